@@ -15,11 +15,12 @@ You should have received a copy of the GNU General Public License along with WAC
 #ifndef _a_settings_h
 #define _a_settings_h
 
+#include <stdint.h>
+
 // IMPORTANT: When adding/removing settings:
 //            1) also update the example config file
 //            2) update the default value in settings.cpp if it's not 0/null
 #define X_SETTING_LIST /* "X Macro" used for settings, also used in the .cpp */ \
-  /*              12345678901324567890 <-- size of settings_defs_t's name field */ \
   X_SETTING(char, deviceName, [32]) \
   X_SETTING(char, deviceGroup, [32]) \
   X_SETTING(char, hostName, [32]) \
@@ -31,30 +32,95 @@ You should have received a copy of the GNU General Public License along with WAC
   X_SETTING(char, backendSecret, [132]) /* bearer token is 128 bytes */ \
   X_SETTING(char, backendURL, [96]) \
   X_SETTING(char, adminIDs, [64]) \
+  X_SETTING(char, mqttBroker, [64]) /* host name or IP address, blank=no MQTT */ \
+  X_SETTING(char, mqttUsername, [32]) \
+  X_SETTING(char, mqttPassword, [64]) \
   X_SETTING(int, backendType, ;) /* 0=none, ... */ \
+  X_SETTING(int, mqttPort, ;) /* default=1883 */ \
   X_SETTING(int, logLevelFile, ;) \
   X_SETTING(int, logLevelSerial, ;) \
   X_SETTING(int, logFileMax, ;) \
   X_SETTING(int, webserverMinutes, ;) /* 0=never, default=99,999,999 */ \
-  X_SETTING(int, readerType, ;) /* 0=none, 1=MFRC522, 2=PN532, 3=rdm6300, 4=Wiegand */ \
+  X_SETTING(int, readerType, ;) /* 0=rdm6300, 1=MFRC522, 2=PN532, 3=rdm6300, 4=Wiegand */ \
+  X_SETTING(int, reader2Type, ;) /* 0=none, else like readerType, uses rx1Pin & tx1Pin */ \
+  X_SETTING(int, beeperPin, ;) /* 0=none, negative=inactive-low/active-high */ \
+  X_SETTING(int, rx2Pin, ;) /* rdm6300, Wiegand D0, etc. */ \
+  X_SETTING(int, tx2Pin, ;) /* rdm6300, Wiegand D1, etc. */ \
+  X_SETTING(int, rx1Pin, ;) /* 2nd reader */ \
+  X_SETTING(int, tx1Pin, ;) /* 2nd reader */ \
+  X_SETTING(int, wiegandBits, ;) /* frame length, 0=26 or 34 */ \
+  X_SETTING(int, powerSave, ;) /* 0=off, 1=light sleep & low CPU frequency when idle */ \
+  X_SETTING(int, tagAwayMilliseconds, ;) /* a tag must be away this long to scan again */ \
+  X_SETTING(int, holdToRun, ;) /* 1=continuous output only while the tag is held there */ \
+  X_SETTING(int, offlineAccess, ;) /* 1=use the local access list when the backend fails */ \
+// end of X_SETTINGs
+
+/*
+Each lock channel has its own output and sensors. Lock 1's settings are at the top of the
+config file, and the settings of lock N are in a "[Lock-N]" section (after the settings
+that aren't in a section). A tag read on reader N controls lock N if it has an Output-Pin,
+otherwise it controls lock 1.
+*/
+#define NUM_LOCKS 2 // at most NUM_READERS
+#define X_LOCK_SETTING_LIST /* like X_SETTING_LIST, for each lock in stg.locks[] */ \
   X_SETTING(int, currentPin, ;) /* 0=none, negative=inactive-low/active-high */ \
+  X_SETTING(int, currentOnLevel, ;) /* analog RMS ADC counts for on, 0=digital currentPin */ \
+  X_SETTING(int, currentOffLevel, ;) /* analog RMS ADC counts for off, 0=3/4 of on */ \
+  X_SETTING(float, currentWattsPerCount, ;) /* analog, for energy usage, 0=not reported */ \
   X_SETTING(int, voltagePin, ;) /* 0=none, negative=inactive-low/active-high */ \
-  X_SETTING(int, beeperPin, ;) /* 0=none, negative=inactive-low/active-high */ \
   X_SETTING(int, outputPin, ;) /* 0=none, negative=inactive-low/active-high */ \
-  X_SETTING(int, rx2Pin, ;) /* rdm6300, etc. */ \
-  X_SETTING(int, tx2Pin, ;) /* rdm6300, etc. */ \
   X_SETTING(int, outputMilliseconds, ;) /* 0=toggle (continuous) */ \
   X_SETTING(int, autoOffMinutes, ;) /* auto-turn off lock (if machine is off), 0=never */ \
-// end of X_SETTINGs
+// end of X_LOCK_SETTINGs
+
+enum settingIndex { // index of each setting in the lists, e.g. si_wifiSSID
+#define X_SETTING(type, name, length) si_##name,
+  X_SETTING_LIST
+  X_LOCK_SETTING_LIST
+#undef X_SETTING
+  si_count
+};
+static_assert(si_count <= 64, "settings changed bitmask needs more bits");
+#define SETTING_BIT(name) (1ULL << si_##name) // bit for changedSettings()
+
+class lockSettings {
+public:
+#define X_SETTING(type, name, length) type name length;
+  X_LOCK_SETTING_LIST
+#undef X_SETTING
+};
 
 class programSettings {
 public:
 #define X_SETTING(type, name, length) type name length;
   X_SETTING_LIST 
 #undef X_SETTING
-  void loadSettings(); // loads from file
+  lockSettings locks[NUM_LOCKS];
+  bool loadSettings(uint32_t &parseMicros); // loads from file, true if it used the snapshot
+  uint64_t changedSettings(const programSettings &old); // returns SETTING_BIT()s of changes
+};
+
+/*
+stg belongs to the I/O task (loop()): after setup(), only that task reads it, and only
+reloadSettings() changes it. The net task loads the new settings into reloadedSettings, and
+reloadSettings() copies them to stg and publishes them with settingsPublish(). Each other
+task reads its own copy of stg, which it updates with refresh(), so the settings never change
+while a task is using them. The copies are made under a lock, so a copy is never half old and
+half new.
+*/
+class settingsCopy : public programSettings {
+public:
+  uint64_t refresh(); // gets the published settings, returns SETTING_BIT()s of changes
+private:
+  uint32_t generation = 0; // of the published settings in this copy, 0=none yet
 };
 
 inline programSettings stg;
+inline settingsCopy netStg; // the net task's copy of stg
+inline settingsCopy webStg; // the web server's (AsyncTCP task's) copy of stg
+inline programSettings reloadedSettings; // the changed config file, see reloadJob() (main.cpp)
+inline uint32_t settingsLoadMicros; // time used by loadSettings() at boot, for serialInfo()
+inline uint32_t settingsParseMicros; // time the config file's last parse took, for serialInfo()
+inline bool settingsFromSnapshot; // true if loadSettings() used the snapshot file at boot
 
 #endif
\ No newline at end of file
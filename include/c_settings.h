@@ -27,13 +27,37 @@ You should have received a copy of the GNU General Public License along with WAC
 #define DEF_WEB_PASSWORD "admin"
 #define DEF_LOG_LEVEL 3
 #define DEF_WEBSERVER_MINUTES 99999999 // enable webserver more-or-less forever
+#define DEF_MQTT_PORT 1883
 #define LCD_TIMER 20 // number of seconds to display temporary LCD messages
 // Wait this long between turning on the machine and checking to see if there's
 //   electrical current because the machine was already on
 #define CURR_CHK_MAX_DELAY 1500 // long enough for sensor response but too short for user
+#define CURR_CHK_INTERVAL 10 // ms after turn-on for the 1st current check, then on sensor changes
+#define SENSOR_DEBOUNCE_MS 20 // current & voltage sensor pins, changes closer than this are bounces
+#define USAGE_SAMPLE_MS 1000 // ms between usage accounting samples while the lock is on
+#define NET_TASK_CORE 0 // same core as the WiFi stack, the I/O task (loop()) is on the other
+#define NET_TASK_STACK 8192 // bytes, same as loop() which used to do the backend lookups
+#define LCD_TASK_CORE 0 // the I2C writes don't delay the I/O task (loop()) on the other core
+#define LCD_TASK_STACK 4096 // bytes
+#define LCD_I2C_TIMEOUT_MS 20 // per I2C transaction, a stuck bus is an error after this
+#define MQTT_TOPIC_ROOT "wacl" // see mqtt.cpp for the topics
+#define MQTT_HEARTBEAT_SECONDS 60 // status messages
+#define MQTT_BACKOFF_MIN_MS 1000 // after a failed connection, doubles up to the max
+#define MQTT_BACKOFF_MAX_MS 64000
+#define MEMBERS_MAX 200 // IDs in the local access list, 68 bytes of RAM each
+#define LCD_RETRY_MS 5000 // time between tries to initialize a display that's not working
+#define CURRENT_TASK_CORE 0 // analog current sampling, the I/O task (loop()) is on the other
+#define CURRENT_TASK_STACK 3072 // bytes
+// Power-Save setting: CPU frequency while idle, and currents for the serialInfo() estimate
+#define POWER_MIN_MHZ 40 // with automatic light sleep, WiFi raises the frequency as needed
+#define POWER_AWAKE_MA 68 // CPU at full speed, WiFi modem sleep (datasheet max)
+#define POWER_IDLE_MA 30 // CPU idle at full speed, WiFi modem sleep (datasheet min)
+#define POWER_SLEEP_MA 3 // light sleep with WiFi waking up for beacons, average (estimate)
 
 #define ENABLE_DNS 0 // enables mDNS server
 #define ENABLE_NTP 1 // enables using NTP server to set time
+#define NTP_SERVER "pool.ntp.org"
+#define ENABLE_MQTT 1 // enables the MQTT client if MQTT-Broker is set
 #define ENABLE_BACKEND_BODGERY_V0 1 // include code for this backend
 #define ENABLE_BACKEND_BODGERY_V1 1 // include code for this backend
 #define ENABLE_BACKEND_GOOGLE_SHEETS 1 // include code for this backend
@@ -44,6 +68,7 @@ You should have received a copy of the GNU General Public License along with WAC
 #define ID_NAME_MAX 50 // for fixed-length buffers
 #define ID_NOT_FOUND -1 // id not found during lookup
 inline constexpr char SETTINGS_FILE[] = "/config.txt"; // LittleFS requires the leading '/'
+inline constexpr char SETTINGS_SNAPSHOT_FILE[] = "/config.bin"; // parsed SETTINGS_FILE
 inline constexpr char LOG_FILE_CURRENT[] = "/log-current.txt";
 inline constexpr char LOG_FILE_OLDER[] = "/log-previous.txt";
 
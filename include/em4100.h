@@ -0,0 +1,70 @@
+// em4100.h - decoder for EM4100 tag frames from an RDM6300 reader
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+#ifndef _em4100_h
+#define _em4100_h
+
+#include <stdint.h>
+
+/*
+The RDM6300 sends a 14-byte frame at 9600 baud each time it reads a tag, over and over
+while the tag is in range:
+  0x02, 10 ASCII hex digits of data (version byte and 32-bit tag ID),
+  2 ASCII hex digits of checksum (XOR of the 5 data bytes), 0x03
+This checks each byte as it arrives, so no frame buffer is needed. Any byte that doesn't
+fit the frame format throws the frame away and the decoder waits for the next 0x02.
+*/
+class em4100Decoder {
+public:
+  // This decodes one byte. It returns true if the byte ends a valid frame and sets the tag ID.
+  bool feed(uint8_t x, uint32_t &tagID) {
+    if (x == 0x02) { // start of frame
+      if (index > 0) framingErrors++; // the previous frame was cut short
+      index = 0;
+      return false;
+    }
+    if (index < 0) return false; // noise between frames
+    if (index < 12) { // data and checksum digits
+      int digit = hexDigit(x);
+      if (digit < 0) { framingErrors++; index = -1; return false; }
+      bytes[index / 2] = (index & 1) ? bytes[index / 2] | digit : digit << 4;
+      index++;
+      return false;
+    }
+    index = -1; // this should be the end of the frame
+    if (x != 0x03) { framingErrors++; return false; }
+    if ((bytes[0] ^ bytes[1] ^ bytes[2] ^ bytes[3] ^ bytes[4]) != bytes[5]) {
+      checksumErrors++;
+      return false;
+    }
+    frames++;
+    tagID = (uint32_t) bytes[1] << 24 | bytes[2] << 16 | bytes[3] << 8 | bytes[4];
+    return true;
+  }
+  // stats
+  uint32_t frames = 0; // valid frames
+  uint32_t checksumErrors = 0;
+  uint32_t framingErrors = 0; // bad characters or frames that were cut short
+private:
+  static int hexDigit(uint8_t x) {
+    if (x >= '0' && x <= '9') return x - '0';
+    if (x >= 'A' && x <= 'F') return x - 'A' + 10;
+    if (x >= 'a' && x <= 'f') return x - 'a' + 10;
+    return -1;
+  }
+  int index = -1; // next digit, -1=waiting for the start of a frame
+  uint8_t bytes[6]; // 5 data bytes and the checksum
+};
+
+#endif
@@ -20,14 +20,18 @@ You should have received a copy of the GNU General Public License along with WAC
 #include <Arduino.h>
 #include <WiFi.h>
 #include <LiquidCrystal_I2C.h>
-#if ENABLE_NTP
-#include <NTPClient.h>
-#endif
 
-#include "timedout.h" // [ms,sec,min]TimedOut classes, softSeconds(), bootTime
+#include "timedout.h" // [ms,sec,min]TimedOut classes, softSeconds(), wallTime(), bootTime
+#include "scheduler.h" // schedTimer class (timed jobs), scheduler
+#include "spsc.h" // spscQueue class (passes data between tasks)
+#include "profiler.h" // jobProfile class (job run-time stats)
+#include "em4100.h" // em4100Decoder class (RDM6300 frames)
+#include "wiegand.h" // wiegandDecoder class
+#include "scan.h" // decideScan()
+#include "presence.h" // uID_t, tag events, presenceEngine class
+#include "members.h" // memberList class (local access list)
 #include "a_settings.h" // stg.* runtime settings
 
-typedef uint32_t uID_t; // type for user id = uid = rfid (someday uint64_t?)
 
 // Global macros
 
@@ -125,52 +129,187 @@ inline int activatedPin(int pin) {
   }
 }
 #define NO_PIN -1
+// The sensors of each lock channel, n is the index in stg.locks[]
+enum sensorIndex { sn_current, sn_voltage, SENSORS_PER_LOCK };
+void sensorsBegin(void); // sensors.cpp
+bool sensorsUpdate(void); // sensors.cpp
+int sensorActive(int n, sensorIndex sensor); // sensors.cpp, like activatedPin() but debounced
+int sensorsFormatStats(char *buffer, size_t size); // sensors.cpp
+size_t sensorsBytesPerLock(void); // sensors.cpp
+void currentBegin(void); // current.cpp
+bool currentAnalog(int n); // current.cpp, true if Current-On-Level is set
+bool currentUpdate(void); // current.cpp
+int currentActive(int n); // current.cpp, like activatedPin(currentPin) but may be analog
+int voltageActive(int n); // current.cpp, like activatedPin(voltagePin)
+bool currentLevel(int n, uint32_t &rms); // current.cpp
+int currentFormatStats(char *buffer, size_t size, int n); // current.cpp
+size_t currentBytesPerLock(void); // current.cpp
+bool currentSampling(void); // current.cpp, the ADC is running (no light sleep)
+
+// Timed jobs, main.cpp
+void startJobs(void);
+void lockJob(void);
+void usageJob(void);
+void adminJob(void);
 
-#define RDM6300_TIMEOUT 500
-class rdm6300Class {
+/*
+Tag readers. Several readers of different types may run at the same time. Each reader
+decodes its input in its own task or interrupt, and it passes valid frames to the I/O
+task through its own queue. The I/O task (readersUpdate()) keeps track of the tag that's
+present at each reader and puts the tag events for all readers in one queue for processID().
+Nothing is allocated after the readers are started.
+*/
+#define NUM_READERS 2
+class tagReader {
 public:
-  void begin(int8_t rxPin = -1, int8_t txPin = -1);
-  uID_t tagID(void);
-  uID_t newTagID(void);
-  void setTimeout(uint32_t x = RDM6300_TIMEOUT);
+  virtual void begin(int8_t pin1, int8_t pin2) = 0; // pins from the settings
+  virtual void end() = 0;
+  virtual const char *type() = 0;
+  virtual int formatStats(char *buffer, size_t size) = 0; // decoder stats
+  virtual int wakePin() { return -1; } // RX pin for Power-Save's wakeup, -1=none
+  virtual bool lightSleepOK() { return true; } // false if it can't wake up in time
+  virtual void update() {} // I/O task, readersUpdate() runs this before reading the frames
+  uint32_t droppedFrames; // the frame queue was full
+protected:
+  void received(uID_t uid, int64_t micros); // reader's task or interrupt: a valid frame
+private:
+  friend void readersUpdate(void);
+  spscQueue<tagFrame, 8> frames; // reader's task or interrupt -> I/O task
 };
-inline rdm6300Class rdm6300;
 
+#define RDM6300_BAUDRATE 9600
+class rdm6300Class : public tagReader {
+public:
+  rdm6300Class(HardwareSerial &x) : serial(x) {}
+  void begin(int8_t rxPin, int8_t txPin) override;
+  void end() override { serial.end(); }
+  const char *type() override { return "rdm6300"; }
+  int formatStats(char *buffer, size_t size) override;
+  int wakePin() override { return rxPin; }
+private:
+  void receive(); // UART event task: decodes the received bytes
+  HardwareSerial &serial;
+  int8_t rxPin = -1;
+  em4100Decoder decoder;
+};
+
+/*
+Wiegand readers use the Rx & Tx pin settings for D0 & D1. The bits are captured by the
+pins' interrupts, and update() gets the frame after it ends.
+*/
+class wiegandClass : public tagReader {
+public:
+  void begin(int8_t d0Pin, int8_t d1Pin) override;
+  void end() override;
+  const char *type() override { return "wiegand"; }
+  int formatStats(char *buffer, size_t size) override;
+  bool lightSleepOK() override { return false; } // the pulses are too short to wake it
+  void update() override;
+private:
+  static void d0ISR(void *arg);
+  static void d1ISR(void *arg);
+  wiegandDecoder decoder;
+  portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED; // for decoder between the ISRs & update()
+  schedTimer frameTimer; // no callback, it wakes up loop() to run update() at the frame's end
+  int8_t pins[2] = {-1, -1}; // D0, D1
+};
+
+inline rdm6300Class rdm6300Reader1(Serial2); // Reader-Type, Rx2-Pin, Tx2-Pin
+inline rdm6300Class rdm6300Reader2(Serial1); // Reader2-Type, Rx1-Pin, Tx1-Pin
+inline wiegandClass wiegandReader1, wiegandReader2; // like rdm6300Reader1 & 2
+inline tagReader *readers[NUM_READERS]; // readers in use, nullptr if none, set by readersBegin()
+void readersBegin(void); // reader.cpp, starts the readers in the settings
+void readersUpdate(void); // reader.cpp, the I/O task runs this to make the tag events
+bool nextTagEvent(tagEvent &x); // reader.cpp, I/O task
+bool tagPresent(uID_t uid); // reader.cpp, I/O task
+int readersFormatStats(char *buffer, size_t size, int index); // reader.cpp
+
+/*
+Usage is billed by the time the machine draws current, not the time it's enabled. While a
+lock is on, usageTimer samples the current sensors every USAGE_SAMPLE_MS. With no current
+sensor, all of the enabled time counts.
+*/
+struct usageSession {
+  uint32_t poweredMillis; // time the machine drew current
+  uint64_t rmsMillis; // analog current sensor: sum of RMS ADC counts x ms, for the energy
+};
+inline schedTimer usageTimer(usageJob); // for all of the locks
+
+/*
+Each lock channel (see X_LOCK_SETTING_LIST) has one of these in locks[]. The jobs that the
+locks' timers run (lockJob() and usageJob()) handle all of the locks.
+*/
 class lockClass {
 public:
+  lockClass() : index(count++) {} // locks[] are numbered in order
   bool isAccessible() { return isAccessibleVar; }
-  void startAccess() { activatePin(stg.outputPin); isAccessibleVar = true;
-    lockTimedout.reset(stg.outputMilliseconds ? stg.outputMilliseconds : CURR_CHK_MAX_DELAY); }
-  void stopAccess() { deactivatePin(stg.outputPin); isAccessibleVar = false; }
+  void startAccess() { activatePin(cfg().outputPin); isAccessibleVar = true;
+    int ms = cfg().outputMilliseconds;
+    lockTimedout.reset(ms ? ms : CURR_CHK_MAX_DELAY);
+    if (ms)
+      lockTimer.start(ms);
+    else
+      lockTimer.start(CURR_CHK_INTERVAL); // then lockJob() runs when a sensor changes
+    usage = {};
+    if (!usageTimer.isActive()) usageTimer.start(USAGE_SAMPLE_MS, USAGE_SAMPLE_MS);
+  }
+  void stopAccess() {
+    deactivatePin(cfg().outputPin); isAccessibleVar = false; lockTimer.stop(); holdID = 0;
+  }
+  // This is run by lockJob(). It returns true if current was detected right after turn-on.
   bool update() {
     if (!isAccessibleVar) return false;
-    if (stg.outputMilliseconds) {
+    if (cfg().outputMilliseconds) {
       if (lockTimedout) stopAccess();
       return false;
     }
-    if (lockTimedout) return false;
+    if (lockTimedout) { lockTimer.stop(); return false; }
     // Got here so it's turned on (accessible) and continuous mode (not pulsed) and not timed-out,
     //   so check current sensor until timer times out
-    if (HIGH == activatedPin(stg.currentPin)) { stopAccess(); return true; } // notify user!
+    if (HIGH == currentActive(index)) { stopAccess(); return true; } // notify user!
     return false;
   }
+  const lockSettings &cfg() { return stg.locks[index]; }
+  bool inUse() { return index == 0 || cfg().outputPin; } // lock 1 is always used
+  const char *label() { return logLabels[index]; } // prefix for log messages
+  const uint8_t index; // in locks[] and stg.locks[]
   minTimedOut autoOffTimedout; // timer for auto-off setting
+  unsigned autoOffStart; // auto-off start time, softSeconds()
   time_t ActivatedTime; // time of lock activation in UTC (not local time)
+  char activeUser[ID_NAME_MAX]; // name of the user who turned on the lock
+  uID_t holdID; // Hold-To-Run: the tag that keeps the lock on, 0=none
+  usageSession usage; // the current session's usage, or the last one's when the lock is off
 private:
+  static inline uint8_t count; // locks constructed so far
+  static constexpr const char *logLabels[] = {"", "Lock 2: ", "Lock 3: ", "Lock 4: "};
+  static_assert(NUM_LOCKS <= sizeof logLabels / sizeof logLabels[0], "add more logLabels");
   bool isAccessibleVar; // true if lock is activated
   // For pulsed-output lock mode, this timer is used to generate the pulse.
-  // For continuous-output lock mode, this timer is used to check for current after turn-on.
+  // For continuous-output lock mode, this timer is used to check for current after turn-on
+  //   (for a machine that's already on, sensor changes are checked as they happen).
   msTimedOut lockTimedout;
+  schedTimer lockTimer{lockJob}; // runs update() at the end of the pulse or to check current
 };
-inline lockClass lock;
+static_assert(NUM_LOCKS <= NUM_READERS, "each lock needs a reader");
+inline lockClass locks[NUM_LOCKS];
 
 /*
 LCD-I2C class customized with added functionality and resetting the display timeout
-when updating the display with the print() function
+when updating the display with the print() function. The print functions only change a
+framebuffer (shownLines), which is also shown remotely (e.g. the web dashboard). loop()
+runs flush(), which posts a copy of the framebuffer to the LCD task if it changed, and the
+LCD task sends just the changed characters to the display (see lcd.cpp). So the I/O task
+never waits for the display, even if the I2C bus is stuck.
 */
+#define LCD_BL 0x08 // PCF8574 backlight pin
+#define LCD_WRITE_THROUGH_BYTES 8 // I2C bytes per character or command from the library
+struct lcdFrame { // I/O task -> LCD task
+  char lines[2][16];
+  uint8_t backlightBit; // LCD_BL or 0
+};
 class MyLcd: public LiquidCrystal_I2C {
 public:
-  using LiquidCrystal_I2C::LiquidCrystal_I2C;
+  MyLcd(pcf8574Address x) : LiquidCrystal_I2C(x), address(x) {}
   size_t printf(const char *format, ...);
   size_t print(const String & x) { addon(); return LiquidCrystal_I2C::print(x); }
   size_t print(const char x[]) { addon(); return LiquidCrystal_I2C::print(x); }
@@ -182,22 +321,56 @@ public:
   size_t print(long x, int y = DEC) { addon(); return LiquidCrystal_I2C::print(x, y); }
   size_t print(unsigned long x, int y = DEC) { addon(); return LiquidCrystal_I2C::print(x, y); }
   // todo? size_t print(const __FlashStringHelper *ifsh) { return print(reinterpret_cast<const char *>(ifsh)); }
-  void init() { begin(16, 2); }
-  void blinkLight() { isBlinked = true; lcdBlinkTimedOut.reset(250); noBacklight(); } // blink backlight
-  void setTimeout() { lcdMsgTimedOut.reset(LCD_TIMER); }
-  bool isTimeoutActive() { return lcdMsgTimedOut.isActive(); }
+  size_t write(uint8_t x) override { mirror(x); return 1; }
+  void clear() { mirrorClear(); writeThroughBytes += LCD_WRITE_THROUGH_BYTES; }
+  void setCursor(uint8_t col, uint8_t row) {
+    cursorCol = col; cursorRow = row; writeThroughBytes += LCD_WRITE_THROUGH_BYTES; }
+  void backlight() { backlightBit = LCD_BL; dirty = true; }
+  void noBacklight() { backlightBit = 0; dirty = true; }
+  const char *shownLine(int line) { return shownLines[line]; } // text currently on the display
+  void init(); // clears the display and starts the LCD task
+  void flush(); // posts the changes for the LCD task
+  // stats
+  uint32_t i2cBytes; // sent by the LCD task
+  uint32_t writeThroughBytes; // estimate of what writing straight through would have sent
+  uint32_t busErrors; // the display was re-initialized after an I2C error or timeout
+  uint32_t deferredFrames; // flush() found the queue full, so it tries again next time
+  void blinkLight() { lcdBlinkTimer.start(250); noBacklight(); } // blink backlight
+  void setTimeout() { lcdMsgTimer.start(LCD_TIMER * 1000); }
+  bool isTimeoutActive() { return lcdMsgTimer.isActive(); }
   void saveLine(int line, const char *str) { strlcpy(savedLines[line], str, sizeof savedLines[0]); }
   void printSaved() { clear(); print(savedLines[0]); setCursor(0, 1); print(savedLines[1]); }
-  void update() {
-    if (lcdMsgTimedOut) { printSaved(); } // update the display after temporarily displaying something
-    if (isBlinked && lcdBlinkTimedOut) { isBlinked = false; backlight(); } // turn backlight back on
-  }
 private:
-  void addon(void) { lcdMsgTimedOut.disable(); } // clear any lcd timeout that may be pending
-  bool isBlinked; // true if lcd is blinked (backlight is off)
-  msTimedOut lcdBlinkTimedOut; // lcd blink (backlight off/on) timer
-  secTimedOut lcdMsgTimedOut; // lcd message timer
+  void addon(void) { lcdMsgTimer.stop(); } // clear any lcd timeout that may be pending
+  static void blinkJob(); // turn backlight back on
+  static void msgJob(); // update the display after temporarily displaying something
+  void mirror(uint8_t x) {
+    if (cursorRow < 2 && cursorCol < 16) shownLines[cursorRow][cursorCol++] = x;
+    writeThroughBytes += LCD_WRITE_THROUGH_BYTES;
+    dirty = true;
+  }
+  void mirrorClear() {
+    memset(shownLines, ' ', sizeof shownLines); shownLines[0][16] = shownLines[1][16] = '\0';
+    cursorCol = cursorRow = 0;
+    dirty = true;
+  }
+  schedTimer lcdBlinkTimer{blinkJob}; // lcd blink (backlight off/on) timer
+  schedTimer lcdMsgTimer{msgJob}; // lcd message timer
   char savedLines[2][17]; // used with the lcd msg timer to update the display
+  char shownLines[2][17]; // framebuffer, what should be on the display
+  uint8_t cursorCol, cursorRow; // cursor position for shownLines[][]
+  uint8_t backlightBit = LCD_BL;
+  bool dirty; // shownLines or backlightBit changed since the last flush()
+  spscQueue<lcdFrame, 2> frames; // the LCD task only needs the latest one
+  // LCD task
+  static void taskLoop(void *);
+  bool reinit();
+  bool render(const lcdFrame &x);
+  TaskHandle_t task;
+  lcdFrame sent; // what is on the display
+  uint8_t lcdCol, lcdRow; // the display's cursor position
+  bool busError = true; // reinit() before the next render()
+  pcf8574Address address;
 };
 inline size_t MyLcd::printf(const char *format, ...)
 {
@@ -207,10 +380,12 @@ inline size_t MyLcd::printf(const char *format, ...)
     int len = vsnprintf(loc_buf, sizeof(loc_buf), format, arg);
     va_end(arg);
     if(len < 0 || len >= (int)sizeof(loc_buf)) return 0;
-    for (int x = 0; x < len; x++) LiquidCrystal_I2C::write(loc_buf[x]);
+    for (int x = 0; x < len; x++) write(loc_buf[x]);
     return len;
 }
 inline MyLcd lcd((pcf8574Address) 0x27); // 0x27=PCF8574 default (more common), 0x3f=PCF8574A
+inline void MyLcd::blinkJob() { lcd.backlight(); }
+inline void MyLcd::msgJob() { lcd.printSaved(); }
 
 class uidAdminClass {
 #define NUM_ADMIN 5
@@ -218,8 +393,7 @@ public:
   void zeroIndex() { index = 0; }
   uID_t next() { return (index < NUM_ADMIN) ? admins[index++] : 0; }
   void load(const char *str);
-  secTimedOut startTimedOut;
-  secTimedOut adminTimedOut;
+  schedTimer adminTimer{adminJob}; // shows admin mode's timeout, see scanMachine (scan.h)
 private:
   bool add(uID_t x) { if (index < NUM_ADMIN) { admins[index++] = x; return 0; } else { return 1; } }
   int index;
@@ -247,17 +421,109 @@ inline void uidAdminClass::load(const char *ptr)
 inline uidAdminClass uidAdmin;
 
 inline uint8_t macAddr[6]; // assigned in setup.cpp
-inline bool rebootRequest; // set by webservercode.cpp, acted upon in main.cpp
-#if ENABLE_NTP
-inline WiFiUDP ntpUDP;
-inline NTPClient timeClientNTP(ntpUDP); // used in main.cpp & setup.cpp
-#endif
+inline uint32_t bootReadyMillis; // time from power-on to the end of setup()
+inline uint32_t firstAcceptMillis; // time from power-on to the 1st accepted scan, 0=none yet
 
 inline minTimedOut webserverTimedout; // initialized in setup.cpp, used by webservercode.cpp,
 
+/*
+Tasks:
+The I/O task is the Arduino loop() task, which runs on core 1 (ARDUINO_RUNNING_CORE). It
+owns the RFID reader, the lock, the LCD, uidAdmin, the scheduler, and stg. The other tasks
+use their own copies of stg (netStg and webStg, see a_settings.h). The net task
+(nettask.cpp) runs on core 0 with the WiFi stack. It does the backend lookups, writes the
+log, loads a changed config file, finishes the WiFi bring-up after boot, runs NTP, MQTT, and
+the WiFi watchdog, and sends the web dashboard updates. It owns the local access list (members.cpp). The web server's
+AsyncTCP task only sends commands to the I/O task, and the MQTT client's callbacks in that
+task only queue events for the net task, as AsyncUDP's callback does with NTP replies. The
+LCD task (lcd.cpp) only writes to the display. The tasks only share data through these
+single-producer single-consumer queues (and MyLcd's queue), so a slow network or display
+never delays the I/O task.
+*/
+enum netRequestType : uint8_t {
+  nr_lookup,
+  nr_add,
+  nr_reload, // load the changed config file into reloadedSettings, then send ne_settingsLoaded
+};
+struct netRequest { // I/O task -> net task
+  netRequestType type;
+  uID_t uid;
+};
+struct netResult { // net task -> I/O task
+  netRequestType type;
+  uID_t uid;
+  int error; // nonzero if the lookup/add failed
+  unsigned long idEnable; // ID_NOT_FOUND if the ID wasn't found
+  char idName[ID_NAME_MAX];
+};
+struct ioStatus { // I/O task -> net task, for the web dashboard
+  char lcd[34]; // the two LCD lines separated by '\n'
+  bool on; // lock.isAccessible()
+  char user[ID_NAME_MAX]; // lock.activeUser
+  time_t activatedTime; // lock.ActivatedTime
+};
+enum ioCommand : uint8_t { // web server (AsyncTCP task) -> I/O task
+  ic_reload, // the config file was changed
+  ic_reboot, // the source of a reboot request should log the reason
+};
+enum netEvent : uint8_t { // net task -> I/O task
+  ne_wifiUp, // the WiFi station got an IP address
+  ne_accessPoint, // WiFi fell back to Access Point mode
+  ne_timeSet, // NTP set the time for the 1st time
+  ne_settingsLoaded, // reloadedSettings is loaded (nr_reload), the I/O task owns it again
+};
+struct usageEvent { // I/O task -> net task, for MQTT
+  uint8_t lock; // index in locks[]
+  bool on; // turned on, else turned off with the usage below
+  char user[ID_NAME_MAX]; // lock.activeUser
+  uint32_t enabledSeconds, poweredSeconds;
+  float wattHours; // negative if it's not measured
+};
+#define LOG_LINE_MAX 256
+struct logLine { // I/O task -> net task
+  uint8_t loglevel;
+  char text[LOG_LINE_MAX];
+};
+inline spscQueue<netRequest, 4> netRequests;
+inline spscQueue<netResult, 4> netResults;
+inline spscQueue<ioStatus, 4> ioStatusUpdates;
+inline spscQueue<ioCommand, 4> ioCommands;
+inline spscQueue<netEvent, 4> netEvents;
+inline spscQueue<logLine, 8> logLines;
+inline spscQueue<usageEvent, 4> usageEvents;
+inline TaskHandle_t ioTask; // set in setup()
+inline TaskHandle_t netTask; // set by startNetTask()
+inline void netWake() { if (netTask) xTaskNotifyGive(netTask); }
+inline void ioRequest(ioCommand x) { ioCommands.push(x); scheduler.wake(); }
+inline void ioNotify(netEvent x) { netEvents.push(x); scheduler.wake(); }
+
 // Functions in other files
 
+void reloadSettings(void); // setup.cpp
+void setupWiFiAccessPoint(void); // setup.cpp
+void startNetTask(void); // nettask.cpp
+void wifiEventsBegin(void); // nettask.cpp
+void mqttBegin(void); // mqtt.cpp
+void mqttJob(void); // mqtt.cpp, run by the net task
+int mqttFormatStats(char *buffer, size_t size); // mqtt.cpp
+bool membersFind(uID_t uid, unsigned long &idEnable, char idName[], bool &fresh); // members.cpp
+void membersStore(uID_t uid, unsigned long idEnable, const char *name, bool pushed); // ditto
+void membersRemove(uID_t uid, bool pushed); // members.cpp
+void membersTrust(bool trusted); // members.cpp
+int membersFormatStats(char *buffer, size_t size); // members.cpp
+void setupPower(void); // power.cpp
+void powerUpdate(void); // power.cpp
+void powerBusy(void); // power.cpp
+void powerIdle(void); // power.cpp
+unsigned powerEstimateMilliamps(unsigned busyPermille, const char **basis); // power.cpp
+void machineTimeoutUpdate(void); // main.cpp
+void showNetAddress(void); // main.cpp
+int lookupID(uID_t uid, unsigned long &idEnable, char idName[]); // main.cpp
+void logFlush(void); // logging.cpp, run by the net task
+void logSettings(const programSettings &s); // logging.cpp
+void settingsPublish(void); // settings.cpp, run by the I/O task when stg changes
 void setupAsyncWebserver(void); // webservercode.cpp
+void webDashboardUpdate(const ioStatus &status); // webservercode.cpp
 String programInfo(void); // info.cpp, used in webservercode.cpp
 time_t localTime(time_t x); // info.cpp
 enum formattedTimeMode { // info.cpp
@@ -272,6 +538,7 @@ const char * formattedTime(time_t t, formattedTimeMode mode = ftm_yyyymmddhhmmss
 void serialInfo(); // info.cpp
 int subnetIP(); // info.cpp
 char * logLatest(void); // logging.cpp
+bool logSince(unsigned &seq, char *line, size_t size); // logging.cpp
 int api_google_sheets(uID_t idTag, unsigned long &idEnable, char idName[]);
 int api_bodgery_v0_lookup(uID_t idTag, unsigned long &idEnable, char idName[]);
 int api_bodgery_v1_lookup(uID_t idTag, unsigned long &idEnable, char idName[]);
@@ -0,0 +1,65 @@
+// memberevent.h - parsing the member events pushed over MQTT
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+#ifndef _memberevent_h
+#define _memberevent_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ArduinoJson.h>
+#include "c_settings.h" // ID_NAME_MAX
+#include "presence.h" // uID_t
+
+/*
+Member events are pushed by the backend to the MQTT members topic (see mqtt.cpp), e.g.
+  {"event":"add","id":1234567,"name":"Jane Doe"}
+  {"event":"remove","id":"0001234567"} or "disable"
+The ID is a number or a string of digits, and it can't be 0.
+*/
+enum memberEventType : uint8_t { me_add, me_remove, me_disable };
+struct memberEvent { // MQTT (AsyncTCP task) -> net task, see mqtt.cpp
+  memberEventType type;
+  uID_t uid;
+  char name[ID_NAME_MAX];
+};
+
+// This parses a member event's payload, it returns false if it isn't one
+inline bool parseMemberEvent(const char *payload, size_t len, memberEvent &event)
+{
+  JsonDocument jsonDoc;
+  if (deserializeJson(jsonDoc, payload, len)) return false;
+  event = {};
+  const char *type = jsonDoc["event"] | "";
+  if (!strcmp(type, "add")) event.type = me_add;
+  else if (!strcmp(type, "remove")) event.type = me_remove;
+  else if (!strcmp(type, "disable")) event.type = me_disable;
+  else return false;
+  JsonVariant id = jsonDoc["id"];
+  if (id.is<const char *>()) {
+    const char *digits = id.as<const char *>();
+    if (!*digits || strspn(digits, "0123456789") != strlen(digits)) return false;
+    unsigned long long x = strtoull(digits, nullptr, 10);
+    if (x > UINT32_MAX) return false;
+    event.uid = x;
+  } else if (id.is<uint32_t>()) {
+    event.uid = id.as<uint32_t>();
+  }
+  if (!event.uid) return false;
+  snprintf(event.name, ID_NAME_MAX, "%s", jsonDoc["name"] | ".");
+  return true;
+}
+
+#endif
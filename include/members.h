@@ -0,0 +1,98 @@
+// members.h - the local access list
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+#ifndef _members_h
+#define _members_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "c_settings.h" // MEMBERS_MAX, ID_NAME_MAX
+#include "presence.h" // uID_t
+
+/*
+The local access list holds the IDs from recent lookups and from member events (see
+memberevent.h), so lookupID() can decide without the backend. An entry is "fresh" if it was
+stored while the MQTT subscription was up, and the subscription has stayed up since, because
+any change to it since then was pushed. Each time the subscription comes up or goes down,
+the epoch changes, so entries from before it came up are stale too: a change between a
+lookup and the subscription wasn't pushed. Stale entries are only used when the backend
+fails, if the Offline-Access setting is on. When the list is full, the least recently used
+entry is replaced. Times are seconds (softSeconds()). The net task owns it (members.cpp).
+*/
+template <int SIZE>
+class memberList {
+public:
+  // This returns true if the ID is in the list, and fresh is true if it's up to date
+  bool find(uID_t uid, unsigned long &idEnable, char idName[], bool &fresh, uint32_t now) {
+    member *x = slot(uid);
+    if (!x) return false;
+    idEnable = x->idEnable;
+    snprintf(idName, ID_NAME_MAX, "%s", x->name);
+    fresh = trusted && x->epoch == epoch;
+    x->usedSeconds = now;
+    if (fresh) hits++;
+    else staleHits++;
+    return true;
+  }
+  // This adds or updates an ID, from a lookup or a push
+  void store(uID_t uid, unsigned long idEnable, const char *name, bool pushed, uint32_t now) {
+    member *x = slot(uid);
+    if (!x && count < SIZE) {
+      x = &members[count++];
+    } else if (!x) { // full, replace the least recently used
+      x = &members[0];
+      for (int i = 1; i < SIZE; i++)
+        if ((int32_t) (members[i].usedSeconds - x->usedSeconds) < 0) x = &members[i];
+    }
+    x->uid = uid;
+    x->idEnable = idEnable ? 1 : 0;
+    x->epoch = epoch;
+    x->usedSeconds = now;
+    snprintf(x->name, ID_NAME_MAX, "%s", name);
+    if (pushed) pushes++;
+  }
+  void remove(uID_t uid, bool pushed) {
+    member *x = slot(uid);
+    if (x) *x = members[--count];
+    if (pushed) pushes++;
+  }
+  // This is called when the MQTT subscription comes up (true) or goes down (false)
+  void trust(bool up) {
+    if (up != trusted) epoch++;
+    trusted = up;
+  }
+  bool isTrusted() const { return trusted; }
+  int size() const { return count; }
+  uint32_t hits = 0, staleHits = 0, pushes = 0;
+private:
+  struct member {
+    uID_t uid;
+    int32_t idEnable; // 0=disabled, 1=enabled
+    uint32_t epoch; // when it was stored
+    uint32_t usedSeconds; // when it was stored or found
+    char name[ID_NAME_MAX];
+  };
+  member *slot(uID_t uid) {
+    for (int i = 0; i < count; i++)
+      if (members[i].uid == uid) return &members[i];
+    return nullptr;
+  }
+  member members[SIZE];
+  int count = 0;
+  uint32_t epoch = 1; // entries stored in other epochs are stale
+  bool trusted = false; // the MQTT subscription is up
+};
+
+#endif
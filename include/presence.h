@@ -0,0 +1,138 @@
+// presence.h - turns the readers' tag frames into tag events
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _presence_h
+#define _presence_h
+
+#include <stdint.h>
+#include <string.h>
+#include "spsc.h" // spscQueue class
+
+typedef uint32_t uID_t; // type for user id = uid = rfid (someday uint64_t?)
+
+#define TAG_TIMEOUT 500 // ms, the readers send frames more often than this while a tag is there
+#define TAG_AWAY_MS 1000 // default for the Tag-Away-Milliseconds setting
+#define TAG_PRESENT_MS 250
+
+/*
+Tag events from the readers. A tag arrives when it's read after being away from that reader
+for the Tag-Away-Milliseconds setting. It's still present each TAG_PRESENT_MS while it keeps
+being read, and it departs when it has been away for that long or another tag arrives.
+Other reads are suppressed, see presenceEngine.
+*/
+enum tagEventType : uint8_t { te_arrived, te_present, te_departed };
+struct tagEvent {
+  tagEventType type;
+  uint8_t reader; // reader number, 1 or 2
+  uID_t uid;
+  int64_t micros; // monoMicros() when the tag was read
+};
+struct tagFrame { // a valid frame from a reader
+  uID_t uid;
+  int64_t micros; // monoMicros() when it was received
+};
+
+/*
+The presence engine keeps the first and last time each recent tag was read at each reader.
+A tag only counts as a new scan (te_arrived) after it has been away from that reader for
+the Tag-Away-Milliseconds setting, so a tag resting on a reader that isn't read now and
+then, or that's read again after another tag was scanned, doesn't turn into extra scans.
+The present tag departs after it's away for that long too.
+The I/O task owns it (reader.cpp). It doesn't allocate or use the hardware, so the event
+path can be tested and benchmarked on the host.
+*/
+#define RECENT_TAGS 8
+template <int READERS, unsigned EVENTS>
+class presenceEngine {
+public:
+  // This turns a valid frame from a reader (index) into tag events
+  void frame(int reader, const tagFrame &f, int64_t awayMicros) {
+    readerState &r = readers[reader];
+    sighting *seen = findSighting(reader, f.uid);
+    int64_t away = seen->uid ? f.micros - seen->lastMicros : INT64_MAX;
+    seen->lastMicros = f.micros;
+    if (away >= awayMicros) { // a new scan
+      *seen = {f.uid, (uint8_t) reader, f.micros, f.micros};
+      if (r.presentID) addEvent(te_departed, reader, r.presentID, f.micros);
+      r.presentID = f.uid;
+      r.presentMicros = f.micros;
+      r.lastMicros = f.micros;
+      addEvent(te_arrived, reader, f.uid, f.micros);
+    } else if (f.uid != r.presentID) { // read again after another tag was scanned
+      r.suppressedScans++;
+    } else {
+      if (away >= TAG_TIMEOUT * 1000) r.suppressedScans++; // it wasn't read for a while
+      r.lastMicros = f.micros;
+      if (f.micros - r.presentMicros >= TAG_PRESENT_MS * 1000) {
+        r.presentMicros = f.micros;
+        addEvent(te_present, reader, f.uid, f.micros);
+      }
+    }
+  }
+  // This makes the departed events that are due and returns the time of the next one, or
+  // INT64_MAX if no tag is present
+  int64_t depart(int64_t now, int64_t awayMicros) {
+    int64_t next = INT64_MAX;
+    for (int i = 0; i < READERS; i++) {
+      readerState &r = readers[i];
+      if (!r.presentID) continue;
+      int64_t departs = r.lastMicros + awayMicros;
+      if (departs <= now) {
+        addEvent(te_departed, i, r.presentID, now);
+        r.presentID = 0;
+      } else if (departs < next) {
+        next = departs;
+      }
+    }
+    return next;
+  }
+  bool nextEvent(tagEvent &x) { return events.pop(x); }
+  void forget() { memset(recentTags, 0, sizeof recentTags); } // the readers were restarted
+  uID_t presentID(int reader) const { return readers[reader].presentID; } // zero=none
+  uint32_t suppressedScans(int reader) const { return readers[reader].suppressedScans; }
+  uint32_t droppedEvents() const { return dropped; } // the event queue was full
+private:
+  struct sighting {
+    uID_t uid; // 0=unused
+    uint8_t reader; // index
+    int64_t firstMicros; // when it arrived
+    int64_t lastMicros; // when it was last read
+  };
+  struct readerState {
+    uID_t presentID; // tag that's present or zero
+    int64_t presentMicros; // time of the last te_arrived or te_present event
+    int64_t lastMicros; // time of the last frame
+    uint32_t suppressedScans; // reads that would have been extra scans without presence
+  };
+  // This returns the sighting of the tag at the reader, or the oldest one to be replaced
+  sighting *findSighting(int reader, uID_t uid) {
+    sighting *oldest = recentTags;
+    for (sighting *x = recentTags; x < recentTags + RECENT_TAGS; x++) {
+      if (x->uid == uid && x->reader == reader) return x;
+      if (x->lastMicros < oldest->lastMicros) oldest = x;
+    }
+    oldest->uid = 0;
+    return oldest;
+  }
+  void addEvent(tagEventType type, int reader, uID_t uid, int64_t micros) {
+    if (!events.push({type, (uint8_t) (reader + 1), uid, micros})) dropped++;
+  }
+  sighting recentTags[RECENT_TAGS] = {};
+  readerState readers[READERS] = {};
+  spscQueue<tagEvent, EVENTS> events; // I/O task -> processID()
+  uint32_t dropped = 0;
+};
+
+#endif
@@ -0,0 +1,55 @@
+// profiler.h - job run-time profiling with log2 histograms
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+#ifndef _profiler_h
+#define _profiler_h
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+/*
+A jobProfile measures how long a job takes using esp_timer's microsecond clock. It keeps the
+count, min, max, and mean, and a log2 histogram of the times in microseconds. The clock
+doesn't depend on the CPU frequency, so times stay right when power management changes it
+in the middle of a job. It only costs a fraction of a microsecond per measurement, so it's
+always on. Each profile must only be used by one task. All profiles are listed in the ' '
+serial command and in the web status. Example:
+  static jobProfile blinkProfile("blink");
+  blinkProfile.start();
+  ToggleLED();
+  blinkProfile.stop();
+*/
+#define PROFILE_BUCKETS 21 // bucket 0 is 0 us, bucket n is 2^(n-1) to 2^n-1 us, the last is more
+
+class jobProfile {
+public:
+  jobProfile(const char *x) : name(x), next(first) { first = this; }
+  void start() { startMicros = esp_timer_get_time(); }
+  void stop() { record(esp_timer_get_time() - startMicros); }
+  void record(uint32_t micros); // for times measured some other way
+  int format(char *buffer, size_t size); // one line of text, returns the snprintf() value
+  static inline jobProfile *first; // list of all profiles, for reporting
+  jobProfile *nextProfile() { return next; }
+private:
+  const char *name;
+  jobProfile *next;
+  int64_t startMicros;
+  uint32_t count;
+  uint32_t minMicros;
+  uint32_t maxMicros;
+  uint64_t totalMicros;
+  uint32_t histogram[PROFILE_BUCKETS];
+};
+
+#endif
@@ -0,0 +1,127 @@
+// rms.h - RMS estimator for AC current sensor samples
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+#ifndef _rms_h
+#define _rms_h
+
+#include <stdint.h>
+
+/*
+This estimates the RMS of the AC part of a sampled waveform (e.g. a current transformer's
+output biased to the middle of the ADC's range) over whole cycles of the line frequency.
+Each window starts at a rising zero crossing and ends at the RMS_CYCLES-th crossing after
+it, so a partial cycle never skews the result, and 50 Hz and 60 Hz both work. A zero
+crossing is when the samples go from below the last window's mean minus a hysteresis to
+above the mean plus the hysteresis, and at least a cycle at 75 Hz after the last one, so
+noise doesn't make extra crossings. If there are no crossings (e.g. no current, just
+noise), a window ends after maxSamples anyway. A window only counts as synced if all its
+cycles are between 45 Hz and 65 Hz and about the same length: noise can still cross often
+enough to make RMS_CYCLES crossings, but then the 75 Hz gate makes its cycles too short, or
+they vary.
+The math is all integer: the window's sums give the variance, n*sum(x^2) - sum(x)^2 over
+n^2, and the RMS is its square root, with RMS_FRAC_BITS fraction bits.
+*/
+#define RMS_CYCLES 6 // cycles per window, 100 ms at 60 Hz
+#define RMS_FRAC_BITS 4
+#define RMS_MIN_HYSTERESIS 8 // ADC counts
+#define RMS_PERIOD_SPREAD 16 // a window's cycles can differ by 1/16 of the longest + 1 sample
+
+class rmsEstimator {
+public:
+  // samplesPerSecond is used for maxSamples, the window for no crossings (RMS_CYCLES at 40 Hz)
+  void begin(uint32_t samplesPerSecond) {
+    maxSamples = samplesPerSecond * RMS_CYCLES / 40;
+    minCycle = samplesPerSecond / 75;
+    minPeriod = samplesPerSecond / 65;
+    maxPeriod = samplesPerSecond / 45;
+    sinceCrossing = 0;
+    below = false;
+    synced = false;
+    reset();
+  }
+  // This adds a sample, it returns true if it ended a window and there's a new estimate
+  bool feed(int x) {
+    bool done = false;
+    sinceCrossing++;
+    if (below && x > reference + hysteresis && sinceCrossing >= minCycle) { // rising crossing
+      below = false;
+      if (!synced) { // start the first window at this crossing
+        synced = true;
+        reset();
+      } else {
+        if (sinceCrossing < shortest) shortest = sinceCrossing;
+        if (sinceCrossing > longest) longest = sinceCrossing;
+        if (++cycles == RMS_CYCLES) {
+          finish(shortest >= minPeriod && longest <= maxPeriod &&
+            longest - shortest <= longest / RMS_PERIOD_SPREAD + 1);
+          done = true;
+        }
+      }
+      sinceCrossing = 0;
+    } else if (!below && x < reference - hysteresis) {
+      below = true;
+    }
+    n++;
+    sum += x;
+    sumSquares += (int64_t) x * x;
+    if (n >= maxSamples) { // no crossings, or too few of them
+      finish(false);
+      synced = false;
+      done = true;
+    }
+    return done;
+  }
+  uint32_t rms() { return (rmsFrac + (1 << (RMS_FRAC_BITS - 1))) >> RMS_FRAC_BITS; } // counts
+  uint32_t rmsFrac = 0; // the latest RMS, ADC counts with RMS_FRAC_BITS fraction bits
+  int mean = 0; // the latest mean, ADC counts
+  uint32_t windows = 0; // number of estimates
+  uint32_t unsyncedWindows = 0; // estimates without whole, steady cycles (e.g. no current)
+private:
+  void reset() { n = 0; sum = 0; sumSquares = 0; cycles = 0; shortest = UINT32_MAX; longest = 0; }
+  void finish(bool whole) {
+    if (n == 0) return;
+    int64_t variance = (int64_t) n * sumSquares - sum * sum; // times n^2
+    if (variance < 0) variance = 0;
+    rmsFrac = isqrt(((uint64_t) variance << (2 * RMS_FRAC_BITS)) / ((uint64_t) n * n));
+    mean = sum / n;
+    reference = mean;
+    hysteresis = rms() / 2 > RMS_MIN_HYSTERESIS ? rms() / 2 : RMS_MIN_HYSTERESIS;
+    windows++;
+    if (!whole) unsyncedWindows++;
+    reset();
+  }
+  static uint32_t isqrt(uint64_t x) { // integer square root, rounded down
+    uint64_t result = 0;
+    for (uint64_t bit = 1ULL << 62; bit; bit >>= 2) {
+      if (x >= result + bit) {
+        x -= result + bit;
+        result = (result >> 1) + bit;
+      } else {
+        result >>= 1;
+      }
+    }
+    return result;
+  }
+  uint32_t n, maxSamples, minCycle, sinceCrossing;
+  uint32_t minPeriod, maxPeriod; // the cycle lengths of 65 Hz and 45 Hz, samples
+  uint32_t shortest, longest; // the window's shortest and longest cycles, samples
+  int64_t sum, sumSquares;
+  int cycles; // rising crossings since the window started
+  int reference = 2048; // the zero level, ADC counts (the middle of the range at first)
+  int hysteresis = RMS_MIN_HYSTERESIS;
+  bool below; // the last crossing was falling
+  bool synced; // the window started at a rising crossing
+};
+
+#endif
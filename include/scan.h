@@ -0,0 +1,144 @@
+// scan.h - what to do with a scanned tag
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+#ifndef _scan_h
+#define _scan_h
+
+#include <stdint.h>
+#include "c_settings.h" // ID_NOT_FOUND
+#include "timedout.h" // secTimedOut, monoMillis()
+
+/*
+decideScan() decides what a scan does from the lookup result and the state of the lock
+and sensors, without doing any of it, so it doesn't depend on the hardware. scanMachine
+(below) gathers the inputs, and main.cpp carries out the decision.
+*/
+struct scanInputs {
+  int error; // nonzero if the lookup failed
+  bool found; // the ID has a record
+  bool enabled; // the ID's access is enabled
+  bool admin; // the ID is one of the Admin-IDs
+  bool adminMode; // adding IDs by scanning them
+  bool adminSecondScan; // the last admin scan was less than 10 seconds ago
+  bool lockOn; // the lock/output is on (lock.isAccessible())
+  bool voltageOn; // the voltage sensor senses the machine is on
+  bool currentOn; // the current sensor senses the machine is running
+  bool holdToRun; // the Hold-To-Run setting
+  bool tagPresent; // the tag is still on the reader
+};
+
+enum scanAction : uint8_t {
+  sa_lookupFailed,
+  sa_noRecord,
+  sa_adminStart, // 2nd admin scan in a row
+  sa_adminStop, // admin scan in admin mode
+  sa_add, // add the ID in admin mode
+  sa_denied,
+  sa_turnOffFirst, // the machine is on (voltage) while the lock is off, turn it off & rescan
+  sa_holdRemoved, // Hold-To-Run: the tag was removed during the lookup
+  sa_turnOn,
+  sa_stopFirst, // the machine is running (current), turn it off before turning the lock off
+  sa_turnOff,
+};
+
+struct scanDecision {
+  scanAction action;
+  bool adminFirstScan; // 1st admin scan, it's also a normal scan
+};
+
+inline scanDecision decideScan(const scanInputs &x)
+{
+  if (x.error) return {sa_lookupFailed, false};
+  if (!x.found) return {sa_noRecord, false};
+  bool adminFirstScan = false;
+  if (x.admin) {
+    if (x.adminMode) return {sa_adminStop, false};
+    if (x.adminSecondScan) return {sa_adminStart, false};
+    adminFirstScan = true;
+  }
+  if (x.adminMode) return {sa_add, false};
+  if (!x.enabled) return {sa_denied, adminFirstScan};
+  if (!x.lockOn) {
+    if (x.voltageOn) return {sa_turnOffFirst, adminFirstScan};
+    if (x.holdToRun && !x.tagPresent) return {sa_holdRemoved, adminFirstScan};
+    return {sa_turnOn, adminFirstScan};
+  }
+  if (x.currentOn) return {sa_stopFirst, adminFirstScan};
+  return {sa_turnOff, adminFirstScan};
+}
+
+/*
+scanMachine is the scan state machine (see processID() in main.cpp) without the hardware:
+  ss_idle:   a tag arrives -> arrived() -> ss_lookup, the I/O task sends the lookup
+  ss_lookup: the lookup result -> lookupDone() -> decideScan() -> ss_idle, or ss_add when
+             an ID is added in admin mode, and the I/O task sends the add request
+  ss_add:    the add result -> addDone() -> ss_idle
+Tags that arrive while a lookup or add is pending are ignored. It also keeps the admin
+window: two admin scans less than ADMIN_WINDOW_SECONDS apart start admin mode, which ends
+ADMIN_TIMEOUT_MS after the last scan, or at another admin scan. The I/O task owns it.
+*/
+#define ADMIN_WINDOW_SECONDS 10
+#define ADMIN_TIMEOUT_MS 50000
+enum scanStateType : uint8_t { ss_idle, ss_lookup, ss_add };
+
+struct scanLookup { // a lookup result and the lock's state, see scanInputs
+  int error;
+  unsigned long idEnable; // ID_NOT_FOUND if the ID wasn't found
+  bool admin; // the ID is one of the Admin-IDs
+  bool lockOn, voltageOn, currentOn, holdToRun, tagPresent;
+};
+
+class scanMachine {
+public:
+  scanStateType state() const { return current; }
+  // A tag arrived, this returns true if it starts a lookup
+  bool arrived() {
+    if (current != ss_idle) return false; // one lookup at a time
+    current = ss_lookup;
+    return true;
+  }
+  void cancel() { current = ss_idle; } // the request couldn't be sent
+  // This decides what a lookup result does, and keeps the admin window and admin mode
+  scanDecision lookupDone(const scanLookup &x) {
+    scanInputs in = {};
+    in.error = x.error;
+    in.found = x.idEnable != (unsigned long) ID_NOT_FOUND;
+    in.enabled = x.idEnable != 0;
+    in.adminMode = adminMode();
+    in.admin = !in.error && in.found && x.admin;
+    in.adminSecondScan = in.admin && !in.adminMode && !windowTimedOut;
+    in.lockOn = x.lockOn;
+    in.voltageOn = x.voltageOn;
+    in.currentOn = x.currentOn;
+    in.holdToRun = x.holdToRun;
+    in.tagPresent = x.tagPresent;
+    if (in.adminMode && !in.error && in.found) // keep it on while scanning key fobs
+      adminEnds = monoMillis() + ADMIN_TIMEOUT_MS;
+    scanDecision decision = decideScan(in);
+    if (decision.adminFirstScan) windowTimedOut.reset(ADMIN_WINDOW_SECONDS);
+    if (decision.action == sa_adminStart) adminEnds = monoMillis() + ADMIN_TIMEOUT_MS;
+    if (decision.action == sa_adminStop) adminEnds = 0;
+    current = decision.action == sa_add ? ss_add : ss_idle;
+    return decision;
+  }
+  void addDone() { current = ss_idle; }
+  bool adminMode() const { return adminEnds > monoMillis(); }
+  uint32_t adminMillisLeft() const { return adminMode() ? adminEnds - monoMillis() : 0; }
+private:
+  scanStateType current = ss_idle;
+  secTimedOut windowTimedOut; // the 2nd admin scan's window, from the 1st one
+  int64_t adminEnds = 0; // monoMillis() when admin mode ends
+};
+
+#endif
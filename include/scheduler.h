@@ -0,0 +1,76 @@
+// scheduler.h - timer wheel scheduler for timed jobs
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+#ifndef _scheduler_h
+#define _scheduler_h
+
+#include <Arduino.h>
+#include "timedout.h" // monoMillis()
+
+/*
+Timed jobs are callbacks run by a hierarchical timer wheel (like the classic Linux kernel
+timers). Starting, stopping, and expiring a timer are O(1), and the main loop sleeps until
+the next timer is due or until something calls scheduler.wake(), instead of checking every
+timer on every loop iteration. Timers are only used by the main loop's task. Example:
+  static void blinkJob() { ToggleLED(); }
+  static schedTimer blinkTimer(blinkJob);
+  blinkTimer.start(500, 500); // milliseconds until the 1st callback, then the repeat period
+  blinkTimer.stop();
+*/
+typedef void (*timerCallback)(void);
+
+class schedTimer {
+public:
+  schedTimer(timerCallback x = nullptr) : callback(x), pprev(nullptr) {}
+  void start(uint32_t ms, uint32_t periodMs = 0); // periodMs=0 for one-time timers
+  void stop();
+  bool isActive() { return pprev != nullptr; } // true if started and not expired/stopped
+  timerCallback callback;
+private:
+  friend class schedulerClass;
+  schedTimer *next; // list of timers in the same wheel slot
+  schedTimer **pprev; // pointer to the pointer to this timer, nullptr if not active
+  uint32_t expires; // tick when this times out
+  uint32_t period; // ms, 0=one-time
+};
+
+#define WHEEL_LEVELS 4
+#define WHEEL_BITS 6 // 64 slots per level, 1 ms per slot in level 0
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+
+class schedulerClass {
+public:
+  void begin(); // call from the main loop's task before using wait()
+  void run(); // runs the callbacks of the timers that are due
+  void wait(); // sleeps until the next timer is due or wake() is called
+  void wake(); // this may be called from other tasks, but not from interrupts
+  void wakeFromISR(); // this is wake() for interrupts
+  uint32_t wakeups; // number of times wait() returned, for reporting
+  uint64_t busyMicros; // time not spent in wait(), for reporting
+private:
+  friend class schedTimer;
+  void add(schedTimer *timer);
+  void cascade(int level, int slot);
+  void runSlot(int slot);
+  uint32_t msUntilNext();
+  schedTimer *wheel[WHEEL_LEVELS][WHEEL_SLOTS]; // lists of timers
+  uint64_t occupied[WHEEL_LEVELS]; // slots that may have timers, cleared when processed
+  uint32_t tick; // next tick to be processed, ticks are the low 32 bits of monoMillis()
+  uint32_t lastWake; // micros() when wait() returned
+  TaskHandle_t task; // the main loop's task
+};
+
+inline schedulerClass scheduler;
+
+#endif
@@ -0,0 +1,182 @@
+// settingsparse.h - looks up and stores the config file's settings
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _settingsparse_h
+#define _settingsparse_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "a_settings.h" // programSettings
+
+/*
+This is the part of loading the settings that doesn't depend on the file system or
+logging, so it can be tested and benchmarked on the host. settings.cpp reads the file and
+logs the errors.
+*/
+
+// Definitions for each setting, used to transfer the settings stored in the
+// file to the variables in the program
+enum settingType : uint8_t { st_char, st_int, st_float };
+typedef struct {
+  const char *name; // e.g. "wifiPassword" or "webserverMinutes"
+  settingType type; // from "char" or "int" or "float"
+  bool perLock; // from X_LOCK_SETTING_LIST
+  uint16_t size; // size of the variable, e.g. 32 for char[32]
+  uint16_t offset; // offset of the variable in the programSettings or lockSettings class
+} settings_defs_t;
+inline constexpr settings_defs_t settingsDefs[] = {
+  #define X_SETTING(type, name, length) \
+    { #name, st_##type, false, sizeof programSettings::name, offsetof(programSettings, name) },
+  X_SETTING_LIST 
+  #undef X_SETTING
+  #define X_SETTING(type, name, length) \
+    { #name, st_##type, true, sizeof lockSettings::name, offsetof(lockSettings, name) },
+  X_LOCK_SETTING_LIST
+  #undef X_SETTING
+};
+#define NUM_SETTINGS (int) (sizeof settingsDefs / sizeof settingsDefs[0])
+
+/*
+Setting names are looked up with a perfect hash that's made by the compiler. The hash
+ignores case, '-', and '_', so it can be used on both the names in settingsDefs[] and the
+names in the file. The compiler searches for a seed that gives each setting its own slot.
+*/
+#define HASH_BITS 7 // 2^HASH_BITS must be more than NUM_SETTINGS, ~4x for a quick seed search
+#define HASH_SLOTS (1 << HASH_BITS)
+#define hashSlot(hash) ((hash) >> (32 - HASH_BITS)) // FNV's upper bits are the best mixed
+constexpr uint32_t settingHash(const char *str, uint32_t seed)
+{
+  uint32_t hash = 2166136261u ^ seed; // FNV-1a
+  for (; *str; str++) {
+    char c = *str;
+    if (c == '-' || c == '_') continue;
+    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    hash = (hash ^ (uint8_t) c) * 16777619u;
+  }
+  return hash;
+}
+constexpr uint32_t settingsHashSeed()
+{
+  for (uint32_t seed = 0; seed < 100000; seed++) {
+    bool used[HASH_SLOTS] = {};
+    bool collision = false;
+    for (int x = 0; x < NUM_SETTINGS && !collision; x++) {
+      uint32_t slot = hashSlot(settingHash(settingsDefs[x].name, seed));
+      collision = used[slot];
+      used[slot] = true;
+    }
+    if (!collision) return seed;
+  }
+  return UINT32_MAX;
+}
+inline constexpr uint32_t hashSeed = settingsHashSeed();
+static_assert(hashSeed != UINT32_MAX, "No perfect hash for settings, increase HASH_SLOTS");
+inline constexpr struct settingsHashTable {
+  int8_t index[HASH_SLOTS]; // index into settingsDefs[] or -1 for an unused slot
+  constexpr settingsHashTable() : index() {
+    for (int x = 0; x < HASH_SLOTS; x++) index[x] = -1;
+    for (int x = 0; x < NUM_SETTINGS; x++)
+      index[hashSlot(settingHash(settingsDefs[x].name, hashSeed))] = x;
+  }
+} settingsHash;
+
+// This compares setting names and returns true if they match. Both strings are
+// assumed to be null-terminated. The file string is assumed to be lowercase and
+// not containing '-' or '_'. The program string is case insensitive.
+inline bool nameMatch(const char *pgmStr, const char *fileStr)
+{
+  bool eos1 = false, eos2 = false; // end of string
+  for (;;) {
+    if (*pgmStr == '_') { pgmStr++; continue; } // skip '_' in settingsDefs[]
+    if (*pgmStr == '\0') eos1 = true;
+    if (*fileStr == '\0') eos2 = true;
+    if (eos1 && eos2) return true; // identical contents and lengths
+    if (tolower(*pgmStr) != *fileStr) return false; // different contents
+    if (eos1 || eos2) return false; // different lengths
+    pgmStr++; fileStr++;
+  }
+}
+
+// This makes a name from the file all lowercase and removes '-' & '_'
+inline void normalizeName(char *dest, const char *src, size_t size)
+{
+  char *end = dest + size - 1;
+  for (; *src && dest < end; src++) {
+    if (*src != '-' && *src != '_') *dest++ = tolower(*src);
+  }
+  *dest = '\0';
+}
+
+// This returns the index of a "[Lock-N]" section's lock, 0 for no section, or -1 if it's
+// not a lock section
+inline int sectionLock(const char *section)
+{
+  char name[32];
+  normalizeName(name, section, sizeof name);
+  if (!*name) return 0;
+  if (strncmp(name, "lock", 4)) return -1;
+  char *end;
+  long n = strtol(name + 4, &end, 10);
+  return (*end || n < 1 || n > NUM_LOCKS) ? -1 : n - 1;
+}
+
+/*
+This stores one setting from the file in s. It returns the setting's definition, or
+nullptr if the name is unknown (*badSection=false) or the setting can't be in the
+section (*badSection=true).
+*/
+inline const settings_defs_t *storeSetting(programSettings &s, const char *section,
+  const char *name, const char *value, bool *badSection)
+{
+  char settingName[100];
+
+  *badSection = false;
+  normalizeName(settingName, name, sizeof settingName);
+  int x = settingsHash.index[hashSlot(settingHash(settingName, hashSeed))];
+  if (x < 0 || !nameMatch(settingsDefs[x].name, settingName)) return nullptr;
+  const settings_defs_t &def = settingsDefs[x];
+  int lockIndex = sectionLock(section);
+  if (lockIndex < 0 || (lockIndex > 0 && !def.perLock)) {
+    *badSection = true;
+    return nullptr;
+  }
+  char *base = def.perLock ? (char *) &s.locks[lockIndex] : (char *) &s;
+  void *ptr = base + def.offset; // pointer to the variable in the program
+  switch (def.type) { // set the variable to the value
+    case st_int:
+      * (int *) ptr = strtol(value, nullptr, 10);
+      break;
+    case st_float:
+      * (float *) ptr = atof(value);
+      break;
+    case st_char: {
+      size_t length = strlen(value);
+      if (length >= 2 && (value[0] == '"' || value[0] == '\'') && value[length - 1] == value[0]) {
+        value++; // quoted
+        length -= 2;
+      }
+      if (length > def.size - 1u) length = def.size - 1u;
+      memcpy(ptr, value, length);
+      ((char *) ptr)[length] = '\0';
+      break;
+    }
+  }
+  return &def;
+}
+
+#endif
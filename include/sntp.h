@@ -0,0 +1,174 @@
+// sntp.h - SNTP packets and a drift-compensated wall clock
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+#ifndef _sntp_h
+#define _sntp_h
+
+#include <stdint.h>
+#include <atomic>
+
+/*
+The wall clock is a line through the monotonic clock (monoMicros()): wall = wallBase + dt plus
+the oscillator's drift (freqPpb) times dt, plus a slew for part of dt, where dt is the time
+since monoBase. Each SNTP sample compares the server's time with the line:
+- The first sample, and any offset over SNTP_STEP_US, steps the clock (sets the line).
+- Smaller offsets are slewed: the clock runs SNTP_SLEW_PPM fast or slow until the offset is
+  gone, so the time never jumps and never goes backwards.
+- The part of an offset that the last slew didn't already plan to remove is drift, so it
+  corrects freqPpb by a fraction (1/SNTP_FREQ_GAIN) of that error over the sample interval.
+- Samples with small drift errors make the poll interval longer, up to 2^SNTP_MAX_POLL
+  seconds, and a large error makes it shorter again, down to 2^SNTP_MIN_POLL seconds.
+Only the net task calls sample(). Any task may call micros(), it reads a copy of the line
+that sample() doesn't change while it's in use, so it never waits for the net task.
+All times are microseconds: t1/t4 are monoMicros() when the request was sent/the reply was
+received, and t2/t3 are the server's wall times when it received/sent, see sntpParse().
+*/
+#define SNTP_STEP_US 1000000 // larger offsets step the clock instead of slewing it
+#define SNTP_MAX_DELAY_US 500000 // round trips longer than this are too inaccurate
+#define SNTP_SLEW_PPM 500 // slew rate, like adjtime()
+#define SNTP_MAX_PPM 500 // limit for freqPpb, the crystal is much better than this
+#define SNTP_FREQ_GAIN 4 // how much of the measured drift to apply each sample
+#define SNTP_STABLE_US 20000 // drift errors under this are "stable" (WiFi round trip jitter)
+#define SNTP_STABLE_SAMPLES 3 // stable samples in a row to double the poll interval
+#define SNTP_MIN_POLL 6 // 64 seconds
+#define SNTP_MAX_POLL 12 // 68 minutes
+
+class sntpClock {
+public:
+  enum result : uint8_t { sr_rejected, sr_slewed, sr_stepped };
+  // This returns the wall-clock time, microseconds since 1970 (since boot if it's not set)
+  int64_t micros(int64_t mono) const {
+    line copy;
+    unsigned g;
+    do { // retry if sample() published a new line while this was copying
+      g = generation.load(std::memory_order_acquire);
+      copy = lines[g & 1];
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while (generation.load(std::memory_order_relaxed) != g);
+    return copy.at(mono);
+  }
+  bool isSet() const { return generation.load(std::memory_order_acquire) != 0; }
+  // This adjusts the clock with a sample from a server
+  result sample(int64_t t1, int64_t t2, int64_t t3, int64_t t4) {
+    line l = lines[generation.load(std::memory_order_relaxed) & 1];
+    int64_t delay = (t4 - t1) - (t3 - t2);
+    if (t4 < t1 || delay < 0 || delay > SNTP_MAX_DELAY_US) {
+      rejects++;
+      return sr_rejected;
+    }
+    int64_t offset = ((t2 - l.at(t1)) + (t3 - l.at(t4))) / 2; // server - local
+    lastOffset = offset;
+    lastDelay = delay;
+    samples++;
+    if (!isSet() || offset > SNTP_STEP_US || offset < -SNTP_STEP_US) {
+      l = {t4, l.at(t4) + offset, t4, l.freqPpb, 0};
+      steps++;
+      stableSamples = 0;
+      pollExp = SNTP_MIN_POLL;
+      publish(l);
+      return sr_stepped;
+    }
+    int64_t unplanned = offset - l.slewLeft(t4); // what the last slew won't fix
+    lastError = unplanned;
+    int64_t ppb = l.freqPpb + unplanned * 1000000000 / (t4 - l.monoBase) / SNTP_FREQ_GAIN;
+    if (ppb > SNTP_MAX_PPM * 1000) ppb = SNTP_MAX_PPM * 1000;
+    if (ppb < -SNTP_MAX_PPM * 1000) ppb = -SNTP_MAX_PPM * 1000;
+    int64_t wall = l.at(t4);
+    int64_t slewMicros = (offset < 0 ? -offset : offset) * 1000000 / SNTP_SLEW_PPM;
+    l = {t4, wall, t4 + slewMicros, (int32_t) ppb,
+      offset < 0 ? -SNTP_SLEW_PPM * 1000 : SNTP_SLEW_PPM * 1000};
+    if (unplanned < SNTP_STABLE_US && unplanned > -SNTP_STABLE_US) {
+      if (++stableSamples >= SNTP_STABLE_SAMPLES && pollExp < SNTP_MAX_POLL) {
+        pollExp++;
+        stableSamples = 0;
+      }
+    } else {
+      stableSamples = 0;
+      if (pollExp > SNTP_MIN_POLL) pollExp--;
+    }
+    publish(l);
+    return sr_slewed;
+  }
+  uint32_t pollSeconds() const { return 1UL << pollExp; } // until the next sample
+  int32_t freqPpb() const { return lines[generation.load(std::memory_order_acquire) & 1].freqPpb; }
+  int64_t lastOffset = 0, lastDelay = 0, lastError = 0; // us, from the latest sample
+  uint32_t samples = 0, steps = 0, rejects = 0;
+private:
+  struct line {
+    int64_t monoBase, wallBase, slewEnd; // slewEnd is a monoMicros() value
+    int32_t freqPpb, slewPpb; // parts per billion
+    int64_t at(int64_t mono) const {
+      int64_t dt = mono - monoBase;
+      int64_t slewed = (mono < slewEnd ? dt : slewEnd - monoBase);
+      return wallBase + dt + dt * freqPpb / 1000000000 + slewed * slewPpb / 1000000000;
+    }
+    int64_t slewLeft(int64_t mono) const { // the part of the slew still to come
+      return (mono < slewEnd) ? (slewEnd - mono) * slewPpb / 1000000000 : 0;
+    }
+  };
+  void publish(const line &l) { // only sample() writes, so only the other copy may be in use
+    unsigned g = generation.load(std::memory_order_relaxed);
+    lines[(g + 1) & 1] = l;
+    generation.store(g + 1, std::memory_order_release);
+  }
+  line lines[2] = {};
+  std::atomic<unsigned> generation{0}; // number of lines published
+  int pollExp = SNTP_MIN_POLL;
+  int stableSamples = 0;
+};
+
+/*
+SNTP (RFC 4330) client packets. The request's transmit time is a nonce (the reply's originate
+time must match it), so the client doesn't need a wall-clock time to send a request.
+NTP times are seconds since 1900 with 32 fraction bits, and they wrap around in 2036.
+*/
+#define SNTP_PACKET_SIZE 48
+#define SNTP_UNIX_OFFSET 2208988800LL // seconds from 1900 to 1970
+
+inline void sntpRequest(uint8_t packet[SNTP_PACKET_SIZE], uint64_t nonce)
+{
+  for (int i = 0; i < SNTP_PACKET_SIZE; i++) packet[i] = 0;
+  packet[0] = (4 << 3) | 3; // version 4, client mode
+  for (int i = 0; i < 8; i++) packet[40 + i] = nonce >> (56 - 8 * i);
+}
+
+inline uint64_t sntpField(const uint8_t *p)
+{
+  uint64_t x = 0;
+  for (int i = 0; i < 8; i++) x = (x << 8) | p[i];
+  return x;
+}
+
+inline int64_t sntpMicros(uint64_t ntpTime) // microseconds since 1970
+{
+  int64_t seconds = ntpTime >> 32;
+  if (seconds < 0x80000000LL) seconds += 1LL << 32; // after the 2036 wraparound
+  return (seconds - SNTP_UNIX_OFFSET) * 1000000 + (((ntpTime & 0xffffffff) * 1000000) >> 32);
+}
+
+// This checks a reply and gets the server's receive and transmit times, false if it's bad
+inline bool sntpParse(const uint8_t *packet, int size, uint64_t nonce, int64_t &t2, int64_t &t3)
+{
+  if (size < SNTP_PACKET_SIZE) return false;
+  if ((packet[0] & 7) != 4 || (packet[0] >> 6) == 3) return false; // not server mode, unsynced
+  if (packet[1] == 0 || packet[1] > 15) return false; // stratum, 0 is a "kiss-o'-death"
+  if (sntpField(packet + 24) != nonce) return false; // not a reply to our request
+  uint64_t receive = sntpField(packet + 32), transmit = sntpField(packet + 40);
+  if (!receive || !transmit) return false;
+  t2 = sntpMicros(receive);
+  t3 = sntpMicros(transmit);
+  return true;
+}
+
+#endif
@@ -0,0 +1,55 @@
+// spsc.h - lock-free single-producer single-consumer queue
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+#ifndef _spsc_h
+#define _spsc_h
+
+#include <atomic>
+
+/*
+This is a fixed-size queue for passing data from one task to another without locks. Only
+one task may push and only one task may pop. The producer owns the head index and the
+consumer owns the tail index, so each index is written by only one task. Example:
+  inline spscQueue<uID_t, 4> ids;
+  ids.push(uid); // producer task, returns false if the queue is full
+  uID_t uid; if (ids.pop(uid)) ...; // consumer task, returns false if the queue is empty
+*/
+template <typename T, unsigned N>
+class spscQueue {
+  static_assert(N && (N & (N - 1)) == 0, "spscQueue size must be a power of 2");
+public:
+  bool push(const T &x) {
+    unsigned h = head.load(std::memory_order_relaxed);
+    if (h - tail.load(std::memory_order_acquire) == N) return false; // full
+    buffer[h & (N - 1)] = x;
+    head.store(h + 1, std::memory_order_release); // publish x to the consumer
+    return true;
+  }
+  bool pop(T &x) {
+    unsigned t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) return false; // empty
+    x = buffer[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release); // give the slot back to the producer
+    return true;
+  }
+  bool empty() {
+    return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+  }
+private:
+  T buffer[N];
+  std::atomic<unsigned> head{0}; // number of items ever pushed
+  std::atomic<unsigned> tail{0}; // number of items ever popped
+};
+
+#endif
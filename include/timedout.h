@@ -12,19 +12,41 @@ WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY
 You should have received a copy of the GNU General Public License along with WACL. If not, see
   <https://www.gnu.org/licenses/>.
 */
+#ifndef _timedout_h
+#define _timedout_h
+
 #include <Arduino.h>
 #include <TimeLib.h>
+#include <esp_timer.h>
+#include "sntp.h" // sntpClock class
+
+/*
+All software timers use one monotonic clock: esp_timer's 64-bit microseconds since boot. It
+never wraps (in practice) and it isn't changed by NTP, so setting the wall-clock time
+(wallTime()) doesn't move any timeout. Wall-clock time is only used for displaying
+and logging dates and times.
+*/
+inline int64_t monoMicros() { return esp_timer_get_time(); } // microseconds since boot
+inline int64_t monoMillis() { return monoMicros() / 1000; } // milliseconds since boot
+inline unsigned softSeconds() { return monoMicros() / 1000000; } // seconds since boot
+
+/*
+The wall clock follows the monotonic clock, corrected for drift and slewed by the SNTP
+client in the net task (see sntp.h), so it doesn't jump except when it is first set.
+TimeLib is only used for its date functions (year(), etc.).
+*/
+inline sntpClock wallClock;
+inline time_t wallTime() { return wallClock.micros(monoMicros()) / 1000000; } // since 1970
 
 /*
-Seconds at boot, used to compute uptime, etc.
+Wall-clock seconds at boot, used to display the boot time, etc.
 If there is no NTP server or other time source, this is zero.
 If there is an NTP server or other time source, this is
 seconds since the 1970 epoch which will fail in the year 2038.
+This is updated each time the wall-clock time is set, see setBootTime().
 */
 inline time_t bootTime;
-#define TIME_T_MAX INT_MAX
-
-inline unsigned softSeconds() { return now() - bootTime; } // seconds since boot
+inline void setBootTime() { bootTime = wallTime() - softSeconds(); }
 
 /*
 Use this for repetitive events or use with a separate boolean for one-time events. Examples:
@@ -43,26 +65,26 @@ Use this for repetitive events or use with a separate boolean for one-time event
 */
 class msTimedOut {
   public:
-    void reset(long x) { timeoutMillis = millis() + x; };
+    void reset(long x) { timeoutMillis = monoMillis() + x; };
     msTimedOut(long x = 0) { reset(x); };
     operator bool() { // conversion operator -- object returns true if timed out
-      long timeLeft = (int) (timeoutMillis - millis());
-      return (timeLeft > 0) ? false : true; // signed comparison prevents wraparound issue
+      return monoMillis() >= timeoutMillis; // 64 bits, so no wraparound issue
     };
   private:
-    unsigned long timeoutMillis; // a future millis() value
+    int64_t timeoutMillis; // a future monoMillis() value
 };
 
 /*
 This has the same usage as msTimedOut except that timedOut only happens once and then
 is disabled so that this can be used for one-time events without an additional variable
 */
+#define TIMEDOUT_DISABLED INT64_MAX
 class secTimedOut {
   public:
-    void disable() { timeoutSec = TIME_T_MAX; };
-    bool isActive() { return (timeoutSec != TIME_T_MAX) && (timeoutSec > softSeconds()); }
-    bool isDisabled() { return (timeoutSec == TIME_T_MAX); }
-    void reset(long x) { timeoutSec = softSeconds() + x; };
+    void disable() { timeoutSec = TIMEDOUT_DISABLED; };
+    bool isActive() { return (timeoutSec != TIMEDOUT_DISABLED) && (timeoutSec > softSeconds()); }
+    bool isDisabled() { return (timeoutSec == TIMEDOUT_DISABLED); }
+    void reset(long x) { timeoutSec = (int64_t) softSeconds() + x; };
     secTimedOut(long x = 0) { reset(x); }
     operator bool() { // conversion operator -- object returns true if timed out and enabled
       if (timeoutSec > softSeconds()) {
@@ -73,7 +95,7 @@ class secTimedOut {
       }
     };
   protected:
-    time_t timeoutSec; // a future softSeconds() value
+    int64_t timeoutSec; // a future softSeconds() value
 };
 
 /*
@@ -81,5 +103,7 @@ This has the same usage as secTimedOut except the timeout value is in minutes in
 */
 class minTimedOut : public secTimedOut {
   public:
-    void reset(long x) { secTimedOut::timeoutSec = softSeconds() + x * 60; };
-};
\ No newline at end of file
+    void reset(long x) { secTimedOut::timeoutSec = (int64_t) softSeconds() + x * 60; };
+};
+
+#endif
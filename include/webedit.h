@@ -0,0 +1,121 @@
+// webedit.h - the file editor page's markup
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _webedit_h
+#define _webedit_h
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// This returns the HTML entity for c, or nullptr if c isn't special
+inline const char *htmlEntity(char c)
+{
+  switch (c) {
+    case '"': return "&quot;";
+    case '\'': return "&#39;";
+    case '<': return "&lt;";
+    case '>': return "&gt;";
+    case '&': return "&amp;";
+    default: return nullptr;
+  }
+}
+
+/*
+This copies text to out, replacing the characters that are special in HTML (including
+attribute values) with entities, and returns the length of the escaped text. If that
+doesn't fit in size, the output is truncated, but never in the middle of an entity.
+*/
+inline size_t htmlEscape(char *out, size_t size, const char *text)
+{
+  size_t length = 0, written = 0;
+  for (; *text; text++) {
+    const char *entity = htmlEntity(*text);
+    size_t n = entity ? strlen(entity) : 1;
+    if (written == length && length + n < size) {
+      memcpy(out + written, entity ? entity : text, n);
+      written += n;
+    }
+    length += n;
+  }
+  if (size) out[written] = '\0';
+  return length;
+}
+
+/*
+This escapes a block of length bytes, such as a piece of a file being sent, and returns the
+escaped length. Entities are per character, so a file can be escaped a block at a time. out
+must hold HTML_ESCAPE_BLOCK(length) bytes, and isn't terminated.
+*/
+#define HTML_ESCAPE_BLOCK(length) ((length) * 6) // "&quot;" is the longest entity
+inline size_t htmlEscapeBlock(char *out, const char *text, size_t length)
+{
+  size_t written = 0;
+  for (size_t x = 0; x < length; x++) {
+    const char *entity = htmlEntity(text[x]);
+    if (entity) {
+      size_t n = strlen(entity);
+      memcpy(out + written, entity, n);
+      written += n;
+    } else
+      out[written++] = text[x];
+  }
+  return written;
+}
+
+/*
+This writes the edit page's save-path input. A new file's path can be typed in, and an
+existing file's path is hidden. It only uses its arguments (no statics), so requests on
+different connections can render at the same time.
+*/
+#define EDIT_INPUT_MAX 256 // editSavePathInput()'s buffer size
+inline void editSavePathInput(char *out, size_t size, const char *path, bool newFile)
+{
+  static const char tail[] = "\" >";
+  int n = snprintf(out, size, "<input type=\"%s\" id=\"save_path\" name=\"save_path\" value=\"",
+    newFile ? "text" : "hidden");
+  if (n < 0 || (size_t) n + sizeof tail > size) { // too small for any path
+    if (size) *out = '\0';
+    return;
+  }
+  htmlEscape(out + n, size - n - (sizeof tail - 1), path);
+  strcat(out, tail);
+}
+
+/*
+This writes a file's <option> for the edit and delete dropdowns. It returns false, leaving
+out empty, if the escaped name doesn't fit, so the file is left out rather than listed with
+a truncated path that would name a different file.
+*/
+#define EDIT_OPTION_MAX 512 // editFileOption()'s buffer size
+inline bool editFileOption(char *out, size_t size, const char *name)
+{
+  static const char head[] = "<option value=\"/", middle[] = "\">", tail[] = "</option>";
+  size_t length = htmlEscape(nullptr, 0, name);
+  if (sizeof head + 2 * length + sizeof middle + sizeof tail - 2 > size) {
+    if (size) *out = '\0';
+    return false;
+  }
+  char *p = out + sizeof head - 1;
+  memcpy(out, head, sizeof head - 1);
+  p += htmlEscape(p, length + 1, name);
+  memcpy(p, middle, sizeof middle - 1);
+  p += sizeof middle - 1;
+  p += htmlEscape(p, length + 1, name);
+  memcpy(p, tail, sizeof tail);
+  return true;
+}
+
+#endif
@@ -23,6 +23,20 @@ inline const char index_html[] PROGMEM = R"rawliteral(
       h2 {text-align: center;}
       h3 {text-align: center;}
     </style>
+    <script>
+      if (!!window.EventSource) { // live dashboard, the server only sends changes
+        var source = new EventSource('/events');
+        ['lcd', 'lock', 'user', 'run'].forEach(function(name) {
+          source.addEventListener(name, function(e) {
+            document.getElementById(name).textContent = e.data;
+          }, false);
+        });
+        source.addEventListener('log', function(e) {
+          var log = document.getElementById('log');
+          log.textContent = (log.textContent + e.data).split('\n').slice(-11).join('\n');
+        }, false);
+      }
+    </script>
   </head>
   <body>
   <div class="content">
@@ -30,6 +44,10 @@ inline const char index_html[] PROGMEM = R"rawliteral(
     <p></p>
     <h2>%TITLE_TEXT% - Home</h2>
     <hr>
+    <pre id="lcd"></pre>
+    <p>Lock: <b id="lock">--</b> &nbsp; User: <b id="user"></b> &nbsp; Runtime: <b id="run"></b></p>
+    <pre id="log"></pre>
+    <hr>
     <pre>%PROGRAM_INFO%</pre>
     <hr>
     <h3><a href="/manager">( Settings/File Manager )</a></h3>
@@ -333,7 +351,7 @@ inline const char edit_html[] PROGMEM = R"rawliteral(
         <legend>Edit text file</legend>
         <div id="spacer_20"></div>
         <table><tr><td colspan="2">
-        <form name="edit_file" action="/save" onsubmit="return validateForm()">
+        <form name="edit_file" method="POST" action="/save" onsubmit="return validateForm()">
           <textarea name="edit_textarea">%TEXTAREA_CONTENT%</textarea>
           <div id="spacer_20"></div>
         </td></tr><tr><td>
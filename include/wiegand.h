@@ -0,0 +1,89 @@
+// wiegand.h - decoder for the two-wire output of Wiegand readers
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+#ifndef _wiegand_h
+#define _wiegand_h
+
+#include <stdint.h>
+#ifndef IRAM_ATTR
+#define IRAM_ATTR // not an ESP32 build
+#endif
+
+/*
+A Wiegand reader sends each bit as a short low pulse (about 50 us) on one of its two
+outputs, D0 for a 0 bit or D1 for a 1 bit, with 1-2 ms between the bits, and the frame ends
+when it stops sending. The first bit is an even parity bit for the first half of the frame
+and the last bit is an odd parity bit for the second half (the halves overlap by a bit for
+odd lengths), and the tag ID is in between, e.g. an 8-bit facility code and a 16-bit card
+number for 26 bits, or the 32-bit ID for 34 bits.
+The pins' falling-edge interrupts call edge(), and the I/O task calls frame() once no bits
+have arrived for WIEGAND_TIMEOUT_US. Two edges closer together than WIEGAND_GLITCH_US
+(e.g. noise, or both lines pulled low) spoil the frame, and so does a frame that's cut
+short, since its length or parity is wrong.
+*/
+#define WIEGAND_TIMEOUT_US 25000 // the end of a frame
+#define WIEGAND_GLITCH_US 150
+#define WIEGAND_MAX_BITS 64
+
+class wiegandDecoder {
+public:
+  // pin interrupts: a falling edge on D0 (bit=0) or D1 (bit=1)
+  void IRAM_ATTR edge(int bit, int64_t micros) {
+    if (count && micros - lastMicros < WIEGAND_GLITCH_US) glitch = true;
+    lastMicros = micros;
+    if (count <= WIEGAND_MAX_BITS) count++; // one more than the max means it's too long
+    data = data << 1 | bit;
+  }
+  bool pending() { return count != 0; } // true if a frame is being received
+  int64_t endMicros() { return lastMicros + WIEGAND_TIMEOUT_US; } // when the frame ends
+  int64_t frameMicros() { return lastMicros; } // time of the last bit
+  /*
+  This checks the received frame and starts the next one. It returns true and sets the tag
+  ID if the frame is valid. bits is the frame length, or 0 for 26 or 34 bits. The ID is the
+  low 32 bits of the data for longer frames.
+  */
+  bool frame(int bits, uint32_t &tagID) {
+    int n = count;
+    uint64_t x = data;
+    bool spoiled = glitch;
+    count = 0;
+    glitch = false;
+    if (spoiled) { glitches++; return false; }
+    if (n < 4 || (bits ? n != bits : n != 26 && n != 34)) { lengthErrors++; return false; }
+    int firstHalf = (n + 1) / 2, secondHalf = n - n / 2; // bits covered by each parity bit
+    uint64_t firstMask = ((1ULL << firstHalf) - 1) << (n - firstHalf);
+    uint64_t secondMask = (1ULL << secondHalf) - 1;
+    if (n < 64) x &= (1ULL << n) - 1;
+    if ((__builtin_popcountll(x & firstMask) & 1) != 0 ||
+        (__builtin_popcountll(x & secondMask) & 1) != 1) {
+      parityErrors++;
+      return false;
+    }
+    frames++;
+    tagID = (uint32_t) ((x >> 1) & ((1ULL << (n - 2)) - 1)); // without the parity bits
+    return true;
+  }
+  // stats
+  uint32_t frames = 0; // valid frames
+  uint32_t parityErrors = 0;
+  uint32_t lengthErrors = 0; // the wrong number of bits, e.g. cut short
+  uint32_t glitches = 0; // frames spoiled by edges too close together
+private:
+  volatile int count = 0; // bits received
+  volatile bool glitch = false; // this frame had a glitch
+  volatile uint64_t data = 0; // the bits received, the last one is bit 0
+  volatile int64_t lastMicros = 0;
+};
+
+#endif
@@ -36,11 +36,11 @@ int api_bodgery_v0_lookup(uID_t idTag, unsigned long &idEnable, char idName[])
   sprintf(buffer, "%010u", idTag);
   HTTPClient http;
   String request = "";
-  request.concat( stg.backendURL );
+  request.concat( netStg.backendURL );
   request.concat( "/entry/" );
   request.concat( buffer );
   request.concat( "/" );
-  request.concat( stg.deviceName );
+  request.concat( netStg.deviceName );
 
   auto start = millis();
   if (!http.begin(request.c_str(), root_ca)) {
@@ -49,7 +49,7 @@ int api_bodgery_v0_lookup(uID_t idTag, unsigned long &idEnable, char idName[])
   }
   http.setConnectTimeout(5000 /*ms*/);
   http.setTimeout(5000 /*ms*/); // not needed?
-  http.setAuthorization(stg.backendUsername, stg.backendSecret);
+  http.setAuthorization(netStg.backendUsername, netStg.backendSecret);
   int status = http.GET();
   String body = http.getString();
   http.end();
@@ -36,13 +36,13 @@ int api_bodgery_v1_lookup(uID_t idTag, unsigned long &idEnable, char idName[])
   sprintf(buffer, "%010u", idTag);
   HTTPClient http;
   String request = "";
-  request.concat( stg.backendURL );
+  request.concat( netStg.backendURL );
   request.concat( "/v1/check_tag/" );
   request.concat( buffer );
   request.concat( "/" );
-  request.concat( stg.deviceName );
+  request.concat( netStg.deviceName );
   String authToken = "Bearer ";
-  authToken.concat( stg.backendSecret );
+  authToken.concat( netStg.backendSecret );
 
   auto start = millis();
   if (!http.begin(request.c_str(), root_ca)) {
@@ -51,7 +51,7 @@ int api_bodgery_v1_lookup(uID_t idTag, unsigned long &idEnable, char idName[])
   }
   http.setConnectTimeout(5000 /*ms*/);
   http.setTimeout(5000 /*ms*/); // not needed?
-  http.addHeader("Authorization", authToken); // http.setAuthorization(stg.backendUsername, stg.backendSecret);
+  http.addHeader("Authorization", authToken); // http.setAuthorization(netStg.backendUsername, netStg.backendSecret);
   int status = http.GET();
   String body = http.getString();
   http.end();
@@ -108,13 +108,13 @@ int api_bodgery_v1_add(uID_t idTag)
   sprintf(buffer, "%010u", idTag);
   HTTPClient http;
   String request = "";
-  request.concat( stg.backendURL );
+  request.concat( netStg.backendURL );
   request.concat( "/v1/role/" );
-  request.concat( stg.deviceGroup );
+  request.concat( netStg.deviceGroup );
   request.concat( "/" );
   request.concat( buffer );
   String authToken = "Bearer ";
-  authToken.concat( stg.backendSecret );
+  authToken.concat( netStg.backendSecret );
 
   auto start = millis();
   if (!http.begin(request.c_str(), root_ca)) {
@@ -123,7 +123,7 @@ int api_bodgery_v1_add(uID_t idTag)
   }
   http.setConnectTimeout(5000 /*ms*/);
   http.setTimeout(5000 /*ms*/); // not needed?
-  http.addHeader("Authorization", authToken); // http.setAuthorization(stg.backendUsername, stg.backendSecret);
+  http.addHeader("Authorization", authToken); // http.setAuthorization(netStg.backendUsername, netStg.backendSecret);
   int status = http.PUT("x");
   String body = http.getString();
   http.end();
@@ -131,7 +131,7 @@ int api_bodgery_v1_add(uID_t idTag)
   logd("response=%i, t=%lums", status, millis() - start);
   if (status != HTTP_CODE_CREATED) {
     loge("Error %i adding user to group '%s' device '%s'",
-      status, stg.deviceGroup, stg.deviceName);
+      status, netStg.deviceGroup, netStg.deviceName);
     return status;
   }
   return 0;
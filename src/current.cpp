@@ -0,0 +1,251 @@
+// current.cpp - analog current sensing
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+/*
+When Current-On-Level is set, a lock's current sensor pin is an analog input, e.g. a current
+transformer with a burden resistor, biased to the middle of the ADC's range. It must be an
+ADC1 pin (GPIO 32-39) since ADC2 can't be used with WiFi. The ADC samples the analog pins
+continuously, CURRENT_SAMPLE_HZ in all, into DMA buffers (the ADC's "digital controller"
+mode, which uses I2S0 on the ESP32), and the current task feeds each pin's samples to its
+rmsEstimator (rms.h). A machine is on when the RMS is at least Current-On-Level, and then
+off when it's below Current-Off-Level, so noise near a threshold doesn't make it flicker.
+The current task wakes the I/O task when that changes. Light sleep is blocked while
+sampling since the ADC's DMA needs the APB clock. The current task owns the ADC driver,
+currentBegin() only asks it to restart.
+*/
+#include "main.h"
+#include "rms.h"
+#include <driver/adc.h>
+#if CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#endif
+
+#define CURRENT_SAMPLE_HZ 20000 // the ESP32's lowest continuous rate, shared by the pins
+#define CURRENT_READ_BYTES 512 // 256 samples, 12.8 ms
+#define CURRENT_READ_MS 100 // timeout for a read, so restarts don't wait for samples
+#define ADC1_CHANNELS 8
+
+static TaskHandle_t currentTask;
+static rmsEstimator estimators[NUM_LOCKS]; // only used by the current task
+static std::atomic<int8_t> channels[NUM_LOCKS]; // ADC1 channel to sample, -1=none
+static std::atomic<bool> restart; // the current task should (re)start the ADC
+static std::atomic<uint32_t> onLevels[NUM_LOCKS], offLevels[NUM_LOCKS]; // ADC counts
+static std::atomic<uint32_t> rmsLevels[NUM_LOCKS]; // the latest RMS, ADC counts
+static std::atomic<bool> machineOn[NUM_LOCKS]; // the RMS is over the thresholds
+static std::atomic<bool> changed; // a machineOn[] changed since currentUpdate()
+static std::atomic<uint32_t> overflows; // DMA data was lost because the task was too slow
+static std::atomic<bool> sampling; // the ADC is running, see currentSampling()
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t adcLock; // no light sleep while sampling
+#endif
+
+bool currentAnalog(int n)
+{
+  return stg.locks[n].currentPin && stg.locks[n].currentOnLevel > 0;
+}
+
+static void adcStop()
+{
+  adc_digi_stop();
+  adc_digi_deinitialize();
+#if CONFIG_PM_ENABLE
+  esp_pm_lock_release(adcLock);
+#endif
+  sampling = false;
+}
+
+// This returns true while the ADC runs, which keeps the chip out of light sleep
+bool currentSampling()
+{
+  return sampling;
+}
+
+// This starts sampling the channels in lockOf[] (ADC1 channel -> lock index, -1=none)
+static bool adcStart(const int8_t lockOf[])
+{
+  adc_digi_init_config_t init = {};
+  adc_digi_pattern_config_t patterns[NUM_LOCKS] = {};
+  int count = 0; // channels sampled
+  for (int ch = 0; ch < ADC1_CHANNELS; ch++) {
+    if (lockOf[ch] < 0) continue;
+    init.adc1_chan_mask |= BIT(ch);
+    patterns[count].atten = ADC_ATTEN_DB_11; // full range, about 0-3.1 V
+    patterns[count].channel = ch;
+    patterns[count].unit = 0; // ADC1
+    patterns[count].bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+    count++;
+  }
+#if CONFIG_PM_ENABLE
+  esp_pm_lock_acquire(adcLock);
+#endif
+  sampling = true;
+  init.max_store_buf_size = 4 * CURRENT_READ_BYTES;
+  init.conv_num_each_intr = CURRENT_READ_BYTES;
+  adc_digi_configuration_t config = {};
+  config.conv_limit_en = 1; // required on the ESP32
+  config.conv_limit_num = 250;
+  config.pattern_num = count;
+  config.adc_pattern = patterns;
+  config.sample_freq_hz = CURRENT_SAMPLE_HZ;
+  config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+  config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE1;
+  if (adc_digi_initialize(&init) != ESP_OK || adc_digi_controller_configure(&config) != ESP_OK
+      || adc_digi_start() != ESP_OK) {
+    adcStop();
+    return false;
+  }
+  for (int n = 0; n < NUM_LOCKS; n++) estimators[n].begin(CURRENT_SAMPLE_HZ / count);
+  return true;
+}
+
+// This compares a lock's latest RMS to its thresholds, and tells the I/O task if it changed
+static void currentCheck(int n)
+{
+  uint32_t rms = estimators[n].rms();
+  rmsLevels[n] = rms;
+  bool on = machineOn[n] ? rms >= offLevels[n] : rms >= onLevels[n];
+  if (on == machineOn[n]) return;
+  machineOn[n] = on;
+  changed = true;
+  scheduler.wake();
+}
+
+static void currentTaskLoop(void *)
+{
+  static uint8_t buffer[CURRENT_READ_BYTES];
+  int8_t lockOf[ADC1_CHANNELS]; // ADC1 channel -> lock index, -1=none
+  bool running = false;
+  while (1) {
+    if (restart.exchange(false)) {
+      if (running) adcStop();
+      memset(lockOf, -1, sizeof lockOf);
+      bool wanted = false;
+      for (int n = 0; n < NUM_LOCKS; n++) {
+        machineOn[n] = false;
+        rmsLevels[n] = 0;
+        if (channels[n] < 0) continue;
+        lockOf[(int) channels[n]] = n;
+        wanted = true;
+      }
+      running = wanted && adcStart(lockOf);
+      if (running) logi("Current sensing started");
+      else if (wanted) loge("Current sensing failed to start");
+    }
+    if (!running) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY); // wait for currentBegin()
+      continue;
+    }
+    uint32_t length = 0;
+    esp_err_t err = adc_digi_read_bytes(buffer, sizeof buffer, &length, CURRENT_READ_MS);
+    if (err == ESP_ERR_INVALID_STATE) overflows++; // the data that's left is still good
+    else if (err != ESP_OK) continue; // timeout
+    for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length; i += SOC_ADC_DIGI_RESULT_BYTES) {
+      adc_digi_output_data_t *p = (adc_digi_output_data_t *) &buffer[i];
+      int n = (p->type1.channel < ADC1_CHANNELS) ? lockOf[p->type1.channel] : -1;
+      if (n >= 0 && estimators[n].feed(p->type1.data)) currentCheck(n);
+    }
+  }
+}
+
+/*
+This (re)starts analog current sensing for the locks that have it, or stops it. setup()
+runs this, and reloadSettings() runs it when the current sensor settings change.
+*/
+void currentBegin()
+{
+  bool any = false;
+  for (int n = 0; n < NUM_LOCKS; n++) {
+    const lockSettings &ls = stg.locks[n];
+    int ch = -1;
+    if (currentAnalog(n)) {
+      ch = digitalPinToAnalogChannel(abs(ls.currentPin));
+      if (ch < 0 || ch >= ADC1_CHANNELS) {
+        loge("%sCurrent-Pin %i isn't an ADC1 pin (32-39), analog current sensing is off",
+             locks[n].label(), ls.currentPin);
+        ch = -1;
+      }
+    }
+    for (int i = 0; i < n && ch >= 0; i++) {
+      if (channels[i] != ch) continue;
+      loge("%sCurrent-Pin %i is already used by lock %i", locks[n].label(), ls.currentPin, i + 1);
+      ch = -1;
+    }
+    onLevels[n] = ls.currentOnLevel;
+    offLevels[n] = (ls.currentOffLevel > 0 && ls.currentOffLevel < ls.currentOnLevel) ?
+      ls.currentOffLevel : ls.currentOnLevel * 3 / 4;
+    channels[n] = ch;
+    if (ch >= 0) any = true;
+  }
+  if (!any && !currentTask) return; // it was never started
+  restart = true;
+  if (!currentTask) {
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "adc", &adcLock);
+#endif
+    xTaskCreatePinnedToCore(currentTaskLoop, "current", CURRENT_TASK_STACK, nullptr, 1,
+      &currentTask, CURRENT_TASK_CORE);
+  } else {
+    xTaskNotifyGive(currentTask);
+  }
+}
+
+/*
+This returns true if an analog current sensor's on/off state changed since the last call,
+loop() runs it each time it wakes up.
+*/
+bool currentUpdate()
+{
+  return changed.exchange(false);
+}
+
+// This is activatedPin() for a lock's current sensor, analog or digital: HIGH=on, LOW=off, NO_PIN
+int currentActive(int n)
+{
+  if (!currentAnalog(n)) return sensorActive(n, sn_current);
+  return machineOn[n] ? HIGH : LOW;
+}
+
+// This is activatedPin() for a lock's voltage sensor, which may be its analog current sensor
+int voltageActive(int n)
+{
+  const lockSettings &ls = stg.locks[n];
+  if (currentAnalog(n) && abs(ls.voltagePin) == abs(ls.currentPin)) return currentActive(n);
+  return sensorActive(n, sn_voltage);
+}
+
+// This returns true if a lock's current sensor is analog, and its latest RMS in ADC counts
+bool currentLevel(int n, uint32_t &rms)
+{
+  rms = rmsLevels[n];
+  return currentAnalog(n) && channels[n] >= 0;
+}
+
+// This formats a lock's analog current sensor stats, it returns 0 if it isn't analog
+int currentFormatStats(char *buffer, size_t size, int n)
+{
+  uint32_t rms;
+  if (!currentLevel(n, rms)) return 0;
+  return snprintf(buffer, size, "RMS %u (on %u, off %u), %u windows (%u without cycles), "
+    "%u overflows", (unsigned) rms, (unsigned) onLevels[n], (unsigned) offLevels[n],
+    (unsigned) estimators[n].windows, (unsigned) estimators[n].unsyncedWindows,
+    (unsigned) overflows);
+}
+
+// This is the RAM used for each lock, for serialInfo()
+size_t currentBytesPerLock()
+{
+  return sizeof estimators[0] + sizeof channels[0] + sizeof onLevels[0] + sizeof offLevels[0]
+    + sizeof rmsLevels[0] + sizeof machineOn[0];
+}
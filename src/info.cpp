@@ -102,7 +102,7 @@ const char * formattedTime(time_t t, formattedTimeMode mode)
   #undef BUFFER_SIZE
 }
 
-/* This returns a string of text info for display in the webserver */
+/* This returns a string of text info for display in the webserver (it uses webStg) */
 String programInfo()
 {
   #define stringf(...) { snprintf(buffer, BUFFER_SIZE, __VA_ARGS__); ret += buffer; }
@@ -114,7 +114,7 @@ String programInfo()
   const char * inPinVlt;
   const char * inPinTxt;
 
-  stringf("Device Name: %s\n" "Hostname:    %s\n", stg.deviceName, stg.hostName);
+  stringf("Device Name: %s\n" "Hostname:    %s\n", webStg.deviceName, webStg.hostName);
   stringf("Software:    " PROJECT_SHORT " - " PROJECT_LONG ", V" VERSION " (built " __DATE__ ")\n");
   stringf("Hardware:    CPU %s-%u @ %u MHz, Flash %u kb @ %u MHz\n",
     ESP.getChipModel(), ESP.getChipRevision(), ESP.getCpuFreqMHz(),
@@ -137,41 +137,72 @@ String programInfo()
                                                 : WiFi.softAPIP().toString().c_str(), subnetIP(),
     macAddr[0], macAddr[1], macAddr[2], macAddr[3], macAddr[4], macAddr[5]
   );
-  { // current sensor pin
-    inPinNum = activatedPin(stg.currentPin);
-    inPinVlt = "--";
-    inPinTxt = inPinNum ? (inPinNum == HIGH ?  "Active" : "Disabled") : "Inactive";
-    if ((stg.currentPin > 0 && inPinNum == HIGH)
-      || (stg.currentPin < 0 && inPinNum == LOW)) inPinVlt = "Gnd";
-    if ((stg.currentPin > 0 && inPinNum == LOW)
-      || (stg.currentPin < 0 && inPinNum == HIGH)) inPinVlt = "+V";
-    stringf("Current Pin: Pin %i, %s=%i=%s (current/voltage sensor input)\n",
-            stg.currentPin, inPinVlt, inPinNum, inPinTxt);
-  }
-  if (stg.voltagePin != stg.currentPin) { // voltage sensor pin
-    inPinNum = activatedPin(stg.voltagePin);
-    inPinVlt = "--";
-    inPinTxt = inPinNum ? (inPinNum == HIGH ?  "Active" : "Disabled") : "Inactive";
-    if ((stg.voltagePin > 0 && inPinNum == HIGH)
-      || (stg.voltagePin < 0 && inPinNum == LOW)) inPinVlt = "Gnd";
-    if ((stg.voltagePin > 0 && inPinNum == LOW)
-      || (stg.voltagePin < 0 && inPinNum == HIGH)) inPinVlt = "+V";
-    stringf("Voltage Pin: Pin %i, %s=%i=%s (current/voltage sensor input)\n",
-            stg.voltagePin, inPinVlt, inPinNum, inPinTxt);
-  }
-  const char * outPinTxt = stg.outputPin ? (stg.outputPin > 0 ?  "Active Low" : "Active High") :
-    "Disabled";
-  stringf("Output Pin:  Pin %i, %s", stg.outputPin, outPinTxt);
-  if (stg.outputPin) {
-    if (stg.outputMilliseconds) {
-      stringf(", Pulsed for %i ms", stg.outputMilliseconds);
-    } else {
-      stringf(", Continuous, Toggled");
+  for (int n = 0; n < NUM_LOCKS; n++) {
+    if (!locks[n].inUse()) continue;
+    const lockSettings &ls = webStg.locks[n];
+    if (n) stringf("Lock %i:\n", n + 1);
+    char line[160];
+    if (currentFormatStats(line, sizeof line, n)) { // analog current sensor
+      stringf("Current Pin: Pin %i, analog, %s, ", abs(ls.currentPin),
+              currentActive(n) == HIGH ? "Active" : "Inactive");
+      ret += line;
+      ret += " (current sensor input)\n";
+    } else { // current sensor pin
+      inPinNum = activatedPin(ls.currentPin);
+      inPinVlt = "--";
+      inPinTxt = inPinNum ? (inPinNum == HIGH ?  "Active" : "Disabled") : "Inactive";
+      if ((ls.currentPin > 0 && inPinNum == HIGH)
+        || (ls.currentPin < 0 && inPinNum == LOW)) inPinVlt = "Gnd";
+      if ((ls.currentPin > 0 && inPinNum == LOW)
+        || (ls.currentPin < 0 && inPinNum == HIGH)) inPinVlt = "+V";
+      stringf("Current Pin: Pin %i, %s=%i=%s (current/voltage sensor input)\n",
+              ls.currentPin, inPinVlt, inPinNum, inPinTxt);
+    }
+    if (ls.voltagePin != ls.currentPin) { // voltage sensor pin
+      inPinNum = activatedPin(ls.voltagePin);
+      inPinVlt = "--";
+      inPinTxt = inPinNum ? (inPinNum == HIGH ?  "Active" : "Disabled") : "Inactive";
+      if ((ls.voltagePin > 0 && inPinNum == HIGH)
+        || (ls.voltagePin < 0 && inPinNum == LOW)) inPinVlt = "Gnd";
+      if ((ls.voltagePin > 0 && inPinNum == LOW)
+        || (ls.voltagePin < 0 && inPinNum == HIGH)) inPinVlt = "+V";
+      stringf("Voltage Pin: Pin %i, %s=%i=%s (current/voltage sensor input)\n",
+              ls.voltagePin, inPinVlt, inPinNum, inPinTxt);
     }
+    const char * outPinTxt = ls.outputPin ? (ls.outputPin > 0 ?  "Active Low" : "Active High") :
+      "Disabled";
+    stringf("Output Pin:  Pin %i, %s", ls.outputPin, outPinTxt);
+    if (ls.outputPin) {
+      if (ls.outputMilliseconds) {
+        stringf(", Pulsed for %i ms", ls.outputMilliseconds);
+      } else {
+        stringf(", Continuous, Toggled");
+      }
+    }
+    stringf(" (lock/relay output)\n");
   }
-  stringf(" (lock/relay output)\n");
-  stringf("Date/Time:   %s\n", formattedTime(localTime(now())));
+  stringf("Date/Time:   %s\n", formattedTime(localTime(wallTime())));
   stringf("Boot Time:   %s   Uptime: %s\n", formattedTime(localTime(bootTime)), uptime());
+  {
+    char line[160];
+    if (membersFormatStats(line, sizeof line)) Serial.printf("  %s\r\n", line);
+    if (mqttFormatStats(line, sizeof line)) Serial.printf("  %s\r\n", line);
+  }
+  for (int i = 0; i < NUM_READERS; i++) {
+    char line[160];
+    if (readersFormatStats(line, sizeof line, i)) stringf("%s\n", line);
+  }
+  {
+    char line[160];
+    if (sensorsFormatStats(line, sizeof line)) stringf("%s\n", line);
+  }
+  stringf("\nJob Profiles:\n");
+  for (jobProfile *p = jobProfile::first; p; p = p->nextProfile()) {
+    char line[160];
+    p->format(line, sizeof line);
+    ret += line;
+    ret += '\n';
+  }
   stringf("\nRecent Log Entries:\n");
   ret += logLatest();
   return ret;
@@ -192,9 +223,82 @@ void serialInfo()
                                      : WiFi.softAPIP().toString().c_str()
     , subnetIP() , WiFi.RSSI(), uptime()
   );
-  time_t t = now();
+  time_t t = wallTime();
   Serial.printf("  Date/Time: UTC:%s", formattedTime(t));
   Serial.printf(", Local:%s\r\n", formattedTime(localTime(t)));
+#if ENABLE_NTP
+  Serial.printf("  NTP: %li ms offset, %li ms delay, %+li ppb drift, %lu s poll; samples %lu"
+    ", steps %lu, rejects %lu\r\n", (long) (wallClock.lastOffset / 1000),
+    (long) (wallClock.lastDelay / 1000), (long) wallClock.freqPpb(),
+    (unsigned long) wallClock.pollSeconds(), (unsigned long) wallClock.samples,
+    (unsigned long) wallClock.steps, (unsigned long) wallClock.rejects);
+#endif
+  if (settingsFromSnapshot)
+    Serial.printf("  Boot: settings %u us parse / %u us snapshot", settingsParseMicros,
+      settingsLoadMicros);
+  else // the load also hashed the config file and wrote the snapshot
+    Serial.printf("  Boot: settings %u us parse / %u us load, no snapshot", settingsParseMicros,
+      settingsLoadMicros);
+  Serial.printf(", ready at %u ms, 1st accepted scan at %u ms\r\n", bootReadyMillis,
+    firstAcceptMillis);
+  {
+    char line[160];
+    if (membersFormatStats(line, sizeof line)) Serial.printf("  %s\r\n", line);
+    if (mqttFormatStats(line, sizeof line)) Serial.printf("  %s\r\n", line);
+  }
+  for (int i = 0; i < NUM_READERS; i++) {
+    char line[160];
+    if (readersFormatStats(line, sizeof line, i)) Serial.printf("  %s\r\n", line);
+  }
+  {
+    int used = 0;
+    for (lockClass &lock : locks) used += lock.inUse();
+    unsigned sensorBytes = sensorsBytesPerLock() + currentBytesPerLock();
+    Serial.printf("  Locks: %i of %i used, %u bytes RAM each (%u lock, %u settings, %u sensors)"
+      "\r\n", used, NUM_LOCKS,
+      (unsigned) (sizeof (lockClass) + sizeof (lockSettings)) + sensorBytes,
+      (unsigned) sizeof (lockClass), (unsigned) sizeof (lockSettings), sensorBytes);
+  }
+  for (int n = 0; n < NUM_LOCKS; n++) {
+    char line[160];
+    if (currentFormatStats(line, sizeof line, n))
+      Serial.printf("  %sCurrent: %s, %s\r\n", locks[n].label(),
+        currentActive(n) == HIGH ? "on" : "off", line);
+  }
+  {
+    char line[160];
+    if (sensorsFormatStats(line, sizeof line)) Serial.printf("  %s\r\n", line);
+  }
+  static uint32_t lastMillis, lastWakeups; // for the loop stats since the last report
+  static uint64_t lastBusyMicros;
+  uint32_t ms = millis() - lastMillis;
+  if (ms) {
+    unsigned busyPermille = (scheduler.busyMicros - lastBusyMicros) / ms;
+    const char *basis;
+    unsigned milliamps = powerEstimateMilliamps(busyPermille, &basis);
+    Serial.printf("  Loop: %u wakeups/s, %u.%u%% busy, ~%u mA average (estimate, %s%s)\r\n",
+      (unsigned) ((uint64_t) (scheduler.wakeups - lastWakeups) * 1000 / ms),
+      busyPermille / 10, busyPermille % 10, milliamps, basis,
+      stg.powerSave ? ", Power-Save" : "");
+  }
+  static uint32_t lastI2cBytes, lastWriteThroughBytes;
+  if (ms) {
+    Serial.printf("  LCD: %u I2C bytes/s (~%u/s writing straight through), %u bus errors, "
+      "%u deferred\r\n",
+      (unsigned) ((uint64_t) (lcd.i2cBytes - lastI2cBytes) * 1000 / ms),
+      (unsigned) ((uint64_t) (lcd.writeThroughBytes - lastWriteThroughBytes) * 1000 / ms),
+      lcd.busErrors, lcd.deferredFrames);
+  }
+  lastI2cBytes = lcd.i2cBytes;
+  lastWriteThroughBytes = lcd.writeThroughBytes;
+  lastMillis += ms;
+  lastWakeups = scheduler.wakeups;
+  lastBusyMicros = scheduler.busyMicros;
+  for (jobProfile *p = jobProfile::first; p; p = p->nextProfile()) {
+    char line[160];
+    p->format(line, sizeof line);
+    Serial.printf("  %s\r\n", line);
+  }
   if (0 == heapInitialFree) // for programInfo report
     heapInitialFree = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
 }
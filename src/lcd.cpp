@@ -0,0 +1,149 @@
+// lcd.cpp - LCD framebuffer rendering
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+/*
+The library writes each character as two 4-bit halves with an I2C transaction for each
+change of the PCF8574's pins, so a character takes about 4 transactions of 2 bytes each.
+The LCD task compares the latest frame from flush() to what's on the display (sent) and
+only sends the characters that changed, moving the display's cursor only when the next
+changed character isn't where the cursor already is. The PCF8574 bytes for the changes
+are batched into I2C transactions of up to LCD_I2C_BATCH bytes (4 bytes per character).
+At 100 kHz each byte takes 90 us, which is more than the 37 us the display needs for a
+write, so no delays are needed between them.
+Each transaction times out after LCD_I2C_TIMEOUT_MS. After an error or a timeout, the
+task restarts the I2C bus, re-initializes the display, and redraws it. If that fails
+(e.g. there's no display), it tries again every LCD_RETRY_MS.
+*/
+#include "main.h"
+#include <Wire.h>
+
+// PCF8574 pins, this is the library's default mapping (LCD_BL is in main.h)
+#define LCD_RS 0x01 // register select, 1=data, 0=command
+#define LCD_EN 0x04 // enable, the display reads D4-D7 when this goes low
+#define LCD_SET_ADDRESS 0x80 // command to move the cursor, row 1 starts at 0x40
+#define LCD_I2C_BATCH 128 // Wire's buffer size
+
+static uint8_t batch[LCD_I2C_BATCH];
+static int batchLen;
+
+// This adds a command or character (rs=LCD_RS) to the batch
+static void batchByte(uint8_t x, uint8_t rs, uint8_t backlightBit)
+{
+  for (int shift = 4; shift >= 0; shift -= 4) {
+    uint8_t pins = ((x >> shift) & 0x0f) << 4 | rs | backlightBit;
+    batch[batchLen++] = pins | LCD_EN;
+    batch[batchLen++] = pins;
+  }
+}
+
+// This sends the batch, it returns false if there was an I2C error or timeout
+static bool sendBatch(uint8_t address, uint32_t &i2cBytes)
+{
+  if (!batchLen) return true;
+  Wire.beginTransmission(address);
+  Wire.write(batch, batchLen);
+  i2cBytes += batchLen + 1; // and the address byte
+  batchLen = 0;
+  return Wire.endTransmission() == 0;
+}
+
+// LCD task: this initializes the display, and the next render() redraws all of it
+bool MyLcd::reinit()
+{
+  Wire.end(); // so begin() restarts the bus, in case it's stuck
+  memset(&sent, ' ', sizeof sent);
+  sent.backlightBit = 0xff; // unknown
+  lcdCol = lcdRow = 0;
+  busError = !begin(16, 2);
+  Wire.setTimeOut(LCD_I2C_TIMEOUT_MS);
+  return !busError;
+}
+
+// LCD task: this sends the changes to the display, it returns false if there was an error
+bool MyLcd::render(const lcdFrame &x)
+{
+  if (busError && !reinit()) return false;
+  bool ok = true;
+  if (x.backlightBit != sent.backlightBit) {
+    batch[batchLen++] = x.backlightBit; // just the backlight pin, EN stays low
+    sent.backlightBit = x.backlightBit;
+  }
+  for (int row = 0; row < 2; row++) {
+    for (int col = 0; col < 16; col++) {
+      char c = x.lines[row][col];
+      if (c == sent.lines[row][col]) continue;
+      if (batchLen > LCD_I2C_BATCH - 8) ok &= sendBatch(address, i2cBytes);
+      if (col != lcdCol || row != lcdRow) {
+        batchByte(LCD_SET_ADDRESS | (row ? 0x40 : 0) | col, 0, x.backlightBit);
+        lcdRow = row;
+      }
+      batchByte(c, LCD_RS, x.backlightBit);
+      sent.lines[row][col] = c;
+      lcdCol = col + 1; // the display moves its cursor right after each character
+    }
+  }
+  ok &= sendBatch(address, i2cBytes);
+  if (!ok) { // the display may have missed something, so start over
+    busError = true;
+    busErrors++;
+  }
+  return ok;
+}
+
+void MyLcd::taskLoop(void *)
+{
+  lcdFrame latest;
+  bool pending = false; // latest isn't on the display yet
+  bool failing = false; // logged that it's not working
+  msTimedOut retryTimedout;
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, pending ? pdMS_TO_TICKS(LCD_RETRY_MS) : portMAX_DELAY);
+    while (lcd.frames.pop(latest)) pending = true; // skip to the latest frame
+    if (!pending || (failing && !retryTimedout)) continue;
+    bool wasWorking = !lcd.busError;
+    pending = !lcd.render(latest);
+    if (pending && wasWorking) pending = !lcd.render(latest); // re-initialize right away
+    if (pending && !failing) logw("LCD isn't responding, retrying every %i s", LCD_RETRY_MS / 1000);
+    if (!pending && failing) logi("LCD is working again");
+    failing = pending;
+    retryTimedout.reset(LCD_RETRY_MS);
+  }
+}
+
+// I/O task: this clears the display, and the first time it starts the LCD task
+void MyLcd::init()
+{
+  mirrorClear();
+  backlightBit = LCD_BL;
+  if (!task) {
+    xTaskCreatePinnedToCore(taskLoop, "lcd", LCD_TASK_STACK, nullptr, 1, &task, LCD_TASK_CORE);
+  }
+}
+
+// I/O task: this posts the framebuffer for the LCD task if it changed
+void MyLcd::flush()
+{
+  if (!dirty) return;
+  lcdFrame x;
+  memcpy(x.lines[0], shownLines[0], 16);
+  memcpy(x.lines[1], shownLines[1], 16);
+  x.backlightBit = backlightBit;
+  if (!frames.push(x)) { // the LCD task is behind, the next flush() will try again
+    deferredFrames++;
+    return;
+  }
+  dirty = false;
+  if (task) xTaskNotifyGive(task);
+}
@@ -15,42 +15,113 @@ You should have received a copy of the GNU General Public License along with WAC
 #include "main.h"
 #include <LittleFS.h>
 
-// This logs data to the serial port and the filesystem if the loglevel is >=
-// the setting. This limits the size of the log on the filesystem.
-void logWrite(int loglevel, const char * const str, ...)
+/*
+Most recent log lines, used to push new log lines to the web dashboard. The net task sends
+them after each logFlush(), so this holds a whole flush: the logLines queue, the dropped
+lines warning, and lines other tasks logged meanwhile. They're written and read under
+logMutex(), so a line isn't overwritten while it's copied.
+*/
+#define RECENT_LINES 16 // must be a power of 2
+#define RECENT_BYTES 128
+static char recentLines[RECENT_LINES][RECENT_BYTES];
+static std::atomic<unsigned> recentSeq; // number of lines ever logged
+static std::atomic<unsigned> logDropped; // lines lost because the logLines queue was full
+
+// Every task logs, so the settings are copied here by logSettings() (the defaults are used
+// while the settings are loaded at boot)
+static std::atomic<int> levelSerial{DEF_LOG_LEVEL}, levelFile{DEF_LOG_LEVEL}, fileMax;
+
+// settingsPublish() runs this with the new settings
+void logSettings(const programSettings &s)
 {
-  #define BUFFER_SIZE 256 // pretty big because json response debug line is long
-  char buffer[BUFFER_SIZE];
-  va_list arg;
+  levelSerial = s.logLevelSerial;
+  levelFile = s.logLevelFile;
+  fileMax = s.logFileMax;
+}
 
-  // printf to buffer with a timestamp prefix and a CRLF=\r\n suffix
-  strlcpy(buffer, formattedTime(localTime(now())), BUFFER_SIZE);
-  // 01234567890123456789
-  // yyyy-mm-dd,hh:mm:ss
-  buffer[19] = ' ';
-  va_start(arg, str);
-  (void) vsnprintf(buffer + 20, BUFFER_SIZE - 20 - 2, str, arg);
-  va_end(arg);
-  strlcat(buffer, "\r\n", BUFFER_SIZE);
+// This logs a formatted line to the serial port and the filesystem if the loglevel is >=
+// the setting. This limits the size of the log on the filesystem.
+static void logOutputLocked(int loglevel, const char *buffer)
+{
+  // save for the web dashboard
+  unsigned seq = recentSeq;
+  strlcpy(recentLines[seq & (RECENT_LINES - 1)], buffer, RECENT_BYTES);
+  recentSeq = seq + 1;
 
   // log to serial port
-  if (!(loglevel < abs(stg.logLevelSerial) || (loglevel == 3 && stg.logLevelSerial < 0))) {
+  int level = levelSerial;
+  if (!(loglevel < abs(level) || (loglevel == 3 && level < 0))) {
     Serial.print(buffer);
   }
 
   // log to file
-  if (!(loglevel < abs(stg.logLevelFile) || (loglevel == 3 && stg.logLevelFile < 0))) {
-    if (stg.logFileMax == 0) return;
+  level = levelFile;
+  int maxSize = fileMax;
+  if (!(loglevel < abs(level) || (loglevel == 3 && level < 0))) {
+    if (maxSize == 0) return;
     File logfile = LittleFS.open(LOG_FILE_CURRENT, "a"); // creates file if it doesn't exist
     if (!logfile) return;
     if (!logfile.print(buffer)) { logfile.close(); return; }
     int logsize = logfile.size();
     logfile.close();
-    if (logsize < stg.logFileMax) return;
+    if (logsize < maxSize) return;
     if (LittleFS.exists(LOG_FILE_OLDER)) LittleFS.remove(LOG_FILE_OLDER);
     LittleFS.rename(LOG_FILE_CURRENT, LOG_FILE_OLDER);
   }
+}
+
+// The net task and the web server's task may both log
+static SemaphoreHandle_t logMutex()
+{
+  static SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+  return mutex;
+}
+
+static void logOutput(int loglevel, const char *buffer)
+{
+  xSemaphoreTake(logMutex(), portMAX_DELAY);
+  logOutputLocked(loglevel, buffer);
+  xSemaphoreGive(logMutex());
+}
+
+/*
+This formats a log line with a timestamp. The I/O task (loop()) passes the line to the net
+task so it doesn't wait for the serial port or the filesystem. Other tasks log it right away.
+*/
+void logWrite(int loglevel, const char * const str, ...)
+{
+  #define BUFFER_SIZE LOG_LINE_MAX // pretty big because json response debug line is long
+  logLine line;
+  char *buffer = line.text;
+  va_list arg;
+
+  // printf to buffer with a timestamp prefix and a CRLF=\r\n suffix
+  strlcpy(buffer, formattedTime(localTime(wallTime())), BUFFER_SIZE);
+  // 01234567890123456789
+  // yyyy-mm-dd,hh:mm:ss
+  buffer[19] = ' ';
+  va_start(arg, str);
+  (void) vsnprintf(buffer + 20, BUFFER_SIZE - 20 - 2, str, arg);
+  va_end(arg);
+  strlcat(buffer, "\r\n", BUFFER_SIZE);
   #undef BUFFER_SIZE
+
+  if (netTask && xTaskGetCurrentTaskHandle() == ioTask) {
+    line.loglevel = loglevel;
+    if (logLines.push(line)) netWake();
+    else logDropped++;
+    return;
+  }
+  logOutput(loglevel, buffer);
+}
+
+// This is run by the net task to log the lines from the I/O task
+void logFlush(void)
+{
+  logLine line;
+  while (logLines.pop(line)) logOutput(line.loglevel, line.text);
+  unsigned dropped = logDropped.exchange(0);
+  if (dropped) logw("%u log lines were dropped", dropped);
 }
 
 #define NUM_LINES 5
@@ -103,4 +174,23 @@ char * logLatest(void)
 
 #undef NUM_LINES
 #undef BYTES_PER_LINE
-#undef BUFFER_SIZE
\ No newline at end of file
+#undef BUFFER_SIZE
+
+/*
+This copies the next log line after the sequence number (arg) to line and updates the
+sequence number, or it returns false if there are no newer lines. Lines that have been
+pushed out of the recent lines buffer are skipped. Start with a sequence number of zero.
+*/
+bool logSince(unsigned &seq, char *line, size_t size)
+{
+  if (seq == recentSeq) return false;
+  xSemaphoreTake(logMutex(), portMAX_DELAY);
+  unsigned last = recentSeq;
+  if (last - seq > RECENT_LINES) seq = last - RECENT_LINES; // skip lost lines
+  strlcpy(line, recentLines[seq++ & (RECENT_LINES - 1)], size);
+  xSemaphoreGive(logMutex());
+  return true;
+}
+
+#undef RECENT_LINES
+#undef RECENT_BYTES
\ No newline at end of file
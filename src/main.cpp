@@ -13,55 +13,103 @@ You should have received a copy of the GNU General Public License along with WAC
   <https://www.gnu.org/licenses/>.
 */
 #include "main.h"
-#if ENABLE_NTP
-#include <TimeLib.h> // for setTime
-#endif
+
+#define poweredMinutes(lock) (((lock).usage.poweredMillis + 30000) / 60000)
+
+static lockClass *shownLock = &locks[0]; // the lock on the LCD and the web dashboard
+
+// This is run by usageTimer every USAGE_SAMPLE_MS while a lock is on
+void usageJob()
+{
+  static jobProfile profile("usageJob");
+  profile.start();
+  bool anyOn = false;
+  for (lockClass &lock : locks) {
+    if (!lock.isAccessible()) continue;
+    anyOn = true;
+    if (!currentActive(lock.index)) continue; // not drawing current (NO_PIN counts as drawing)
+    lock.usage.poweredMillis += USAGE_SAMPLE_MS;
+    uint32_t rms;
+    if (currentLevel(lock.index, rms)) lock.usage.rmsMillis += (uint64_t) rms * USAGE_SAMPLE_MS;
+  }
+  if (!anyOn) usageTimer.stop();
+  profile.stop();
+}
+
+// This returns the usage of the lock session for the log, e.g. "used 12 minutes (15 enabled)"
+static const char *usageText(lockClass &lock)
+{
+  #define BUFFER_SIZE 64
+  static char buffer[BUFFER_SIZE];
+  int len = snprintf(buffer, BUFFER_SIZE, "used %lu minutes (%li enabled)",
+    (unsigned long) poweredMinutes(lock), (wallTime() - lock.ActivatedTime + 30) / 60);
+  float wattsPerCount = lock.cfg().currentWattsPerCount;
+  if (lock.usage.rmsMillis && wattsPerCount > 0)
+    snprintf(buffer + len, BUFFER_SIZE - len, ", %.1f Wh",
+      lock.usage.rmsMillis * (double) wattsPerCount / 3600000.0);
+  return buffer;
+  #undef BUFFER_SIZE
+}
+
+// This sends a lock on/off event with the usage to the net task for MQTT
+static void usagePublish(lockClass &lock, bool on)
+{
+  usageEvent event = {};
+  event.lock = lock.index;
+  event.on = on;
+  strlcpy(event.user, lock.activeUser, sizeof event.user);
+  event.enabledSeconds = wallTime() - lock.ActivatedTime;
+  event.poweredSeconds = lock.usage.poweredMillis / 1000;
+  float wattsPerCount = lock.cfg().currentWattsPerCount;
+  event.wattHours = (wattsPerCount > 0) ? lock.usage.rmsMillis * wattsPerCount / 3600000.0 : -1;
+  if (usageEvents.push(event)) netWake();
+}
 
 /*
 This sets up the LCD object so the LCD displays a usage summary after the LCD
-message timeout finishes. This also disables the auto-off timer.
+message timeout finishes. This also disables the auto-off timer and publishes the usage.
 */
-void machineOffSetup()
+static void machineOffSetup(lockClass &lock)
 {
   #define BUFFER_SIZE 17
   char buffer[BUFFER_SIZE];
 
   // 0123456789012345
-  // mm/dd,hh:mm ZZZm
+  // mm/dd,hh:mm ZZZm  where ZZZ is the minutes the machine drew current
   strlcpy(buffer, formattedTime(localTime(lock.ActivatedTime), ftm_mmddhhmm), BUFFER_SIZE);
   #pragma GCC diagnostic ignored "-Wformat-truncation"
-  snprintf(buffer + 11, sizeof buffer - 11, " %3lim",
-    (now() - lock.ActivatedTime + 30) / 60);
+  snprintf(buffer + 11, sizeof buffer - 11, " %3lum", (unsigned long) poweredMinutes(lock));
   #pragma GCC diagnostic pop
   lcd.saveLine(1, buffer);
   #undef BUFFER_SIZE
   lock.autoOffTimedout.disable();
+  usagePublish(lock, false);
 }
 
 /*
-This handles auto-turnoff of the machine/lock if enabled in the settings.
+This handles auto-turnoff of a machine/lock if enabled in the settings.
 This also handles the realtime updating of the time on the LCD while the
 machine/lock is enabled/activated.
 */
-void machineTimeoutUpdate()
+static void lockTimeoutUpdate(lockClass &lock)
 {
-  static time_t autoOffStart; // auto-off start time
+  int autoOffMinutes = lock.cfg().autoOffMinutes;
 
   if (!lock.isAccessible()) // machine is already off
     return;
   // Update the machine runtime on the LCD while it's turned-on/accessible
-  if (!lcd.isTimeoutActive()) { // if not displaying a temporary message...
+  if (&lock == shownLock && !lcd.isTimeoutActive()) { // if not displaying a temporary message...
     #define BUFFER_SIZE 17
     char buffer[17];
 
-    int sec = now() - lock.ActivatedTime;
+    int sec = wallTime() - lock.ActivatedTime;
     lcd.setCursor(0, 1);
     // 0123456789012345
     // ON mmm:ss MMM:SS  where MMM:SS is the time the machine is enabled but unpowered
     snprintf(buffer, sizeof buffer, "ON%4i:%02i", sec / 60, sec % 60);
     if (lock.autoOffTimedout.isActive()) {
-      sec = now() - autoOffStart;
-      sec = 60 * stg.autoOffMinutes - sec;
+      sec = softSeconds() - lock.autoOffStart;
+      sec = 60 * autoOffMinutes - sec;
       if (sec < 0) sec = 0;
       #pragma GCC diagnostic ignored "-Wformat-truncation"
       snprintf(buffer + 9, sizeof buffer - 9, "%4i:%02i", sec / 60, sec % 60);
@@ -72,9 +120,9 @@ void machineTimeoutUpdate()
     lcd.print(buffer);
     #undef BUFFER_SIZE
   }
-  if (stg.autoOffMinutes == 0) // auto-off is disabled
+  if (autoOffMinutes == 0) // auto-off is disabled
     return;
-  if (activatedPin(stg.currentPin)) { // machine is drawing current or pin isn't used
+  if (currentActive(lock.index)) { // machine is drawing current or pin isn't used
     if (lock.autoOffTimedout.isActive()) // must've powered back on, so stop auto-off timeout
      lock.autoOffTimedout.disable();
     return;
@@ -82,23 +130,32 @@ void machineTimeoutUpdate()
   // At this point we know that:
   //   1) machine is unlocked, 2) auto-off setting is enabled, 3) machine isn't drawing current
   if (lock.autoOffTimedout.isDisabled()) { // start auto-off timer if it's not started
-    lock.autoOffTimedout.reset(stg.autoOffMinutes);
-    autoOffStart = now();
+    lock.autoOffTimedout.reset(autoOffMinutes);
+    lock.autoOffStart = softSeconds();
     return;
   }
   if (lock.autoOffTimedout) { // perform auto-off
     lock.stopAccess();
-    machineOffSetup();
+    shownLock = &lock;
+    machineOffSetup(lock);
     lcd.setCursor(0, 1);
     //          01234567898012345
-    lcd.printf("%i min auto-OFF", stg.autoOffMinutes);
+    lcd.printf("%i min auto-OFF", autoOffMinutes);
     lcd.setTimeout();
-    logu("Auto-off (%im), used %li minutes",
-      stg.autoOffMinutes, (now() - lock.ActivatedTime + 30) / 60);
+    logu("%sAuto-off (%im), %s",
+      lock.label(), autoOffMinutes, usageText(lock));
     return;
   }
 }
 
+// This runs lockTimeoutUpdate() for each lock
+void machineTimeoutUpdate()
+{
+  for (lockClass &lock : locks) {
+    if (lock.inUse()) lockTimeoutUpdate(lock);
+  }
+}
+
 /*
 This looks up the ID (1st arg) using the backend. It returns the enable in the
 2nd arg and the name in the 3rd arg. If not found, it returns ID_NOT_FOUND
@@ -107,13 +164,25 @@ in the 2nd arg. Also, the fcn return value is nonzero if an error occurred.
 
 This may call functions that use internet API calls to perform the lookup.
 These can take awhile, especially when using the https protocol.
-This can block the main thread for 0.2 to 2 seconds.
+This can block for 0.2 to 2 seconds, so only the net task calls this.
+The local access list (members.h) answers without the backend while MQTT keeps it up to
+date. If the Offline-Access setting is on, it also answers for the IDs it has when the
+backend fails, with the last known access.
 */
 int lookupID(uID_t uid, unsigned long &idEnable, char idName[])
 {
   int error = 0;
+  bool fresh;
+  unsigned long cachedEnable;
+  char cachedName[ID_NAME_MAX];
+  bool cached = membersFind(uid, cachedEnable, cachedName, fresh);
+  if (cached && fresh) { // MQTT pushes keep it up to date, see members.cpp
+    idEnable = cachedEnable;
+    strlcpy(idName, cachedName, ID_NAME_MAX);
+    return 0;
+  }
 
-  switch (stg.backendType) {
+  switch (netStg.backendType) {
     case 0: // standalone -- just testing for now
       idEnable = (uid == 2455917) ? 1 : 0; // for testing
       strlcpy(idName, "John Doe", ID_NAME_MAX);
@@ -129,256 +198,336 @@ int lookupID(uID_t uid, unsigned long &idEnable, char idName[])
       error = 999;
       break;
   }
+  if (error && cached && netStg.offlineAccess) { // the backend is down, use the last known access
+    logw("ID '%010u' lookup failed with error %i, using the local access list", uid, error);
+    idEnable = cachedEnable;
+    strlcpy(idName, cachedName, ID_NAME_MAX);
+    return 0;
+  }
+  if (!error && idEnable == (unsigned long) ID_NOT_FOUND) membersRemove(uid, false);
+  else if (!error) membersStore(uid, idEnable, idName, false);
   return error;
 }
 
 /*
-This checks user input for an ID. If an ID is input, it looks up the ID and
-allows/denies access based on the lookup info.
+Scans are handled by a state machine that's advanced by tag events and net results, so
+the scan feedback (the backlight blink is a timer), the lookup, and the display overlap,
+and nothing waits. scanMachine (see scan.h) has the states and the admin mode, and these
+functions do the I/O for it:
+  ss_idle:   a tag arrives -> blink, show "WAIT...", and send the lookup -> ss_lookup
+  ss_lookup: the lookup result arrives -> decideScan() -> scanAct() turns the lock on/off
+             first and then updates the display and the log -> ss_idle, or it sends an add
+             request in admin mode -> ss_add
+  ss_add:    the add result arrives -> show it -> ss_idle
+Tags that arrive while a lookup or add is pending are ignored (on any reader, the locks
+share the lookups). Hold-To-Run departures are handled in any state.
 */
-void processID(void)
+static scanMachine scan;
+static lockClass *scanLock; // the lock that the pending scan is for
+static int64_t scanMicros; // when the tag was read, for the scan-to-lock profile
+static char addName[ID_NAME_MAX]; // name of the ID being added in admin mode
+
+// This sends the lock and LCD state to the net task for the web dashboard
+static void publishStatus()
 {
-  char idName[ID_NAME_MAX];
-  unsigned long idEnable;
-
-  uID_t uid = rdm6300.newTagID();
-  if (uid == 0) return; // no RFID ready
-#if 0 // background blink -- bad, the lookup can block turning the backlight back on
-  lcd.blinkLight(); // turn backlight off/on to indicate RFID was read
-#else // foreground blink -- looks good
-  lcd.noBacklight(); // turn backlight off/on to indicate RFID was read
-  delay(250);
-  lcd.backlight();
-#endif
-  lcd.clear();
-  lcd.print("WAIT...");
-  // This may take time, like 0.1-1.9 seconds, blocking loop() and software timers (ie lcd blink)
-  int error = lookupID(uid, idEnable, idName);
-  lcd.init(); // re-init/clear lcd (just in case it got stuck)
-  do { // <-- not a do-loop, just used for "break;" statements
-    if (uid == 0) break;
-
-    if (error) {
+  ioStatus status;
+  snprintf(status.lcd, sizeof status.lcd, "%s\n%s", lcd.shownLine(0), lcd.shownLine(1));
+  status.on = shownLock->isAccessible();
+  strlcpy(status.user, shownLock->activeUser, sizeof status.user);
+  status.activatedTime = shownLock->ActivatedTime;
+  if (ioStatusUpdates.push(status)) netWake(); // if full, secondJob() sends it again soon
+}
+
+// This sends a lookup or add request to the net task
+static void sendNetRequest(netRequestType type, uID_t uid)
+{
+  if (!netRequests.push({type, uid})) scan.cancel(); // there's only one pending, so it's not full
+  netWake();
+}
+
+// This returns true if the ID is one of the Admin-IDs
+static bool isAdminID(uID_t uid)
+{
+  uidAdmin.zeroIndex();
+  while (uID_t adminID = uidAdmin.next()) {
+    if (adminID == uid) return true;
+  }
+  return false;
+}
+
+// This carries out the decision for a lookup result, the lock first and then the display
+static void scanAct(scanDecision decision, const netResult &result, lockClass &lock)
+{
+  uID_t uid = result.uid;
+  const char *idName = result.idName;
+  static jobProfile relayProfile("scanToLock"); // from the tag read to the lock output
+
+  // the "No longer adding" message when admin mode times out
+  if (scan.adminMode()) uidAdmin.adminTimer.start(scan.adminMillisLeft());
+  else uidAdmin.adminTimer.stop();
+  shownLock = &lock;
+  switch (decision.action) {
+    case sa_turnOn:
+      lock.startAccess();
+      relayProfile.record(monoMicros() - scanMicros);
+      if (stg.holdToRun) lock.holdID = uid;
+      lock.ActivatedTime = wallTime();
+      strlcpy(lock.activeUser, idName, sizeof lock.activeUser);
+      usagePublish(lock, true);
+      lcd.saveLine(0, idName);
+      lcd.saveLine(1, ""); // machineTimeoutUpdate() updates this line
+      lcd.print(idName);
+      lcd.setCursor(0, 1);
+      lcd.print("Enabled - ON");
+      logu("%sAccepted '%s', turned on", lock.label(), idName);
+      if (!firstAcceptMillis) {
+        firstAcceptMillis = millis();
+        logi("First accepted scan %lu ms after power-on", (unsigned long) firstAcceptMillis);
+      }
+      break;
+    case sa_turnOff:
+      lock.stopAccess();
+      relayProfile.record(monoMicros() - scanMicros);
+      machineOffSetup(lock);
+      lcd.print(idName);
+      lcd.setCursor(0, 1);
+      //         0123456789012345
+      lcd.print("Machine is OFF");
+      logu("%sAccepted '%s', turned off, %s", lock.label(), idName, usageText(lock));
+      break;
+    case sa_lookupFailed:
       //         0123456789012345
       lcd.print("Access Rejected");
       lcd.setCursor(0, 1);
-      lcd.printf("%i Lookup Fail", error);
-      logu("ID '%010u' lookup failed with error %i", uid, error);
+      lcd.printf("%i Lookup Fail", result.error);
+      logu("%sID '%010u' lookup failed with error %i", lock.label(), uid, result.error);
       break;
-    }
-
-    if (idEnable == ID_NOT_FOUND) {
+    case sa_noRecord:
       //         0123456789012345
       lcd.print("Access Rejected");
       lcd.setCursor(0, 1);
       lcd.print("No Record for ID");
-      logu("Rejected ID '%010u' for no record", uid);
+      logu("%sRejected ID '%010u' for no record", lock.label(), uid);
       break;
-    }
-
-    #define ADMIN_TIMEOUT 50
-    uidAdmin.zeroIndex();
-    if (uidAdmin.adminTimedOut.isActive()) // keep active while scanning key fobs
-      uidAdmin.adminTimedOut.reset(ADMIN_TIMEOUT);
-    while (1) { // uidAdmin search loop
-      uID_t adminID = uidAdmin.next();
-      if (adminID == 0) break; // no matching admin IDs
-      if (adminID == uid) {
-        if (uidAdmin.adminTimedOut.isActive()) { // 3rd admin scan, stop admin mode
-          uidAdmin.adminTimedOut.disable();
-          lcd.print(idName);
-          lcd.setCursor(0, 1);
-          //         0123456789012345
-          lcd.print("Adding Stopped");
-          logd("Admin mode stopped by key fob");
-          uid = 0;
-        } if (uidAdmin.startTimedOut) { // 1st admin scan, wait for 2nd admin scan
-          uidAdmin.startTimedOut.reset(10);
-        } else { // 2nd admin scan, start admin mode
-          uidAdmin.adminTimedOut.reset(ADMIN_TIMEOUT);
-          lcd.print(idName);
-          lcd.setCursor(0, 1);
-          //         0123456789012345
-          lcd.print("Scan fobs to add");
-          logi("Admin mode started by '%s'", idName);
-          uid = 0;
-          if (lock.isAccessible()) {
-            lock.stopAccess();
-            machineOffSetup();
-            logu("Auto-off (%im), used %li minutes",
-              stg.autoOffMinutes, (now() - lock.ActivatedTime + 30) / 60);
-          }
-        }
-        break;
-      } // if Admin ID matches
-    } // uidAdmin search loop
-    #undef ADMIN_TIMEOUT
-    if (uid == 0) break;
-
-    lcd.print(idName);
-    lcd.setCursor(0, 1);
-
-    if (uidAdmin.adminTimedOut.isActive()) {
-      error = (stg.backendType == 2) ? api_bodgery_v1_add(uid) : 100;
-      if (error) {
-        lcd.printf("Add Error %i", error);
-        logw("Adding '%s' failed with error %i", idName, error);
-        break;
+    case sa_adminStop:
+      lcd.print(idName);
+      lcd.setCursor(0, 1);
+      //         0123456789012345
+      lcd.print("Adding Stopped");
+      logd("Admin mode stopped by key fob");
+      break;
+    case sa_adminStart:
+      lcd.print(idName);
+      lcd.setCursor(0, 1);
+      //         0123456789012345
+      lcd.print("Scan fobs to add");
+      logi("Admin mode started by '%s'", idName);
+      if (lock.isAccessible()) {
+        lock.stopAccess();
+        machineOffSetup(lock);
+        logu("%sAuto-off (%im), %s", lock.label(), lock.cfg().autoOffMinutes, usageText(lock));
       }
-      lcd.print("Added");
-      logi("Added '%s' to active list", idName);
       break;
-    }
-
-    if (!idEnable) {
+    case sa_add:
+      lcd.print(idName);
+      lcd.setCursor(0, 1);
+      lcd.print("Adding...");
+      strlcpy(addName, idName, sizeof addName);
+      sendNetRequest(nr_add, uid); // the net task adds it and processResult() shows the result
+      break;
+    case sa_denied:
+      lcd.print(idName);
+      lcd.setCursor(0, 1);
       lcd.print("Access Rejected");
-      logu("Rejected '%s', access denied", idName);
+      logu("%sRejected '%s', access denied", lock.label(), idName);
       break;
-    }
-    if (!lock.isAccessible()) { // machine is disabled/off so turn it on
-      if (HIGH == activatedPin(stg.voltagePin)) {
-        //         0123456789012345
-        lcd.print("Turn off. Rescan");
-        logu("Turn off & re-scan to turn on, '%s'", idName);
-        break;
-      } else {
-        lcd.saveLine(0, idName);
-        lcd.saveLine(1, ""); // machineTimeoutUpdate() updates this line
-        lcd.print("Enabled - ON");
-        lock.startAccess();
-        lock.ActivatedTime = now();
-        logu("Accepted '%s', turned on", idName);
-        break;
-      }
-    }
-    if (lock.isAccessible()) { // machine already enabled/on so turn it off
-      if (HIGH == activatedPin(stg.currentPin)) {
-        //         0123456789012345
-        lcd.print("Turn off. Rescan");
-        logu("Turn off & re-scan before turning off, '%s'", idName);
-        break;
-      } else {
-        lock.stopAccess();
-        machineOffSetup();
-        //         0123456789012345
-        lcd.print("Machine is OFF");
-        logu("Accepted '%s', turned off, used %li minutes",
-          idName, (now() - lock.ActivatedTime + 30) / 60);
-        break;
-      }
-    }
-  } while (0);
-  lcd.setTimeout(); // clear above LCD message after a little while
-  return;
+    case sa_turnOffFirst:
+      lcd.print(idName);
+      lcd.setCursor(0, 1);
+      //         0123456789012345
+      lcd.print("Turn off. Rescan");
+      logu("%sTurn off & re-scan to turn on, '%s'", lock.label(), idName);
+      break;
+    case sa_holdRemoved:
+      lcd.print(idName);
+      lcd.setCursor(0, 1);
+      //         0123456789012345
+      lcd.print("Hold tag to run");
+      logu("%s'%s' removed the tag before turning on", lock.label(), idName);
+      break;
+    case sa_stopFirst:
+      lcd.print(idName);
+      lcd.setCursor(0, 1);
+      //         0123456789012345
+      lcd.print("Turn off. Rescan");
+      logu("%sTurn off & re-scan before turning off, '%s'", lock.label(), idName);
+      break;
+  }
 }
 
-/* This is for timed jobs of about 5m or more. This gets run at least every minute. */
-void minuteJobs()
+// This handles a result from the net task
+static void processResult(const netResult &result)
 {
-#if ENABLE_NTP
-  static minTimedOut NTPTimedout; // periodically get accurate time from a server
-  if (NTPTimedout) {
-    NTPTimedout.reset(59); // minutes
-    if (WiFi.status() == WL_CONNECTED) {
-      if (timeClientNTP.forceUpdate()) { // uses the Internet, has a one second timeout
-        setTime(timeClientNTP.getEpochTime());
-        if (softSeconds() / 3600 / 24 > 365 * 10 /*years*/) { // then bootTime==0, so fix it
-          bootTime = now();
-          logw("Setting boot time now because NTP failed during initial boot");
-        }
-      }
+  if (result.type == nr_add) {
+    scan.addDone();
+    lcd.setCursor(0, 1);
+    if (result.error) {
+      lcd.printf("Add Error %-6i", result.error);
+      logw("Adding '%s' failed with error %i", addName, result.error);
+    } else {
+      //          0123456789012345
+      lcd.printf("%-16s", "Added");
+      logi("Added '%s' to active list", addName);
     }
+    lcd.setTimeout(); // clear above LCD message after a little while
+    publishStatus();
+    return;
   }
-#endif
-  // ADD MORE MINUTE-TIMED JOBS HERE
+
+  lcd.clear(); // the LCD task re-initializes the display if it gets stuck
+  if (result.uid) {
+    lockClass &lock = *scanLock;
+    scanLookup x;
+    x.error = result.error;
+    x.idEnable = result.idEnable;
+    x.admin = isAdminID(result.uid);
+    x.lockOn = lock.isAccessible();
+    x.voltageOn = HIGH == voltageActive(lock.index);
+    x.currentOn = HIGH == currentActive(lock.index);
+    x.holdToRun = stg.holdToRun;
+    x.tagPresent = tagPresent(result.uid);
+    scanAct(scan.lookupDone(x), result, lock);
+  } else {
+    scan.cancel();
+  }
+  lcd.setTimeout(); // clear above LCD message after a little while
+  publishStatus(); // show the result right away
 }
 
-// This is for timed jobs of about 10s-5m. This gets run approximately once every second.
-void secondsLongJobs()
+// Hold-To-Run: this turns a lock off when the tag that turned it on departs
+static void tagDeparted(uID_t uid)
 {
-  static unsigned sixteenSeconds;
-  if ((sixteenSeconds++ & 0x0f) == 0) minuteJobs();
-
-  static secTimedOut WiFiDisconnectTimedout; // reconnect WiFi Station if it disconnected
-  static secTimedOut WifIDisMsgTimedout; // for disconnect log message
-  if (WiFiDisconnectTimedout) {
-    WiFiDisconnectTimedout.reset(60);
-    if (WiFi.status() != WL_CONNECTED) {
-      // Note: this could probably be replaced with
-      //   WiFi.setAutoReconnect(true);
-      //   WiFi.persistent(true);
-      // right after wifi.begin in setup.cpp but then we couldn't log the disconnect issue
-      WiFiDisconnectTimedout.reset(60);
-      WiFi.reconnect(); // this doesn't do anything when WiFi mode is set to WIFI_AP
-      if (WifIDisMsgTimedout) {
-        WifIDisMsgTimedout.reset(3600);
-        logw("WiFi Disconnected - reconnect attempted");
-      }
-    }
-  }
-  if (uidAdmin.adminTimedOut) {
+  for (lockClass &lock : locks) {
+    if (!lock.isAccessible() || uid != lock.holdID) continue;
+    lock.stopAccess();
+    shownLock = &lock;
+    machineOffSetup(lock);
     lcd.clear();
-    //         0123456789012345
-    lcd.print("No longer adding");
+    lcd.print(lock.activeUser);
     lcd.setCursor(0, 1);
     //         0123456789012345
-    lcd.print("fobs by scanning");
-    lcd.setTimeout(); // clear above message after a little while
-    logd("Admin mode stopped by timeout");
+    lcd.print("Machine is OFF");
+    logu("%sReleased '%s', turned off, %s", lock.label(), lock.activeUser, usageText(lock));
+    lcd.setTimeout();
+    publishStatus();
   }
-  if (uidAdmin.adminTimedOut.isActive()) {
+}
+
+// This returns the lock for a reader's scans: lock N for reader N if it's used, else lock 1
+static lockClass &lockForReader(int reader)
+{
+  int n = reader - 1;
+  return (n > 0 && n < NUM_LOCKS && locks[n].inUse()) ? locks[n] : locks[0];
+}
+
+/*
+This advances the scan state machine. It handles the net task's results and the tag
+events, and it sends the ID of a new scan to the net task to look it up.
+*/
+void processID(void)
+{
+  netResult result;
+  if (scan.state() != ss_idle && netResults.pop(result)) processResult(result);
+  tagEvent event;
+  while (nextTagEvent(event)) {
+    if (event.type == te_departed) tagDeparted(event.uid);
+    if (event.type != te_arrived || !scan.arrived()) continue; // one lookup at a time
+    scanMicros = event.micros;
+    scanLock = &lockForReader(event.reader);
+    lcd.blinkLight(); // turn backlight off/on to show the tag was read, during the lookup
+    lcd.clear();
+    lcd.print("WAIT...");
+    sendNetRequest(nr_lookup, event.uid);
+  }
+}
+
+/*
+Timed jobs are run by the scheduler (see scheduler.h) from loop(). They shouldn't take long
+since they delay any other jobs that are due.
+*/
+
+// This is run when admin mode times out
+void adminJob()
+{
+  lcd.clear();
+  //         0123456789012345
+  lcd.print("No longer adding");
+  lcd.setCursor(0, 1);
+  //         0123456789012345
+  lcd.print("fobs by scanning");
+  lcd.setTimeout(); // clear above message after a little while
+  logd("Admin mode stopped by timeout");
+}
+
+// This is for jobs that get run every second
+static void secondJob()
+{
+  static jobProfile profile("secondJob");
+  profile.start();
+  if (scan.adminMode()) {
     lcd.setCursor(15, 0); // admin-mode indicator -- also disables LCD timeout
     lcd.print("*");
   }
   machineTimeoutUpdate();
+  publishStatus();
   // ADD MORE SECOND-TIMED JOBS HERE
+  profile.stop();
 }
+static schedTimer secondTimer(secondJob);
 
-/*
- This is for timed jobs of about 10s or less. This gets run frequently -- every loop iteration.
- IMPORTANT: An expired timer will retrigger in ~25 days because of 32-bit signed int comparison,
-            so this is most useful for repetitive events. The second and minute timers are
-            more useful for single-time events.
-*/
-void millisecondJobs()
+// fast-blink=OK, slow-blink=no-WiFi, stuck-on/off=froze-up, Power-Save blinks slower
+static void ledJob();
+static schedTimer ledTimer(ledJob);
+static void ledJob()
 {
-  static msTimedOut oneSecondTimedout;
-  if (oneSecondTimedout) {
-    oneSecondTimedout.reset(1000);
-    secondsLongJobs();
-  }
-  static msTimedOut ledTimedout;
-  if (ledTimedout) { // fast-blink=OK, slow-blink=no-WiFi, stuck-on/off=froze-up
-    ledTimedout.reset((WiFi.status() == WL_CONNECTED) ? 17 : 1500);
-    digitalWrite(LED_BUILTIN, digitalRead(LED_BUILTIN) ? LOW : HIGH);
-  }
-  if (lock.update()) { // then the lock object is telling us AC-current was detected on power-on
+  ledTimer.start((WiFi.status() == WL_CONNECTED) ? (stg.powerSave ? 250 : 17) : 1500);
+  digitalWrite(LED_BUILTIN, digitalRead(LED_BUILTIN) ? LOW : HIGH);
+}
+
+// This is run at the end of a lock pulse, and after turn-on and when a sensor changes to check
+// for current right after turn-on
+void lockJob()
+{
+  static jobProfile profile("lockJob");
+  profile.start();
+  for (lockClass &lock : locks) {
+    if (!lock.update()) continue; // else the lock detected AC-current on power-on
+    shownLock = &lock;
     lcd.setCursor(0, 1);
     //         0123456789012345
     lcd.print("Turn Off. Rescan");
   }
-  lcd.update();
-  // ADD MORE MILLISECOND-TIMED JOBS HERE
+  profile.stop();
 }
 
 // This is used with the serial interface to test the scanner's working distance
-static void testScanner(void)
+static void testScannerJob(void)
 {
-  static uID_t idLast = 0;
-  static msTimedOut TestTimedout;
-  uID_t uid;
-
-  if (TestTimedout) {
-    TestTimedout.reset(200);
-    uid = rdm6300.tagID();
-    if (idLast == uid) {
-      if (uid) Serial.print('.'); // indicate tag is still present
-    } else if (uid) {
-        Serial.printf("\r\n%u", uid); // new tag
-    }
-    idLast = uid;
+  tagEvent event;
+  while (nextTagEvent(event)) {
+    if (event.type == te_present) Serial.print('.'); // indicate tag is still present
+    if (event.type == te_arrived) Serial.printf("\r\n%u:%u", event.reader, event.uid); // new tag
   }
 }
+static schedTimer testScannerTimer(testScannerJob);
+
+// This starts the periodic jobs, setup() calls this
+void startJobs()
+{
+  secondTimer.start(1000, 1000);
+  ledTimer.start(0);
+  // ADD MORE TIMED JOBS HERE
+}
 
 // This handles user input from the serial port for use in debugging
 // It returns true if in debugging mode and false for normal mode
@@ -392,30 +541,113 @@ static bool processSerialDebug(void)
     if (x == 't') {
       if (testModeForScanner) {
         testModeForScanner = false;
-        rdm6300.setTimeout();
+        testScannerTimer.stop();
         Serial.print("RFID test mode stopped.\r\n");
       } else {
         testModeForScanner = true;
-        rdm6300.setTimeout(50);
+        testScannerTimer.start(200, 200);
         Serial.print("RFID test mode started. Press 't' again to exit test mode.\r\n");
       }
     }
     if (x == ' ') serialInfo();
   }
-  if (testModeForScanner) testScanner();
   return testModeForScanner;
 }
 
+// This shows the IP address on the 2nd LCD line for a while, at boot and when WiFi comes up
+void showNetAddress()
+{
+  lcd.setCursor(0, 1);
+  if (WiFi.status() == WL_CONNECTED) {
+    lcd.print(WiFi.localIP());
+    lcd.print('/');
+    lcd.print(subnetIP());
+  } else if (WiFi.getMode() == WIFI_AP) {
+    lcd.print("AP ");
+    lcd.print(WiFi.softAPIP());
+  } else {
+    //         0123456789012345
+    lcd.print("WiFi connecting");
+  }
+  lcd.print("      "); // clear end-of-line just in case
+  lcd.setTimeout();
+}
+
+static bool reloadPending; // the config file changed, see reloadJob()
+static enum : uint8_t { rl_idle, rl_loading, rl_loaded } reloadState; // of reloadedSettings
+
+/*
+This handles the WiFi and NTP progress from the net task, which finishes them in the
+background after boot, and the settings loads. The IP address isn't shown over a user's
+display, and the boot time replaces the unset (1970) time on the idle display if the lock
+hasn't been used since boot.
+*/
+static void netEventJob()
+{
+  netEvent event;
+  while (netEvents.pop(event)) {
+    bool idle = scan.state() == ss_idle && !shownLock->isAccessible();
+    if (event == ne_timeSet && !firstAcceptMillis) {
+      lcd.saveLine(1, formattedTime(localTime(bootTime), ftm_yyyymmddhhmm));
+      if (idle && !lcd.isTimeoutActive()) lcd.printSaved();
+    }
+    if ((event == ne_wifiUp || event == ne_accessPoint) && idle) showNetAddress();
+    if (event == ne_settingsLoaded) reloadState = rl_loaded;
+  }
+}
+
+/*
+When the config file changes, the net task loads it into reloadedSettings (parsing it can
+take a while), and the I/O task owns reloadedSettings again when the net task says it's
+loaded. The I/O task applies it with reloadSettings() only when no scan is in progress, so
+a scan's lookup and its result are handled with the same readers, pins, and lock settings.
+If the file changes again during a load, it's loaded again after that one is applied.
+*/
+static void reloadJob()
+{
+  if (reloadState == rl_loaded && scan.state() == ss_idle) {
+    reloadState = rl_idle;
+    reloadSettings();
+  }
+  if (reloadPending && reloadState == rl_idle && netRequests.push({nr_reload, 0})) {
+    reloadPending = false;
+    reloadState = rl_loading;
+    netWake();
+  }
+}
+
 void loop()
 {
-  millisecondJobs(); // timed (intermittent) background jobs
+  static jobProfile loopProfile("loop"); // max is the worst loop-iteration gap, without sleep
+  static jobProfile idProfile("processID");
+  loopProfile.start();
+  powerUpdate();
+  if (sensorsUpdate() | currentUpdate()) { // a sensor changed
+    lockJob(); // current right after turn-on
+    machineTimeoutUpdate();
+  }
+  scheduler.run(); // timed (intermittent) background jobs
+  readersUpdate(); // tag events for processID()
 
-  if(rebootRequest) { // note: the source of a reboot request should log the reason
-    delay(100);
-    ESP.restart();
+  ioCommand command;
+  while (ioCommands.pop(command)) {
+    if (command == ic_reboot) { // note: the source of a reboot request should log the reason
+      delay(100);
+      ESP.restart();
+    }
+    if (command == ic_reload) reloadPending = true; // the config file was changed
   }
+  netEventJob(); // WiFi and NTP came up in the background
+  reloadJob(); // the config file was changed
 
   if (!processSerialDebug()) {
+    idProfile.start();
     processID(); // Main job of the program -- process user ID's
+    idProfile.stop();
   }
+  lcd.flush(); // post the display changes for the LCD task, if any
+  loopProfile.stop();
+  powerIdle();
+  scheduler.wait(); // sleep until a timed job is due or there's input
+  powerBusy();
 } // loop end
\ No newline at end of file
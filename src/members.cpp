@@ -0,0 +1,52 @@
+// members.cpp - local access list, kept up to date by lookups and MQTT pushes
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+/*
+The net task's local access list, see memberList in members.h.
+*/
+#include "main.h"
+
+static memberList<MEMBERS_MAX> members;
+
+// This returns true if the ID is in the list, and fresh is true if it's up to date
+bool membersFind(uID_t uid, unsigned long &idEnable, char idName[], bool &fresh)
+{
+  return members.find(uid, idEnable, idName, fresh, softSeconds());
+}
+
+// This adds or updates an ID, from a lookup or a push
+void membersStore(uID_t uid, unsigned long idEnable, const char *name, bool pushed)
+{
+  members.store(uid, idEnable, name, pushed, softSeconds());
+}
+
+void membersRemove(uID_t uid, bool pushed)
+{
+  members.remove(uid, pushed);
+}
+
+// This is called when the MQTT subscription comes up (true) or goes down (false)
+void membersTrust(bool trusted)
+{
+  members.trust(trusted);
+}
+
+int membersFormatStats(char *buffer, size_t size)
+{
+  return snprintf(buffer, size, "Access list: %i of %i IDs (%s), %lu hits, %lu stale hits, "
+    "%lu pushes", members.size(), MEMBERS_MAX, members.isTrusted() ? "pushed" : "not pushed",
+    (unsigned long) members.hits, (unsigned long) members.staleHits,
+    (unsigned long) members.pushes);
+}
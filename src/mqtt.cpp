@@ -0,0 +1,220 @@
+// mqtt.cpp - MQTT client for access list pushes, usage events, and heartbeats
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+/*
+The net task runs the MQTT client (AsyncMqttClient, on AsyncTCP), so a slow or missing broker
+never delays the I/O task. Topics, where <group> is Device-Group (Device-Name if it's blank)
+and <device> is Device-Name:
+  wacl/<group>/members          subscribed, member events from the backend, e.g.
+                                {"event":"add","id":1234567,"name":"Jane Doe"}
+                                {"event":"remove","id":1234567} or "disable"
+  wacl/<group>/<device>/usage   published, lock on/off events with the usage
+  wacl/<group>/<device>/status  published and retained, a heartbeat every
+                                MQTT_HEARTBEAT_SECONDS, and {"online":false} as the will
+The client's callbacks run in the AsyncTCP task, so they only set flags and queue the member
+events for the net task. When the connection fails or drops, mqttJob() tries again after a
+backoff that doubles from MQTT_BACKOFF_MIN_MS to MQTT_BACKOFF_MAX_MS.
+*/
+#include "main.h"
+
+#if ENABLE_MQTT
+#include <AsyncMqttClient.h>
+#include <ArduinoJson.h>
+#include "memberevent.h" // parseMemberEvent()
+
+#define MQTT_CONNECT_TIMEOUT_MS 30000
+#define MQTT_TOPIC_MAX 96
+
+static AsyncMqttClient mqtt;
+static std::atomic<bool> restart; // mqttBegin() was called
+static std::atomic<bool> connectedFlag, disconnectedFlag, subscribedFlag; // from callbacks
+static std::atomic<bool> refusedFlag; // the broker refused the subscription
+static std::atomic<unsigned> droppedMembers; // the memberEvents queue was full
+static spscQueue<memberEvent, 8> memberEvents; // AsyncTCP task -> net task
+static char broker[sizeof netStg.mqttBroker], username[sizeof netStg.mqttUsername];
+static char password[sizeof netStg.mqttPassword], clientId[sizeof netStg.hostName];
+static char membersTopic[MQTT_TOPIC_MAX], usageTopic[MQTT_TOPIC_MAX];
+static char statusTopic[MQTT_TOPIC_MAX];
+static uint16_t port;
+static uint32_t connects, published, droppedUsage;
+
+// This parses a member event, in the AsyncTCP task
+static void mqttMessage(char *, char *payload, AsyncMqttClientMessageProperties, size_t len,
+  size_t index, size_t total)
+{
+  if (index != 0 || len != total) return; // too big for one packet, not a member event
+  memberEvent event;
+  if (!parseMemberEvent(payload, len, event)) return;
+  if (!memberEvents.push(event)) droppedMembers++;
+  netWake();
+}
+
+// The net task runs this to (re)connect when it gets new MQTT settings (netStg)
+void mqttBegin()
+{
+  restart = true;
+  netWake();
+}
+
+// This copies the settings, the client keeps pointers to them while it's connected
+static void mqttSetup()
+{
+  if (mqtt.connected()) mqtt.disconnect(true);
+  strlcpy(broker, netStg.mqttBroker, sizeof broker);
+  strlcpy(username, netStg.mqttUsername, sizeof username);
+  strlcpy(password, netStg.mqttPassword, sizeof password);
+  strlcpy(clientId, netStg.hostName, sizeof clientId);
+  port = netStg.mqttPort;
+  const char *group = *netStg.deviceGroup ? netStg.deviceGroup : netStg.deviceName;
+  snprintf(membersTopic, MQTT_TOPIC_MAX, MQTT_TOPIC_ROOT "/%s/members", group);
+  snprintf(usageTopic, MQTT_TOPIC_MAX, MQTT_TOPIC_ROOT "/%s/%s/usage", group, netStg.deviceName);
+  snprintf(statusTopic, MQTT_TOPIC_MAX, MQTT_TOPIC_ROOT "/%s/%s/status", group, netStg.deviceName);
+  static bool callbacks;
+  if (!callbacks) {
+    callbacks = true;
+    mqtt.onConnect([](bool) { connectedFlag = true; netWake(); });
+    mqtt.onDisconnect([](AsyncMqttClientDisconnectReason) { disconnectedFlag = true; netWake(); });
+    mqtt.onSubscribe([](uint16_t, uint8_t qos) { // the granted QoS, 0x80=failure
+      (qos == 0x80 ? refusedFlag : subscribedFlag) = true;
+      netWake();
+    });
+    mqtt.onMessage(mqttMessage);
+  }
+  mqtt.setServer(broker, port);
+  mqtt.setCredentials(*username ? username : nullptr, *password ? password : nullptr);
+  mqtt.setClientId(clientId);
+  mqtt.setWill(statusTopic, 1, true, "{\"online\":false}");
+}
+
+static void mqttPublish(const char *topic, JsonDocument &jsonDoc, bool retain)
+{
+  char payload[200];
+  size_t len = serializeJson(jsonDoc, payload, sizeof payload);
+  if (mqtt.publish(topic, 1, retain, payload, len)) published++;
+}
+
+static void mqttHeartbeat()
+{
+  JsonDocument jsonDoc;
+  jsonDoc["online"] = true;
+  jsonDoc["time"] = (long) wallTime();
+  jsonDoc["uptime"] = softSeconds();
+  jsonDoc["heap"] = ESP.getFreeHeap();
+  jsonDoc["rssi"] = WiFi.RSSI();
+  mqttPublish(statusTopic, jsonDoc, true);
+}
+
+// This is run by the net task
+void mqttJob()
+{
+  static bool connecting;
+  static uint32_t backoffMs = MQTT_BACKOFF_MIN_MS;
+  static msTimedOut retryTimedout, connectTimedout;
+  static secTimedOut heartbeatTimedout;
+  static jobProfile profile("mqtt");
+  profile.start();
+
+  if (restart.exchange(false)) {
+    mqttSetup();
+    if (*broker) logi("MQTT broker %s:%u, topic %s", broker, port, membersTopic);
+    connecting = false;
+    backoffMs = MQTT_BACKOFF_MIN_MS;
+    retryTimedout.reset(0);
+  }
+  if (connectedFlag.exchange(false)) {
+    connecting = false;
+    backoffMs = MQTT_BACKOFF_MIN_MS;
+    connects++;
+    logi("MQTT connected to %s", broker);
+    mqtt.subscribe(membersTopic, 1);
+    heartbeatTimedout.reset(0);
+  }
+  if (subscribedFlag.exchange(false)) membersTrust(true); // pushes keep the list up to date
+  if (refusedFlag.exchange(false)) // e.g. the broker's ACL, the list stays untrusted
+    logw("MQTT broker %s refused the subscription to %s", broker, membersTopic);
+  if (disconnectedFlag.exchange(false)) {
+    if (!connecting) logw("MQTT disconnected from %s", broker);
+    connecting = false;
+    membersTrust(false); // changes may be missed until the subscription is back
+    retryTimedout.reset(backoffMs);
+    backoffMs = (backoffMs * 2 < MQTT_BACKOFF_MAX_MS) ? backoffMs * 2 : MQTT_BACKOFF_MAX_MS;
+  }
+  if (connecting && connectTimedout) { // no answer, onDisconnect() retries
+    mqtt.disconnect(true);
+    connecting = false;
+  }
+
+  memberEvent event;
+  while (memberEvents.pop(event)) {
+    if (event.type == me_remove) membersRemove(event.uid, true);
+    else membersStore(event.uid, event.type == me_add, event.name, true);
+    logi("MQTT: ID '%010u' %s", event.uid,
+      event.type == me_add ? "added" : event.type == me_remove ? "removed" : "disabled");
+  }
+  unsigned dropped = droppedMembers.exchange(0);
+  if (dropped) { // the list may be wrong, so stop trusting it until the next subscription
+    logw("MQTT: %u member events were dropped", dropped);
+    membersTrust(false);
+    mqtt.disconnect();
+  }
+
+  usageEvent usage;
+  while (usageEvents.pop(usage)) {
+    if (!mqtt.connected()) {
+      droppedUsage++;
+      continue;
+    }
+    JsonDocument jsonDoc;
+    jsonDoc["lock"] = usage.lock + 1;
+    jsonDoc["event"] = usage.on ? "on" : "off";
+    jsonDoc["user"] = usage.user;
+    jsonDoc["time"] = (long) wallTime();
+    if (!usage.on) {
+      jsonDoc["enabledSeconds"] = usage.enabledSeconds;
+      jsonDoc["poweredSeconds"] = usage.poweredSeconds;
+      if (usage.wattHours >= 0) jsonDoc["wattHours"] = usage.wattHours;
+    }
+    mqttPublish(usageTopic, jsonDoc, false);
+  }
+
+  if (*broker && !mqtt.connected() && !connecting && retryTimedout &&
+      WiFi.status() == WL_CONNECTED) {
+    connecting = true;
+    connectTimedout.reset(MQTT_CONNECT_TIMEOUT_MS);
+    mqtt.connect(); // doesn't wait, the callbacks report the result
+  }
+  if (mqtt.connected() && heartbeatTimedout) {
+    heartbeatTimedout.reset(MQTT_HEARTBEAT_SECONDS);
+    mqttHeartbeat();
+  }
+  profile.stop();
+}
+
+int mqttFormatStats(char *buffer, size_t size)
+{
+  if (!*broker) return 0;
+  return snprintf(buffer, size, "MQTT: %s %s, %lu connects, %lu published, %lu usage dropped",
+    mqtt.connected() ? "connected to" : "not connected to", broker, (unsigned long) connects,
+    (unsigned long) published, (unsigned long) droppedUsage);
+}
+#else
+void mqttBegin() {}
+void mqttJob()
+{
+  usageEvent usage;
+  while (usageEvents.pop(usage)) /*NULL*/;
+}
+int mqttFormatStats(char *, size_t) { return 0; }
+#endif
@@ -0,0 +1,237 @@
+// nettask.cpp - network task: backend lookups, logging, NTP, WiFi, web dashboard
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+#include "main.h"
+#if ENABLE_NTP
+#include <AsyncUDP.h>
+#endif
+
+/*
+The net task does the jobs that can block for a while, like backend lookups over the
+Internet and writing the log to the filesystem, so they never delay the I/O task (loop())
+that runs the reader, the lock, and the LCD. See "Tasks" in main.h.
+*/
+#define NET_TASK_WAIT 1000 // ms, the net task's timed jobs run at least this often
+#define WIFI_CONNECT_SECONDS 12 // after boot, then fall back to Access Point mode
+
+/*
+setup() doesn't wait for WiFi (see setupWiFi()). The WiFi event callback wakes the net task
+when the station gets an IP address, and then the net task starts getting the time and tells
+the I/O task to show the address. The callback runs in the WiFi event task, so it only sets a flag.
+*/
+static std::atomic<bool> wifiGotIP;
+
+// This does the lookups, adds, and config file loads for the I/O task
+static void netRequestJob()
+{
+  netRequest request;
+  while (netRequests.pop(request)) {
+    if (request.type == nr_reload) { // the parse can take a while, so it's done here
+      uint32_t parseMicros;
+      reloadedSettings.loadSettings(parseMicros);
+      ioNotify(ne_settingsLoaded);
+      continue;
+    }
+    netResult result = {};
+    result.type = request.type;
+    result.uid = request.uid;
+    static jobProfile profile("lookup");
+    profile.start();
+    if (request.type == nr_lookup) {
+      result.error = lookupID(request.uid, result.idEnable, result.idName);
+    } else {
+      result.error = (netStg.backendType == 2) ? api_bodgery_v1_add(request.uid) : 100;
+    }
+    profile.stop();
+    while (!netResults.push(result)) delay(10); // the I/O task takes one at a time
+    scheduler.wake();
+  }
+}
+
+#if ENABLE_NTP
+/*
+This is the SNTP client for wallClock (see sntp.h). It sends a request and returns, so the net
+task never waits for the server. The reply comes to AsyncUDP's onPacket() callback in the
+async_udp task, which gets monoMicros() for t4 right away, passes the reply on through
+ntpReplies, and wakes the net task. So t4 is when the reply came, not when the net task got
+to it. Note: looking up the server's address can block, but lwIP caches it, and it's only
+looked up again after a failure.
+*/
+#define NTP_REPLY_TIMEOUT_MS 1000
+#define NTP_RETRY_SECONDS 16 // after a failure
+static msTimedOut ntpPollTimedout; // times out right away
+
+struct ntpReply {
+  int64_t t4; // monoMicros() when it came
+  int size;
+  uint8_t packet[SNTP_PACKET_SIZE];
+};
+static spscQueue<ntpReply, 2> ntpReplies; // async_udp task -> net task
+
+static void ntpJob()
+{
+  static AsyncUDP udp;
+  static IPAddress server;
+  static bool resolved;
+  static int64_t sentMicros; // the request's nonce too, 0=no request out
+  static msTimedOut replyTimedout;
+  static jobProfile profile("ntpRoundTrip");
+  ntpReply reply;
+
+  while (ntpReplies.pop(reply)) {
+    int64_t t2, t3;
+    if (!sentMicros || !sntpParse(reply.packet, reply.size, sentMicros, t2, t3))
+      continue; // not a reply to the request that's out
+    profile.record(reply.t4 - sentMicros);
+    bool wasSet = wallClock.isSet();
+    sntpClock::result result = wallClock.sample(sentMicros, t2, t3, reply.t4);
+    if (result == sntpClock::sr_stepped) {
+      setBootTime(); // timers aren't affected, they use the monotonic clock
+      if (!wasSet) {
+        logi("NTP set the time, %lu ms after power-on", millis());
+        ioNotify(ne_timeSet);
+      } else {
+        logw("NTP stepped the time by %li ms", (long) (wallClock.lastOffset / 1000));
+      }
+    }
+    sentMicros = 0;
+    ntpPollTimedout.reset(result == sntpClock::sr_rejected ? NTP_RETRY_SECONDS * 1000
+                                                           : wallClock.pollSeconds() * 1000);
+  }
+  if (sentMicros) { // waiting for the reply
+    if (!replyTimedout) return; // onPacket() wakes the net task
+    udp.close();
+    sentMicros = 0;
+    resolved = false;
+    ntpPollTimedout.reset(NTP_RETRY_SECONDS * 1000);
+    return;
+  }
+  if (!ntpPollTimedout || WiFi.status() != WL_CONNECTED) return;
+  ntpPollTimedout.reset(NTP_RETRY_SECONDS * 1000); // in case this fails
+  if (!resolved && !(resolved = WiFi.hostByName(NTP_SERVER, server))) return;
+  if (!udp.connected()) {
+    if (!udp.connect(server, 123)) return; // any local port
+    udp.onPacket([](AsyncUDPPacket &packet) {
+      ntpReply reply;
+      reply.t4 = monoMicros();
+      reply.size = packet.length() < sizeof reply.packet ? packet.length() : sizeof reply.packet;
+      memcpy(reply.packet, packet.data(), reply.size);
+      if (ntpReplies.push(reply)) netWake();
+    });
+  }
+  uint8_t packet[SNTP_PACKET_SIZE];
+  sentMicros = monoMicros();
+  sntpRequest(packet, sentMicros);
+  if (udp.write(packet, sizeof packet) != sizeof packet) {
+    udp.close();
+    sentMicros = 0;
+    return;
+  }
+  replyTimedout.reset(NTP_REPLY_TIMEOUT_MS);
+}
+#endif
+
+// This finishes the WiFi bring-up, it returns true when the station got an IP address
+static bool wifiUpJob()
+{
+  static bool settled; // connected or fell back to Access Point mode
+  if (wifiGotIP.exchange(false)) {
+    logi("WiFi connection established, IP %s, %lu ms after power-on",
+      WiFi.localIP().toString().c_str(), millis());
+    settled = true;
+    ioNotify(ne_wifiUp);
+    return true;
+  }
+  if (settled || millis() < WIFI_CONNECT_SECONDS * 1000) return false;
+  settled = true;
+  if (WiFi.getMode() == WIFI_STA) { // still connecting, like setup() used to wait for
+    logw("Connecting to WiFi '%s' failed", netStg.wifiSSID);
+    setupWiFiAccessPoint();
+    ioNotify(ne_accessPoint);
+  }
+  return false;
+}
+
+// This reconnects WiFi Station if it disconnected
+static void wifiJob()
+{
+  static secTimedOut WifIDisMsgTimedout; // for disconnect log message
+  if (WiFi.status() != WL_CONNECTED) {
+    // Note: this could probably be replaced with
+    //   WiFi.setAutoReconnect(true);
+    //   WiFi.persistent(true);
+    // right after wifi.begin in setup.cpp but then we couldn't log the disconnect issue
+    WiFi.reconnect(); // this doesn't do anything when WiFi mode is set to WIFI_AP
+    if (WifIDisMsgTimedout) {
+      WifIDisMsgTimedout.reset(3600);
+      logw("WiFi Disconnected - reconnect attempted");
+    }
+  }
+}
+
+static void netTaskLoop(void *)
+{
+  static ioStatus status; // latest status from the I/O task
+  secTimedOut wifiTimedout(60);
+  static jobProfile logProfile("logFlush");
+  static jobProfile webProfile("dashboard");
+
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(NET_TASK_WAIT)); // netWake() or timeout
+    powerBusy();
+    uint64_t changed = netStg.refresh(); // settings published by the I/O task
+    if (changed & (SETTING_BIT(mqttBroker) | SETTING_BIT(mqttPort) | SETTING_BIT(mqttUsername) |
+                   SETTING_BIT(mqttPassword) | SETTING_BIT(deviceName) | SETTING_BIT(deviceGroup)))
+      mqttBegin(); // reconnect with the new settings (and connect for the 1st time)
+    netRequestJob();
+    logProfile.start();
+    logFlush();
+    logProfile.stop();
+    while (ioStatusUpdates.pop(status)) /*NULL*/;
+    webProfile.start();
+    webDashboardUpdate(status);
+    webProfile.stop();
+    if (wifiUpJob()) { // the station just got an IP address
+#if ENABLE_NTP
+      if (!wallClock.isSet()) ntpPollTimedout.reset(0); // get the time now
+#endif
+    }
+#if ENABLE_NTP
+    ntpJob();
+#endif
+    mqttJob();
+    if (wifiTimedout) {
+      wifiTimedout.reset(60); // seconds
+      wifiJob();
+    }
+    // ADD MORE NETWORK JOBS HERE
+    powerIdle();
+  }
+}
+
+// This is called by setup() before it starts connecting to WiFi
+void wifiEventsBegin()
+{
+  WiFi.onEvent([](arduino_event_id_t, arduino_event_info_t) {
+    wifiGotIP = true;
+    netWake(); // no-op before startNetTask(), the net task checks the flag when it starts
+  }, ARDUINO_EVENT_WIFI_STA_GOT_IP);
+}
+
+// This is called at the end of setup()
+void startNetTask()
+{
+  xTaskCreatePinnedToCore(netTaskLoop, "net", NET_TASK_STACK, nullptr, 1, &netTask,
+    NET_TASK_CORE);
+}
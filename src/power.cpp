@@ -0,0 +1,224 @@
+// power.cpp - low-power idle mode
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+/*
+When the Power-Save setting is on, the ESP32 goes into automatic light sleep whenever all
+tasks are waiting, and the CPU runs at a low frequency unless a task is busy. WiFi stays
+associated by using modem sleep (it wakes for the access point's beacons). The device
+wakes up for:
+  - scheduled timers (the scheduler's wait() and the net task's timeout)
+  - the start of a reader frame on a reader's RX pin (the UART doesn't run in light sleep,
+    so light sleep is blocked for a little while after that so the reader's frames are read)
+  - a change on the current and voltage sensor pins (sensors.cpp)
+The pins use level interrupts because only level wakeups work in light sleep. An RX pin's
+interrupt disables itself and the I/O task re-arms it after the reader is done. Wiegand
+readers' pulses are too short to wake it up, so there's no light sleep (just the low CPU
+frequency) when one is used.
+
+Automatic light sleep needs CONFIG_PM_ENABLE in the framework's sdkconfig. Without it, this
+only lowers the CPU frequency and turns on WiFi modem sleep.
+*/
+#include "main.h"
+#include <driver/gpio.h>
+#include <hal/gpio_ll.h>
+#if CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#endif
+
+#define RX_AWAKE_MS (TAG_TIMEOUT + 100) // stay awake this long after a reader frame starts
+#define WAKE_PINS NUM_READERS // the readers' RX pins
+
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t cpuLock; // full CPU speed while a task is busy
+static esp_pm_lock_handle_t awakeLock; // no light sleep while the reader is sending
+#endif
+static int wakePins[WAKE_PINS]; // pins with wakeup interrupts, 0=none
+static bool lightSleepOn; // setupPower() turned on automatic light sleep
+static std::atomic<uint8_t> pinsFired; // a bit for each of wakePins
+
+static void IRAM_ATTR wakeISR(void *arg)
+{
+  int bit = (intptr_t) arg;
+  // Level interrupt, so the I/O task re-arms it. gpio_intr_disable() is in flash, so the
+  //   IRAM-safe HAL call is used.
+  gpio_ll_intr_disable(&GPIO, (gpio_num_t) wakePins[bit]);
+  pinsFired |= 1 << bit;
+  scheduler.wakeFromISR();
+}
+
+// This enables the level interrupt and light-sleep wakeup for a pin
+static void armPin(int pin, int bit, int level)
+{
+  attachInterruptArg(pin, wakeISR, (void *) (intptr_t) bit, level ? ONHIGH : ONLOW);
+  gpio_wakeup_enable((gpio_num_t) pin, level ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+}
+
+static void disarmPin(int &pin)
+{
+  if (!pin) return;
+  detachInterrupt(pin);
+  gpio_wakeup_disable((gpio_num_t) pin);
+  pin = 0;
+}
+
+// This is the RX pins' stay-awake timer
+static void rxAwakeJob()
+{
+#if CONFIG_PM_ENABLE
+  esp_pm_lock_release(awakeLock);
+#endif
+  for (int i = 0; i < NUM_READERS; i++) {
+    if (wakePins[i]) armPin(wakePins[i], i, LOW);
+  }
+}
+static schedTimer rxAwakeTimer(rxAwakeJob);
+
+// This handles the wakeup interrupts, loop() runs this each time it wakes up
+void powerUpdate()
+{
+  uint8_t fired = pinsFired.exchange(0);
+  if (!fired) return;
+#if CONFIG_PM_ENABLE
+  if (!rxAwakeTimer.isActive()) esp_pm_lock_acquire(awakeLock);
+#endif
+  rxAwakeTimer.start(RX_AWAKE_MS);
+}
+
+/*
+The I/O and net tasks call these when they start and stop doing something, so the CPU
+runs at full speed while they're busy.
+*/
+void powerBusy()
+{
+#if CONFIG_PM_ENABLE
+  if (cpuLock) esp_pm_lock_acquire(cpuLock);
+#endif
+}
+void powerIdle()
+{
+#if CONFIG_PM_ENABLE
+  if (cpuLock) esp_pm_lock_release(cpuLock);
+#endif
+}
+
+// This is called by setup() and reloadSettings() after the pins are set up
+void setupPower()
+{
+  static bool first = true;
+  static uint32_t maxMHz;
+  if (first) {
+    first = false;
+    maxMHz = getCpuFrequencyMhz();
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "busy", &cpuLock);
+    esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "reader", &awakeLock);
+    powerBusy(); // for the I/O task (this task)
+    esp_sleep_enable_gpio_wakeup();
+#endif
+  }
+  if (rxAwakeTimer.isActive()) {
+    rxAwakeTimer.stop();
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_release(awakeLock);
+#endif
+  }
+  for (int i = 0; i < WAKE_PINS; i++) disarmPin(wakePins[i]);
+  pinsFired = 0;
+
+  lightSleepOn = false;
+  bool lightSleep = stg.powerSave;
+  for (int i = 0; i < NUM_READERS; i++) {
+    if (!lightSleep || !readers[i] || readers[i]->lightSleepOK()) continue;
+    logw("Power-Save: no light sleep with a %s reader", readers[i]->type());
+    lightSleep = false;
+  }
+#if CONFIG_PM_ENABLE
+  esp_pm_config_esp32_t pm = {
+    .max_freq_mhz = (int) maxMHz,
+    .min_freq_mhz = stg.powerSave ? POWER_MIN_MHZ : (int) maxMHz,
+    .light_sleep_enable = lightSleep,
+  };
+  if (esp_pm_configure(&pm) != ESP_OK) loge("Power management setup failed");
+  else lightSleepOn = lightSleep;
+#else
+  setCpuFrequencyMhz(stg.powerSave ? 80 : maxMHz); // WiFi needs at least 80 MHz
+  if (stg.powerSave) logw("Power-Save: light sleep isn't available in this build");
+#endif
+  if (!stg.powerSave) return;
+  WiFi.setSleep(true); // modem sleep, WiFi stays associated (this is also the default)
+
+  for (int i = 0; i < NUM_READERS; i++) { // the readers' RX pins, they're idle-high
+    int pin = readers[i] ? readers[i]->wakePin() : -1;
+    if (pin <= 0) continue;
+    wakePins[i] = pin;
+    armPin(pin, i, LOW);
+  }
+}
+
+#if CONFIG_PM_ENABLE && CONFIG_PM_PROFILING
+/*
+This returns the microseconds spent in light sleep since boot, from esp_pm's mode stats,
+or -1 if they aren't there. esp_pm only prints them, after the locks, in a line like
+  SLEEP     80M        123456789             97%
+*/
+static int64_t sleepMicros()
+{
+  static char dump[2048];
+  FILE *f = fmemopen(dump, sizeof dump - 1, "w");
+  if (!f) return -1;
+  esp_pm_dump_locks(f);
+  long len = ftell(f);
+  fclose(f);
+  dump[len > 0 && len < (long) sizeof dump ? len : sizeof dump - 1] = 0;
+  const char *line = strstr(dump, "\nSLEEP");
+  long long micros;
+  if (!line || sscanf(line + 1, "SLEEP %*uM %lld", &micros) != 1) return -1;
+  return micros;
+}
+#endif
+
+/*
+This estimates the average current from the sleep residency. When esp_pm's profiling is in
+the build (CONFIG_PM_PROFILING), the time in light sleep is measured, the I/O task's busy
+time is at the awake current, and the rest is at the idle current. Otherwise the busy time
+is only the I/O task's (the net, AsyncTCP, LCD and current tasks aren't counted), and the
+rest is at the light-sleep current if the chip can sleep: light sleep is in the build,
+setupPower() turned it on (a Wiegand reader turns it off), and the ADC isn't sampling an
+analog current sensor. basis gets a description of how it was estimated.
+*/
+unsigned powerEstimateMilliamps(unsigned busyPermille, const char **basis)
+{
+  if (busyPermille > 1000) busyPermille = 1000;
+#if CONFIG_PM_ENABLE && CONFIG_PM_PROFILING
+  static int64_t lastSleep = -1, lastNow;
+  int64_t sleep = sleepMicros(), now = monoMicros();
+  bool measured = sleep >= 0 && lastSleep >= 0 && now > lastNow;
+  unsigned sleepPermille = measured ? (sleep - lastSleep) * 1000 / (now - lastNow) : 0;
+  lastSleep = sleep;
+  lastNow = now;
+  if (measured) {
+    if (sleepPermille > 1000) sleepPermille = 1000;
+    if (busyPermille > 1000 - sleepPermille) busyPermille = 1000 - sleepPermille;
+    *basis = "measured light sleep";
+    return (sleepPermille * POWER_SLEEP_MA + busyPermille * POWER_AWAKE_MA +
+      (1000 - sleepPermille - busyPermille) * POWER_IDLE_MA + 500) / 1000;
+  }
+#endif
+  bool canSleep = lightSleepOn && !currentSampling();
+  *basis = canSleep ? "I/O task busy, light sleep" : "I/O task busy, no light sleep";
+  unsigned idleMA = canSleep ? POWER_SLEEP_MA : POWER_IDLE_MA;
+  return (busyPermille * POWER_AWAKE_MA + (1000 - busyPermille) * idleMA + 500) / 1000;
+}
@@ -0,0 +1,41 @@
+// profiler.cpp - job run-time profiling with log2 histograms
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+#include "profiler.h"
+
+void jobProfile::record(uint32_t micros)
+{
+  if (count == 0 || micros < minMicros) minMicros = micros;
+  if (micros > maxMicros) maxMicros = micros;
+  totalMicros += micros;
+  count++;
+  int bucket = micros ? 32 - __builtin_clz(micros) : 0; // log2(micros) + 1
+  histogram[(bucket < PROFILE_BUCKETS) ? bucket : PROFILE_BUCKETS - 1]++;
+}
+
+/*
+This formats the stats like this, where the histogram counts are for times of 0 us, 1 us,
+2-3 us, 4-7 us, etc. up to the largest time:
+  lockJob   n=153 min=4 mean=6 max=41 us; log2 hist: 0 0 0 12 130 9 2
+*/
+int jobProfile::format(char *buffer, size_t size)
+{
+  int last = PROFILE_BUCKETS - 1;
+  while (last > 0 && histogram[last] == 0) last--;
+  int len = snprintf(buffer, size, "%-9s n=%u min=%u mean=%u max=%u us; log2 hist:", name, count,
+    minMicros, count ? (unsigned) (totalMicros / count) : 0, maxMicros);
+  for (int i = 0; i <= last && len < (int) size; i++)
+    len += snprintf(buffer + len, size - len, " %u", histogram[i]);
+  return len;
+}
@@ -15,23 +15,37 @@ You should have received a copy of the GNU General Public License along with WAC
 
 /*
 NOTE:
-This is currently set up for ESP32 using RX2 = GPIO16 = Serial2 (Hardware Serial)
+Reader 1 uses Serial2 (RX2 = GPIO16 by default) and reader 2 uses Serial1, which
+must have its pins set because its default pins are used for the flash memory.
 
 The ESP32 is able to reassign any of the three UARTs to different pins using
 a feature called either GPIO Matrix, Pin Mux, or IO MUX.
+
+The bytes are decoded by the UART's event task as they arrive (see em4100.h), so frames
+aren't lost or delayed when loop() is busy.
 */
 #include "main.h"
 
-#include <rdm6300.h>
+void rdm6300Class::begin(int8_t rxPin, int8_t txPin)
+{
+  serial.end(); // in case the pins are being changed
+  this->rxPin = rxPin;
+  serial.begin(RDM6300_BAUDRATE, SERIAL_8N1, rxPin, txPin);
+  serial.onReceive([this]() { receive(); });
+}
 
-Rdm6300 rdm6300obj;
+// This is run by the UART's event task when bytes are received
+void rdm6300Class::receive()
+{
+  int64_t now = monoMicros();
+  uID_t uid;
+  while (serial.available()) {
+    if (decoder.feed(serial.read(), uid)) received(uid, now);
+  }
+}
 
-void rdm6300Class::begin(int8_t rxPin, int8_t txPin)
+int rdm6300Class::formatStats(char *buffer, size_t size)
 {
-  Serial2.begin(RDM6300_BAUDRATE, SERIAL_8N1, rxPin, txPin);
-  rdm6300obj.set_tag_timeout(RDM6300_TIMEOUT);
-  rdm6300obj.begin(&Serial2);
+  return snprintf(buffer, size, "%u frames, %u checksum errors, %u framing errors",
+    decoder.frames, decoder.checksumErrors, decoder.framingErrors);
 }
-uint32_t rdm6300Class::tagID() { return rdm6300obj.get_tag_id(); }
-uint32_t rdm6300Class::newTagID() { return rdm6300obj.get_new_tag_id(); }
-void rdm6300Class::setTimeout(uint32_t x) { rdm6300obj.set_tag_timeout(x); }
\ No newline at end of file
@@ -0,0 +1,120 @@
+// reader.cpp - tag readers, tag presence, and tag events
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+#include "main.h"
+
+static presenceEngine<NUM_READERS, 8> presence; // I/O task, see presence.h
+
+// This is run by a reader's task or interrupt for each valid frame
+void tagReader::received(uID_t uid, int64_t micros)
+{
+  if (!frames.push({uid, micros})) {
+    droppedFrames++;
+    return;
+  }
+  scheduler.wake(); // so loop() handles the tag right away
+}
+
+bool nextTagEvent(tagEvent &x) { return presence.nextEvent(x); }
+
+static int64_t awayMicros()
+{
+  return (stg.tagAwayMilliseconds > 0 ? stg.tagAwayMilliseconds : TAG_AWAY_MS) * 1000LL;
+}
+
+// This makes the departed events and then starts departTimer for the next departure
+static void readersDepartJob(void);
+static schedTimer departTimer(readersDepartJob);
+static void readersDepartJob(void)
+{
+  int64_t now = monoMicros();
+  int64_t next = presence.depart(now, awayMicros());
+  if (next != INT64_MAX) departTimer.start((next - now + 999) / 1000);
+}
+
+// This turns the frames from all the readers into tag events
+void readersUpdate(void)
+{
+  bool received = false;
+  int64_t away = awayMicros();
+  for (int i = 0; i < NUM_READERS; i++) {
+    tagReader *reader = readers[i];
+    if (!reader) continue;
+    reader->update();
+    tagFrame frame;
+    while (reader->frames.pop(frame)) {
+      received = true;
+      presence.frame(i, frame, away);
+    }
+  }
+  if (received) readersDepartJob();
+}
+
+// This returns true if the tag is present at any reader
+bool tagPresent(uID_t uid)
+{
+  for (int i = 0; i < NUM_READERS; i++) {
+    if (readers[i] && uid && presence.presentID(i) == uid) return true;
+  }
+  return false;
+}
+
+// This returns the reader for a reader type setting, or nullptr if there's none
+static tagReader *readerForType(int type, int index)
+{
+  switch (type) {
+    case 0: // none, but reader 1 defaults to rdm6300 for older config files
+      return index ? nullptr : &rdm6300Reader1;
+    case 3:
+      return index ? &rdm6300Reader2 : &rdm6300Reader1;
+    case 4:
+      return index ? &wiegandReader2 : &wiegandReader1;
+    default:
+      logw("Reader %i type %i isn't supported", index + 1, type);
+      return nullptr;
+  }
+}
+
+// This (re)starts the readers per the settings, setup() and reloadSettings() run this
+void readersBegin(void)
+{
+  for (int i = 0; i < NUM_READERS; i++) {
+    if (readers[i]) readers[i]->end();
+    readers[i] = nullptr;
+  }
+  departTimer.stop();
+  presence.forget();
+  readers[0] = readerForType(stg.readerType, 0);
+  readers[1] = readerForType(stg.reader2Type, 1);
+  if (readers[1] == &rdm6300Reader2 && stg.rx1Pin < 0) { // default pins are flash
+    logw("Reader 2 needs Rx1-Pin");
+    readers[1] = nullptr;
+  }
+  if (readers[0]) readers[0]->begin(stg.rx2Pin, stg.tx2Pin);
+  if (readers[1]) readers[1]->begin(stg.rx1Pin, stg.tx1Pin);
+}
+
+// This formats a line of stats for the reader (index), it returns 0 if it's not used
+int readersFormatStats(char *buffer, size_t size, int index)
+{
+  tagReader *reader = readers[index];
+  if (!reader) return 0;
+  int len = snprintf(buffer, size, "Reader %i (%s): ", index + 1, reader->type());
+  if (len < (int) size) len += reader->formatStats(buffer + len, size - len);
+  if (len < (int) size) {
+    len += snprintf(buffer + len, size - len, ", %u/%u dropped frames/events, %u suppressed",
+      reader->droppedFrames, presence.droppedEvents(), presence.suppressedScans(index));
+  }
+  return len;
+}
@@ -0,0 +1,171 @@
+// scheduler.cpp - timer wheel scheduler for timed jobs
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+/*
+Level 0 of the wheel has a slot for each of the next 64 milliseconds. Each slot of level 1
+covers 64 ms, level 2 covers 4 s, and level 3 covers 4.4 minutes, so the wheel covers
+4.6 hours. Longer timers wait in the last slot of level 3 and get put back in the wheel
+when that slot is reached. When level 0 wraps around, the next slot of level 1 is
+"cascaded" into level 0, and so on for the higher levels.
+*/
+#include "scheduler.h"
+#include "profiler.h"
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define levelShift(level) ((level) * WHEEL_BITS)
+#define MAX_WAIT_MS 10000 // upper limit for wait(), just in case
+
+void schedTimer::start(uint32_t ms, uint32_t periodMs)
+{
+  stop();
+  expires = monoMillis() + ms;
+  period = periodMs;
+  scheduler.add(this);
+}
+
+void schedTimer::stop()
+{
+  if (!pprev) return;
+  *pprev = next;
+  if (next) next->pprev = pprev;
+  pprev = nullptr;
+}
+
+// This puts a timer in the wheel slot for its expiration time
+void schedulerClass::add(schedTimer *timer)
+{
+  int32_t delta = timer->expires - tick;
+  if (delta < 0) { // past due, so do it on the next tick
+    timer->expires = tick;
+    delta = 0;
+  }
+  int level;
+  uint32_t slot;
+  for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+    if (delta < (1L << levelShift(level + 1))) break;
+  }
+  if (delta < (1L << levelShift(WHEEL_LEVELS))) {
+    slot = (timer->expires >> levelShift(level)) & WHEEL_MASK;
+  } else { // too far away, so use the last slot and re-add it when it's reached
+    slot = ((tick >> levelShift(level)) - 1) & WHEEL_MASK;
+  }
+  schedTimer **head = &wheel[level][slot];
+  timer->next = *head;
+  if (*head) (*head)->pprev = &timer->next;
+  *head = timer;
+  timer->pprev = head;
+  occupied[level] |= 1ULL << slot;
+}
+
+// This moves the timers in a slot of a higher level into the lower levels
+void schedulerClass::cascade(int level, int slot)
+{
+  schedTimer *timer = wheel[level][slot];
+  wheel[level][slot] = nullptr;
+  occupied[level] &= ~(1ULL << slot);
+  while (timer) {
+    schedTimer *next = timer->next;
+    add(timer);
+    timer = next;
+  }
+}
+
+// This runs the callbacks for the timers in a level 0 slot
+void schedulerClass::runSlot(int slot)
+{
+  schedTimer *pending = wheel[0][slot]; // callbacks may start or stop any timer
+  wheel[0][slot] = nullptr;
+  occupied[0] &= ~(1ULL << slot);
+  if (pending) pending->pprev = &pending;
+  while (pending) {
+    schedTimer *timer = pending;
+    timer->stop();
+    if (timer->period) {
+      timer->expires += timer->period;
+      add(timer);
+    }
+    if (timer->callback) timer->callback();
+  }
+}
+
+// This is called by the main loop to run the timers that are due
+void schedulerClass::run()
+{
+  uint32_t now = monoMillis();
+  while ((int32_t) (now - tick) >= 0) {
+    int slot = tick & WHEEL_MASK;
+    if (slot == 0) { // level 0 wrapped around
+      for (int level = 1; level < WHEEL_LEVELS; level++) {
+        int x = (tick >> levelShift(level)) & WHEEL_MASK;
+        cascade(level, x);
+        if (x) break; // this level didn't wrap around
+      }
+    }
+    if (occupied[0] & (1ULL << slot)) {
+      static jobProfile lateProfile("timerLate"); // how late timers run, ms resolution
+      lateProfile.record((now - tick) * 1000);
+      runSlot(slot);
+    } else if (!occupied[0]) { // skip ahead to the next cascade
+      uint32_t nextWrap = (tick | WHEEL_MASK) + 1;
+      tick = ((int32_t) (now - nextWrap) >= 0) ? nextWrap : now + 1;
+      continue;
+    }
+    tick++;
+  }
+}
+
+// This returns the number of ms until the next timer or cascade is due
+uint32_t schedulerClass::msUntilNext()
+{
+  uint32_t next = tick + MAX_WAIT_MS;
+  for (int level = 0; level < WHEEL_LEVELS; level++) {
+    if (!occupied[level]) continue;
+    // rotate the occupied bits so the next slot to be processed is bit 0
+    uint32_t base = ((tick - 1) >> levelShift(level)) + 1;
+    int rot = base & WHEEL_MASK;
+    uint64_t bits = (occupied[level] >> rot) | (rot ? occupied[level] << (WHEEL_SLOTS - rot) : 0);
+    uint32_t due = (base + __builtin_ctzll(bits)) << levelShift(level);
+    if ((int32_t) (due - next) < 0) next = due;
+  }
+  int32_t ms = next - (uint32_t) monoMillis();
+  return (ms > 0) ? ms : 0;
+}
+
+void schedulerClass::begin()
+{
+  task = xTaskGetCurrentTaskHandle(); // note: tick starts at 0 for timers started earlier
+  lastWake = micros();
+}
+
+void schedulerClass::wait()
+{
+  uint32_t ms = msUntilNext();
+  busyMicros += micros() - lastWake;
+  if (ms) ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms));
+  lastWake = micros();
+  wakeups++;
+}
+
+void schedulerClass::wake()
+{
+  if (task) xTaskNotifyGive(task);
+}
+
+void IRAM_ATTR schedulerClass::wakeFromISR()
+{
+  BaseType_t higherPriorityTaskWoken = pdFALSE;
+  if (task) vTaskNotifyGiveFromISR(task, &higherPriorityTaskWoken);
+  if (higherPriorityTaskWoken) portYIELD_FROM_ISR();
+}
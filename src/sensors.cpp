@@ -0,0 +1,194 @@
+// sensors.cpp - interrupt-driven current and voltage sensor pins
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+/*
+The locks' digital current and voltage sensor pins use interrupts, so a machine that's switched on
+and off between the I/O task's checks isn't missed, and a change is seen right away. The
+interrupts are level-triggered because only level interrupts wake the ESP32 from light
+sleep: each one re-arms its pin for the opposite level and queues a timestamped edge.
+sensorsUpdate() debounces the edges for the I/O task: a change is taken right away unless
+the last change was less than SENSOR_DEBOUNCE_MS ago, and then the pin's latest level is
+taken when that time is up. The latest edges are kept for diagnostics. An analog current
+sensor (current.cpp) doesn't use this.
+*/
+#include "main.h"
+#include <driver/gpio.h>
+#include <hal/gpio_ll.h>
+
+#define SENSOR_QUEUE 16 // edges, a power of 2
+#define SENSOR_HISTORY 8 // edges kept for diagnostics
+#define SENSOR_DEBOUNCE_US (SENSOR_DEBOUNCE_MS * 1000)
+#define NUM_SENSORS (NUM_LOCKS * SENSORS_PER_LOCK) // sensor i is lock i / 2's sensorIndex i % 2
+
+struct sensorEdge {
+  uint8_t sensor; // index in pins[]
+  uint8_t level; // the pin's level after the edge
+  int64_t micros; // monoMicros() of the interrupt
+};
+
+static int pins[NUM_SENSORS]; // pins with interrupts, 0=none (no pin, analog, or shared)
+static spscQueue<sensorEdge, SENSOR_QUEUE> edges; // ISR -> I/O task
+static std::atomic<uint32_t> droppedEdges; // the queue was full
+static sensorEdge history[SENSOR_HISTORY]; // the latest edges, for diagnostics
+static uint32_t edgeCount; // edges ever, history[] is a ring buffer
+static uint32_t bounces; // edges within SENSOR_DEBOUNCE_MS of a change
+static uint8_t rawLevel[NUM_SENSORS]; // the pin's level after its latest edge
+static uint8_t level[NUM_SENSORS]; // debounced pin level
+static int64_t changeMicros[NUM_SENSORS]; // the last debounced change
+static bool changed; // a debounced level changed since sensorsUpdate()
+
+static void IRAM_ATTR sensorISR(void *arg)
+{
+  int i = (intptr_t) arg;
+  gpio_num_t pin = (gpio_num_t) pins[i];
+  int x = gpio_ll_get_level(&GPIO, pin);
+  // wake on the next change, this is gpio_wakeup_enable() without its lock and not in flash
+  gpio_ll_wakeup_enable(&GPIO, pin, x ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL);
+  if (!edges.push({(uint8_t) i, (uint8_t) x, esp_timer_get_time()})) droppedEdges++;
+  scheduler.wakeFromISR();
+}
+
+static void take(int i, int64_t micros)
+{
+  level[i] = rawLevel[i];
+  changeMicros[i] = micros;
+  changed = true;
+}
+
+// This starts settleTimer for the first sensor whose debounce time will be up
+static void settleJob();
+static schedTimer settleTimer(settleJob);
+static void settleStart()
+{
+  int64_t now = monoMicros();
+  int64_t next = INT64_MAX;
+  for (int i = 0; i < NUM_SENSORS; i++) {
+    if (!pins[i] || level[i] == rawLevel[i]) continue;
+    int64_t due = changeMicros[i] + SENSOR_DEBOUNCE_US - now;
+    if (due < next) next = due;
+  }
+  if (next == INT64_MAX) return;
+  settleTimer.start(next > 0 ? (next + 999) / 1000 : 0);
+}
+
+// This takes the pins' latest levels when their debounce times are up
+static void settleJob()
+{
+  int64_t now = monoMicros();
+  for (int i = 0; i < NUM_SENSORS; i++) {
+    if (!pins[i] || level[i] == rawLevel[i]) continue;
+    if (now - changeMicros[i] >= SENSOR_DEBOUNCE_US) take(i, now);
+  }
+  if (changed) scheduler.wake(); // so loop() runs sensorsUpdate()
+  settleStart();
+}
+
+/*
+This handles the queued edges, loop() runs this each time it wakes up. It returns true if
+a sensor changed.
+*/
+bool sensorsUpdate()
+{
+  sensorEdge x;
+  bool pending = false;
+  while (edges.pop(x)) {
+    history[edgeCount++ % SENSOR_HISTORY] = x;
+    int i = x.sensor;
+    if (x.micros - changeMicros[i] < SENSOR_DEBOUNCE_US) bounces++;
+    rawLevel[i] = x.level;
+    if (rawLevel[i] == level[i]) continue; // it bounced back
+    if (x.micros - changeMicros[i] >= SENSOR_DEBOUNCE_US)
+      take(i, x.micros);
+    else
+      pending = true;
+  }
+  if (pending) settleStart();
+  bool ret = changed;
+  changed = false;
+  return ret;
+}
+
+// This (re)arms the sensor pins, after setupPins() and currentBegin()
+void sensorsBegin()
+{
+  for (int i = 0; i < NUM_SENSORS; i++) {
+    if (!pins[i]) continue;
+    detachInterrupt(pins[i]);
+    gpio_wakeup_disable((gpio_num_t) pins[i]);
+    pins[i] = 0;
+  }
+  settleTimer.stop();
+  sensorEdge x;
+  while (edges.pop(x)) /*NULL*/;
+  for (int n = 0; n < NUM_LOCKS; n++) {
+    const lockSettings &ls = stg.locks[n];
+    int *p = &pins[n * SENSORS_PER_LOCK];
+    p[sn_current] = currentAnalog(n) ? 0 : abs(ls.currentPin);
+    p[sn_voltage] = abs(ls.voltagePin);
+    if (p[sn_voltage] == abs(ls.currentPin)) p[sn_voltage] = 0; // sensorActive() shares it
+  }
+  for (int i = 0; i < NUM_SENSORS; i++) {
+    for (int j = 0; j < i && pins[i]; j++) {
+      if (pins[j] != pins[i]) continue;
+      loge("Sensor pin %i is used by more than one lock", pins[i]);
+      pins[i] = 0;
+    }
+    if (!pins[i]) continue;
+    level[i] = rawLevel[i] = digitalRead(pins[i]);
+    changeMicros[i] = monoMicros() - SENSOR_DEBOUNCE_US;
+    gpio_int_type_t next = level[i] ? GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL;
+    attachInterruptArg(pins[i], sensorISR, (void *) (intptr_t) i, level[i] ? ONLOW : ONHIGH);
+    gpio_wakeup_enable((gpio_num_t) pins[i], next);
+  }
+}
+
+// This is activatedPin() for a lock's digital sensors, using their debounced levels
+int sensorActive(int n, sensorIndex sensor)
+{
+  const lockSettings &ls = stg.locks[n];
+  int pin = (sensor == sn_current) ? ls.currentPin : ls.voltagePin;
+  if (!pin) return NO_PIN;
+  int i = n * SENSORS_PER_LOCK + sensor;
+  int shared = n * SENSORS_PER_LOCK + sn_current; // the voltage pin may be the current pin
+  if (!pins[i] && sensor == sn_voltage && pins[shared] == abs(pin)) i = shared;
+  if (!pins[i]) return activatedPin(pin);
+  return (pin > 0) ? HIGH - level[i] : level[i];
+}
+
+// This formats the edge counts and the latest edges, it returns 0 if there are no sensor pins
+int sensorsFormatStats(char *buffer, size_t size)
+{
+  bool any = false;
+  for (int i = 0; i < NUM_SENSORS; i++) any |= pins[i] != 0;
+  if (!any) return 0;
+  int len = snprintf(buffer, size, "Sensors: %u edges (%u bounces, %u dropped), latest:",
+    (unsigned) edgeCount, (unsigned) bounces, (unsigned) droppedEdges);
+  int64_t now = monoMicros();
+  uint32_t n = edgeCount < SENSOR_HISTORY ? edgeCount : SENSOR_HISTORY;
+  for (uint32_t k = 1; k <= n && len < (int) size; k++) {
+    const sensorEdge &x = history[(edgeCount - k) % SENSOR_HISTORY];
+    len += snprintf(buffer + len, size - len, " %c%i=%u@-%lims",
+      x.sensor % SENSORS_PER_LOCK == sn_current ? 'C' : 'V', x.sensor / SENSORS_PER_LOCK + 1,
+      x.level, (long) ((now - x.micros) / 1000));
+  }
+  return len;
+}
+
+// This is the RAM used for each lock, for serialInfo()
+size_t sensorsBytesPerLock()
+{
+  return SENSORS_PER_LOCK * (sizeof pins[0] + sizeof rawLevel[0] + sizeof level[0] +
+    sizeof changeMicros[0]);
+}
@@ -26,107 +26,51 @@ Examples (the first line is the canonical/preferred format):
 
 #include "main.h"
 #include "ini_by_benhoyt.h"
+#include "settingsparse.h" // storeSetting()
 #include <LittleFS.h>
+#include <rom/crc.h>
 
 #define initString(storage, constant) strlcpy(storage, constant, sizeof constant)
 
 // This sets any not-zero/not-null default values
-static void initSettings()
+static void initSettings(programSettings &s)
 {
-  initString(stg.deviceName, DEF_DEVICE_NAME);
-  initString(stg.wifiSSID, DEF_WIFI_SSID);
-  initString(stg.wifiPassword, DEF_WIFI_PASSWORD);
-  initString(stg.webserverUsername, DEF_WEB_USERNAME);
-  initString(stg.webserverPassword, DEF_WEB_PASSWORD);
-  stg.logLevelFile = DEF_LOG_LEVEL;
-  stg.logLevelSerial = DEF_LOG_LEVEL;
-  stg.webserverMinutes = DEF_WEBSERVER_MINUTES;
-  stg.rx2Pin = -1; // hardware default
-  stg.tx2Pin = -1; // hardware default
-  sprintf(stg.hostName, PROJECT_SHORT "-%02x%02x%02x", macAddr[3], macAddr[4], macAddr[5]);
-}
-
-// Definitions for each setting, used to transfer the settings stored in the
-// file to the variables in the program
-typedef struct {
-  char type[6]; // either "char" or "int" or "float"
-  char name[20]; // e.g. "wifiPassword" or "webserverMinutes"
-  char size[6]; // e.g. "[32]" for char or ";" for int
-  void * ptr; // pointer to the variable in the program
-} settings_defs_t;
-static const settings_defs_t settingsDefs[] = {
-  #define X_SETTING(type, name, length) { #type, #name, #length, &stg.name},
-  X_SETTING_LIST 
-  #undef X_SETTING
-  { "", "", "", NULL } // indicates end
-};
-
-// This is a helper for ini_handler_fcn.
-// This compares setting names and returns true if they match. Both strings are
-// assumed to be null-terminated. The file string is assumed to be lowercase and
-// not containing '-' or '_'. The program string is case insensitive.
-static bool nameMatch(const char *pgmStr, const char *fileStr)
-{
-  bool eos1 = false, eos2 = false; // end of string
-  for (;;) {
-    if (*pgmStr == '_') { pgmStr++; continue; } // skip '_' in settingsDefs[]
-    if (*pgmStr == '\0') eos1 = true;
-    if (*fileStr == '\0') eos2 = true;
-    if (eos1 && eos2) return true; // identical contents and lengths
-    if (tolower(*pgmStr) != *fileStr) return false; // different contents
-    if (eos1 || eos2) return false; // different lengths
-    pgmStr++; fileStr++;
-  }
+  memset(&s, 0, sizeof s); // also clears settings removed from the file
+  initString(s.deviceName, DEF_DEVICE_NAME);
+  initString(s.wifiSSID, DEF_WIFI_SSID);
+  initString(s.wifiPassword, DEF_WIFI_PASSWORD);
+  initString(s.webserverUsername, DEF_WEB_USERNAME);
+  initString(s.webserverPassword, DEF_WEB_PASSWORD);
+  s.logLevelFile = DEF_LOG_LEVEL;
+  s.logLevelSerial = DEF_LOG_LEVEL;
+  s.webserverMinutes = DEF_WEBSERVER_MINUTES;
+  s.mqttPort = DEF_MQTT_PORT;
+  s.rx2Pin = -1; // hardware default
+  s.tx2Pin = -1; // hardware default
+  s.rx1Pin = -1; // none
+  s.tx1Pin = -1; // none
+  sprintf(s.hostName, PROJECT_SHORT "-%02x%02x%02x", macAddr[3], macAddr[4], macAddr[5]);
 }
 
 // This is a helper for reading config file -- it handles each config entry
-static int ini_handler_fcn(void* user /*unused*/, const char* setting_section /*unused*/,
+static int ini_handler_fcn(void* user /*the programSettings*/, const char* setting_section,
   const char* setting_name, const char* setting_value, int lineno)
 {
-  char settingName[100];
-
-  {
-    const char *src = setting_name;
-    char *dest = settingName; // setting_name with '-' & '_' removed
-
-    while (1) { // make setting name from file all lowercase and remove '-' & '_'
-      *dest = *src++;
-      if (*dest == '\0') break;
-      *dest = tolower(*dest);
-      if (*dest != '-' && *dest != '_') dest++;
+  bool badSection;
+  const settings_defs_t *def = storeSetting(*(programSettings *) user, setting_section,
+    setting_name, setting_value, &badSection);
+  if (!def) {
+    if (badSection) {
+      loge("Setting '%s' on line %i can't be in section '%s'", setting_name, lineno,
+        setting_section);
+    } else {
+      loge("Unknown setting '%s' with value '%s' on line %i", setting_name, setting_value,
+        lineno);
     }
+    return 0;
   }
-  for (int x = 0; settingsDefs[x].name[0] != '\0'; x++) {
-    if (nameMatch(settingsDefs[x].name, settingName)) { // settings name match
-      if (settingsDefs[x].type[0] == 'i') { // set the variable to the value
-        int z = strtol(setting_value, nullptr, 10);
-        * (int *) (settingsDefs[x].ptr) = z;
-        logd("Setting %s=%s='%i'", settingsDefs[x].name, setting_name, z);
-      } else if (settingsDefs[x].type[0] == 'f') {
-        float z = atof(setting_value);
-        * (float *) (settingsDefs[x].ptr) = z;
-        logd("Setting %s=%s=%f", settingsDefs[x].name, setting_name, z);
-      } else if (settingsDefs[x].type[0] == 'c') {
-        bool quoted = false;
-        int srcLen = strlen(setting_value);
-        if ((setting_value[0] == '"' || setting_value[0] == '\'') &&
-            setting_value[srcLen - 1] == setting_value[0]
-        ) quoted = true;
-        int destLen = strtol(&settingsDefs[x].size[1], nullptr, 10);
-        if (destLen <=2)
-          loge("Programming error: config string length invalid");
-        strlcpy((char *) (settingsDefs[x].ptr), &setting_value[quoted ? 1 : 0],
-          quoted ? min(destLen, srcLen - 1) : destLen);
-        logd("Setting %s[%i]=%s='%s'",
-          settingsDefs[x].name, destLen, setting_name, (char *) settingsDefs[x].ptr);
-      } else {
-        loge("Programming error: config type not handled");
-      }
-      return 1;
-    } // if
-  } // for
-  loge("Unknown setting '%s' with value '%s' on line %i", setting_name, setting_value, lineno);
-  return 0;
+  logd("Setting %s=%s='%s'", def->name, setting_name, setting_value);
+  return 1;
 }
 
 static File configFile;
@@ -141,18 +85,154 @@ static char* ini_reader_fcn(char* buffer, int max, void* stream) {
   return (char *) 1;
 }
 
-// Load settings from file
-void programSettings::loadSettings()
+/*
+The parsed settings are saved in a snapshot file so later boots can load them with one
+read instead of parsing the config file. The snapshot is used only if its hash of the
+config file (and of this program's build) matches, so editing the config file or updating
+the program causes the config file to be parsed again. It also keeps how long that parse
+took, so the boot stats can compare it to loading the snapshot.
+*/
+#define SNAPSHOT_MAGIC 0x4c434157 // "WACL"
+#define SNAPSHOT_VERSION (2 + (sizeof (programSettings) << 8))
+typedef struct {
+  uint32_t magic; // SNAPSHOT_MAGIC
+  uint32_t version; // SNAPSHOT_VERSION
+  uint32_t configHash; // from configHash()
+  uint32_t crc; // crc32 of settings
+  uint32_t parseMicros; // how long parsing the config file took
+  programSettings settings;
+} settings_snapshot_t;
+
+// This returns a hash (crc32) of the program build and the config file's contents
+static uint32_t configHash(File &file)
 {
-  initSettings();
+  static const char build[] = VERSION " " __DATE__ " " __TIME__;
+  uint8_t buffer[256];
+  int len;
+
+  uint32_t hash = crc32_le(0, (const uint8_t *) build, sizeof build);
+  while ((len = file.read(buffer, sizeof buffer)) > 0)
+    hash = crc32_le(hash, buffer, len);
+  file.seek(0, SeekSet);
+  return hash;
+}
+
+// This loads the settings from the snapshot file and returns true if it's valid
+static bool loadSnapshot(uint32_t hash, programSettings &settings, uint32_t &parseMicros)
+{
+  settings_snapshot_t snapshot;
+
+  File file = LittleFS.open(SETTINGS_SNAPSHOT_FILE, "r");
+  if (!file) return false;
+  size_t len = file.read((uint8_t *) &snapshot, sizeof snapshot);
+  file.close();
+  if (len != sizeof snapshot || snapshot.magic != SNAPSHOT_MAGIC ||
+      snapshot.version != SNAPSHOT_VERSION || snapshot.configHash != hash ||
+      snapshot.crc != crc32_le(0, (const uint8_t *) &snapshot.settings, sizeof snapshot.settings)
+  ) return false;
+  memcpy(&settings, &snapshot.settings, sizeof settings);
+  parseMicros = snapshot.parseMicros;
+  return true;
+}
+
+static void saveSnapshot(uint32_t hash, const programSettings &settings, uint32_t parseMicros)
+{
+  settings_snapshot_t snapshot;
+
+  snapshot.magic = SNAPSHOT_MAGIC;
+  snapshot.version = SNAPSHOT_VERSION;
+  snapshot.configHash = hash;
+  snapshot.parseMicros = parseMicros;
+  memcpy(&snapshot.settings, &settings, sizeof settings);
+  snapshot.crc = crc32_le(0, (const uint8_t *) &snapshot.settings, sizeof snapshot.settings);
+  File file = LittleFS.open(SETTINGS_SNAPSHOT_FILE, "w");
+  if (!file || file.write((const uint8_t *) &snapshot, sizeof snapshot) != sizeof snapshot)
+    logw("Can't save settings snapshot '%s'", SETTINGS_SNAPSHOT_FILE);
+  file.close();
+}
+
+// This returns a bitmask of SETTING_BIT()s for the settings that differ from the argument
+uint64_t programSettings::changedSettings(const programSettings &old)
+{
+  uint64_t changed = 0;
+  #define X_SETTING(type, name, length) \
+    if (memcmp(&name, &old.name, sizeof name)) changed |= SETTING_BIT(name);
+  X_SETTING_LIST
+  #undef X_SETTING
+  for (int i = 0; i < NUM_LOCKS; i++) { // a lock setting's bit is for all of the locks
+    #define X_SETTING(type, name, length) \
+      if (memcmp(&locks[i].name, &old.locks[i].name, sizeof locks[i].name)) \
+        changed |= SETTING_BIT(name);
+    X_LOCK_SETTING_LIST
+    #undef X_SETTING
+  }
+  return changed;
+}
+
+/*
+Load settings from file into this object (stg at boot, or reloadedSettings in the net task),
+and return true if they came from the snapshot. parseMicros is set to how long parsing the
+config file took, now or when the snapshot was saved. It only changes this object and
+parseMicros, so any task can run it.
+*/
+bool programSettings::loadSettings(uint32_t &parseMicros)
+{
+  parseMicros = 0;
+  bool fromSnapshot = false;
   configFile = LittleFS.open(SETTINGS_FILE);
   if (!configFile) {
+    initSettings(*this);
     loge("Can't open configuration file '%s'", SETTINGS_FILE);
-    return;
+    return false;
   }
 
-  int line = ini_parse_stream(ini_reader_fcn, NULL, ini_handler_fcn, NULL);
-  if (line) loge("Error in '%s' on line %i", SETTINGS_FILE, line);
+  uint32_t hash = configHash(configFile);
+  if (loadSnapshot(hash, *this, parseMicros)) {
+    fromSnapshot = true;
+  } else {
+    uint32_t start = micros();
+    initSettings(*this);
+    int line = ini_parse_stream(ini_reader_fcn, NULL, ini_handler_fcn, this);
+    parseMicros = micros() - start;
+    if (line) loge("Error in '%s' on line %i", SETTINGS_FILE, line);
+    saveSnapshot(hash, *this, parseMicros);
+  }
   configFile.close();
-  return;
-}
\ No newline at end of file
+  return fromSnapshot;
+}
+
+/*
+The published settings are a copy of stg that the other tasks copy from (see settingsCopy).
+The generation changes each time they're published, so a task only takes the lock to copy
+them when they have changed.
+*/
+static programSettings published;
+static std::atomic<uint32_t> publishedGeneration;
+
+static SemaphoreHandle_t publishMutex()
+{
+  static SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+  return mutex;
+}
+
+// The I/O task runs this after it changes stg
+void settingsPublish()
+{
+  xSemaphoreTake(publishMutex(), portMAX_DELAY);
+  published = stg;
+  publishedGeneration++;
+  xSemaphoreGive(publishMutex());
+  logSettings(stg); // the logging settings are used by every task
+}
+
+// A task runs this on its own copy when it's about to use the settings
+uint64_t settingsCopy::refresh()
+{
+  if (generation == publishedGeneration) return 0;
+  xSemaphoreTake(publishMutex(), portMAX_DELAY);
+  uint64_t changed = published.changedSettings(*this);
+  (programSettings &) *this = published;
+  generation = publishedGeneration;
+  xSemaphoreGive(publishMutex());
+  return changed;
+}
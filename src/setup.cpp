@@ -29,29 +29,12 @@ static void setupMDNS()
 static void setupMDNS() {}
 #endif
 
-#if ENABLE_NTP
-static void setupNTP()
-{
-  timeClientNTP.begin(); // uses "pool.ntp.org"
-  bool success = timeClientNTP.forceUpdate();
-  if (success) {
-    setTime(timeClientNTP.getEpochTime());
-    logi("NTP successful");
-  } else {
-    loge("NTP setup failed");
-  }
-  bootTime = now();
-}
-#else
-void setupNTP() {}
-#endif
-
 /*
 WiFi Access Point mode can be used for setting up the WiFi and other settings,
 or it can be used standalone in this mode -- but without NTP date/time.
 If WiFi doesn't initially connect, we can fall back to AP mode.
 */
-static void setupWiFiAccessPoint()
+void setupWiFiAccessPoint()
 {
   char ssid[40];
 
@@ -70,7 +53,12 @@ static void setupWiFiAccessPoint()
   //   (this does not have a captive portal, at least not yet)
 }
 
-// This returns true if WiFi setup was successful and false if it failed
+/*
+This starts connecting to the WiFi network and returns false if the SSID isn't set. It
+doesn't wait for the connection, so the readers and the lock work right away. The net task
+finishes the job when the station gets an IP address, or it falls back to Access Point mode
+if the connection takes too long, see wifiUpJob().
+*/
 static bool setupWiFi()
 {
   if (!*stg.wifiSSID) {
@@ -80,18 +68,85 @@ static bool setupWiFi()
   WiFi.mode(WIFI_STA);
   WiFi.begin(stg.wifiSSID, stg.wifiPassword);
   logi("Connecting to '%s' WiFi network", stg.wifiSSID);
-  for (int i = 0; i < 12; i++) {
-    lcd.print('.');
-    delay(1000);
-    if(WiFi.status() == WL_CONNECTED) {
-      logi("WiFi connection established, IP %s", WiFi.localIP().toString().c_str());
-      setupNTP();
-      return true;
-    } // if
-  } // for
-  Serial.println("");
-  logw("Connecting to WiFi '%s' failed", stg.wifiSSID);
-  return false;
+  return true;
+}
+
+static void setupPins()
+{
+  if (stg.beeperPin) pinMode(abs(stg.beeperPin), OUTPUT);
+  for (const lockSettings &ls : stg.locks) {
+    if (ls.outputPin) pinMode(abs(ls.outputPin), OUTPUT);
+    if (ls.currentPin) pinMode(abs(ls.currentPin), INPUT);
+    if (ls.voltagePin) pinMode(abs(ls.voltagePin), INPUT); // this may be the same as currentPin
+  }
+}
+
+/*
+This applies the config file after it has been changed, only the settings that changed, so
+a reboot isn't needed. The locks stay in their current states (on or off). Settings that
+are read when they're used (log levels, backend, timeouts, etc.) don't need anything done
+here. The net task has already loaded the file into reloadedSettings, so the I/O task doesn't
+stall for the parse, see reloadJob() (main.cpp). The other tasks get the new settings when
+they refresh their copies of stg.
+*/
+void reloadSettings()
+{
+  static programSettings old; // static because it's big for the stack
+  uint64_t changed = reloadedSettings.changedSettings(stg);
+  if (!changed) {
+    logi("Settings reloaded, nothing changed");
+    return;
+  }
+  logw("Settings reloaded, changes mask 0x%09llx", changed);
+  old = stg;
+  stg = reloadedSettings;
+  settingsPublish(); // the other tasks apply their own changes (MQTT, web sessions)
+
+  if (changed & (SETTING_BIT(outputPin) | SETTING_BIT(beeperPin) | SETTING_BIT(currentPin) |
+                 SETTING_BIT(voltagePin) | SETTING_BIT(currentOnLevel))) {
+    // release the old pins and then set up the new ones
+    for (const lockSettings &ls : old.locks) {
+      if ((changed & SETTING_BIT(outputPin)) && ls.outputPin) pinMode(abs(ls.outputPin), INPUT);
+    }
+    if ((changed & SETTING_BIT(beeperPin)) && old.beeperPin) pinMode(abs(old.beeperPin), INPUT);
+    setupPins();
+    for (lockClass &lock : locks) {
+      if (lock.isAccessible() && !lock.inUse()) // its section was removed
+        lock.stopAccess();
+      if (lock.isAccessible()) // keep the lock in its current state
+        activatePin(lock.cfg().outputPin);
+      else
+        deactivatePin(lock.cfg().outputPin);
+    }
+  }
+  const uint64_t readerBits = SETTING_BIT(readerType) | SETTING_BIT(rx2Pin) | SETTING_BIT(tx2Pin) |
+    SETTING_BIT(reader2Type) | SETTING_BIT(rx1Pin) | SETTING_BIT(tx1Pin);
+  if (changed & readerBits)
+    readersBegin();
+  const uint64_t currentBits = SETTING_BIT(currentPin) | SETTING_BIT(voltagePin) |
+    SETTING_BIT(currentOnLevel) | SETTING_BIT(currentOffLevel);
+  if (changed & currentBits) {
+    currentBegin();
+    sensorsBegin();
+  }
+  if (changed & (SETTING_BIT(powerSave) | readerBits | currentBits))
+    setupPower();
+  if (changed & SETTING_BIT(adminIDs))
+    uidAdmin.load(stg.adminIDs);
+  if (changed & SETTING_BIT(webserverMinutes))
+    webserverTimedout.reset(stg.webserverMinutes);
+  if (changed & (SETTING_BIT(wifiSSID) | SETTING_BIT(wifiPassword))) {
+    if (*stg.wifiSSID) {
+      logi("Connecting to '%s' WiFi network", stg.wifiSSID);
+      WiFi.disconnect();
+      WiFi.mode(WIFI_STA);
+      WiFi.begin(stg.wifiSSID, stg.wifiPassword); // wifiJob() retries if this fails
+    } else {
+      setupWiFiAccessPoint();
+    }
+  }
+  if (changed & SETTING_BIT(hostName))
+    logw("The hostname setting takes effect after a reboot");
 }
 
 static void setupLittleFS()
@@ -108,7 +163,6 @@ static void setupLittleFS()
 // This is executed by the Arduino framework once on startup/boot
 void setup()
 {
-  bool WiFiModeAP;
   pinMode(LED_BUILTIN, OUTPUT);
   
   Serial.begin(115200);
@@ -121,19 +175,16 @@ void setup()
   lcd.printSaved();
 
   setupLittleFS();
-  stg.loadSettings();
-
-  WiFi.macAddress(macAddr); // set global var
-  lock.stopAccess();
-  lcd.setCursor(0, 1);
-  lcd.print("WiFi");
-  bool WiFiModeSta = true;
-  if (!setupWiFi()) {
-    setupWiFiAccessPoint();
-    WiFiModeSta = false;
-    WiFiModeAP = true;
-  }
-  // log here so that time is properly set by WiFi and NTP
+  WiFi.macAddress(macAddr); // set global var, used by the hostName default setting
+  uint32_t start = micros();
+  settingsFromSnapshot = stg.loadSettings(settingsParseMicros);
+  settingsLoadMicros = micros() - start;
+  settingsPublish(); // for the other tasks' copies
+
+  for (lockClass &lock : locks) lock.stopAccess();
+  wifiEventsBegin(); // before WiFi.begin() so the net task hears about the connection
+  if (!setupWiFi()) setupWiFiAccessPoint();
+  // the time isn't set yet, ntpJob() logs when it is
   logw("BOOT: " PROJECT_SHORT " - " PROJECT_LONG ", V" VERSION ", built " __DATE__);
   setupMDNS();
   setupAsyncWebserver();
@@ -143,29 +194,23 @@ void setup()
   // uidAdmin.zeroIndex();
   // logd("First Admin-ID: %lu", uidAdmin.next());
 
-  if (stg.outputPin) pinMode(abs(stg.outputPin), OUTPUT);
-  if (stg.beeperPin) pinMode(abs(stg.beeperPin), OUTPUT);
-  if (stg.currentPin) pinMode(abs(stg.currentPin), INPUT);
-  if (stg.voltagePin) pinMode(abs(stg.voltagePin), INPUT); // this may be the same pin as currentPin
-  rdm6300.begin(stg.rx2Pin, stg.tx2Pin);
-  lock.autoOffTimedout.disable();
-  uidAdmin.adminTimedOut.disable();
+  setupPins();
+  readersBegin();
+  currentBegin();
+  sensorsBegin();
+  setupPower(); // after the pins are set up
+  for (lockClass &lock : locks) lock.autoOffTimedout.disable();
+  Serial.onReceive([]() { scheduler.wake(); }); // for processSerialDebug()
 
   logd("Admin UN: '%s', PW: '%s'\r\n", stg.webserverUsername, stg.webserverPassword);
   serialInfo();
 
-  lcd.setCursor(0, 1);
-  if (WiFiModeSta) {
-    lcd.print(WiFi.localIP());
-    lcd.print('/');
-    lcd.print(subnetIP());
-  }
-  if (WiFiModeAP) {
-    lcd.print("AP ");
-    lcd.print(WiFi.softAPIP());
-  }
-  lcd.print("      "); // clear end-of-line just in case
-  // in a little while, replace ip address with boot date/time
+  // in a little while, replace the IP address with the boot date/time (ntpJob() updates it)
   lcd.saveLine(1, formattedTime(localTime(bootTime), ftm_yyyymmddhhmm));
-  lcd.setTimeout();
+  showNetAddress();
+  scheduler.begin();
+  startJobs();
+  ioTask = xTaskGetCurrentTaskHandle(); // loop() runs in this task too
+  startNetTask(); // after this, only the I/O task uses stg, see reloadSettings()
+  bootReadyMillis = millis();
 }
\ No newline at end of file
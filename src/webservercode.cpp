@@ -13,15 +13,18 @@ The original code has been modified.
 #include <AsyncTCP.h>
 #include <LittleFS.h>
 #include <Update.h>
+#include <mbedtls/md.h>
 #include "webserverhtml.h"
+#include "webedit.h" // editSavePathInput(), editFileOption(), htmlEscapeBlock()
 
 static AsyncWebServer server(80);
+static AsyncEventSource events("/events"); // live dashboard (Server-Sent Events)
+static std::atomic<bool> dashboardResync; // true to send everything, e.g. for a new viewer
 static String allowedExtensionsForEdit = "txt, log, ini, htm, html, css, js";
 
-static String filesDropdownOptions = "";
-static String textareaContent = "";
-static String savePath = "";
-static String savePathInput = "";
+// Note: the file manager keeps no state between requests (the AsyncTCP task may serve
+//   several users at once), so the file path is carried in the request parameters
+#define EDIT_FILE_MAX 16384 // largest file that can be edited, bounds the memory used
 
 static const char param_delete_path[] = "delete_path";
 static const char param_edit_path[] = "edit_path";
@@ -31,15 +34,159 @@ static const char param_save_path[] = "save_path";
 static const char textPlain[] = "text/plain";
 static const char pageNotFound[] = "404 Page not found";
 
-static bool authNeeded(AsyncWebServerRequest *request) 
+static bool serverDisabled(void) 
 {
-  return request->authenticate(stg.webserverUsername, stg.webserverPassword) ?
-    false : true;
+  return webserverTimedout.isActive() ? false : true;
 }
 
-static bool serverDisabled(void) 
+/*
+Web sessions: After logging in once with the webserver username and password, the browser
+gets a session cookie so the password isn't checked on every request. The cookie is
+  hex(session id, expiration time, HMAC-SHA256 of the id and expiration time)
+The HMAC key is random and changes on every boot, and a small session table allows
+sessions to be revoked, which happens when the webserver's enable time runs out or the web
+credentials change. Only the AsyncTCP task uses the session table.
+*/
+#define SESSION_MAX 4 // maximum number of logged-in browsers
+#define SESSION_MINUTES 30
+#define SESSION_MAC_SIZE 16 // truncated HMAC size, bytes
+#define SESSION_TOKEN_SIZE (2 * (8 + SESSION_MAC_SIZE)) // hex characters
+static const char sessionCookie[] = "WACL_SESSION=";
+static uint8_t sessionKey[32];
+static struct {
+  uint32_t id; // random, zero=unused
+  uint32_t expires; // softSeconds()
+} sessions[SESSION_MAX];
+
+static void sessionMac(const uint8_t payload[8], uint8_t mac[SESSION_MAC_SIZE])
 {
-  return webserverTimedout.isActive() ? false : true;
+  uint8_t hmac[32];
+  mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), sessionKey, sizeof sessionKey,
+    payload, 8, hmac);
+  memcpy(mac, hmac, SESSION_MAC_SIZE);
+}
+
+static void sessionPayload(uint32_t id, uint32_t expires, uint8_t payload[8])
+{
+  for (int x = 0; x < 4; x++) {
+    payload[x] = id >> (24 - 8 * x);
+    payload[x + 4] = expires >> (24 - 8 * x);
+  }
+}
+
+// This revokes all sessions so everyone must log in again
+static void sessionsRevoke(void)
+{
+  memset(sessions, 0, sizeof sessions);
+}
+
+/*
+This refreshes the web server's copy of the settings (webStg). The sessions belong to the
+AsyncTCP task, so it revokes them itself when the web credentials change.
+*/
+static void webSettingsRefresh(void)
+{
+  if (webStg.refresh() & (SETTING_BIT(webserverUsername) | SETTING_BIT(webserverPassword)))
+    sessionsRevoke(); // log in again with the new password
+}
+
+// This starts a session and returns its cookie value (token) in the argument
+static void sessionStart(char token[SESSION_TOKEN_SIZE + 1])
+{
+  uint8_t bytes[8 + SESSION_MAC_SIZE];
+  int slot = 0;
+  for (int x = 0; x < SESSION_MAX; x++) { // use an expired slot or the oldest one
+    if (sessions[x].expires < sessions[slot].expires) slot = x;
+  }
+  do { sessions[slot].id = esp_random(); } while (sessions[slot].id == 0);
+  sessions[slot].expires = softSeconds() + SESSION_MINUTES * 60;
+  sessionPayload(sessions[slot].id, sessions[slot].expires, bytes);
+  sessionMac(bytes, bytes + 8);
+  for (int x = 0; x < (int) sizeof bytes; x++) sprintf(token + 2 * x, "%02x", bytes[x]);
+}
+
+/*
+This returns the session cookie's value in a Cookie header ("name=value; name=value"), or
+nullptr. The name must start the header or follow a "; ", so "xWACL_SESSION=" doesn't match.
+*/
+static const char *sessionCookieValue(const char *cookies)
+{
+  for (const char *ptr = cookies; ptr; ptr = strchr(ptr, ';')) {
+    if (*ptr == ';') ptr++;
+    while (*ptr == ' ') ptr++;
+    if (!strncmp(ptr, sessionCookie, sizeof sessionCookie - 1))
+      return ptr + sizeof sessionCookie - 1;
+  }
+  return nullptr;
+}
+
+// This returns a hex digit's value, or -1 if it isn't one (strtoul allows spaces and signs)
+static int hexDigit(char c)
+{
+  if (!isxdigit((unsigned char) c)) return -1;
+  return isdigit((unsigned char) c) ? c - '0' : tolower((unsigned char) c) - 'a' + 10;
+}
+
+// This returns true if the request has a cookie for an active session
+static bool sessionValid(AsyncWebServerRequest *request)
+{
+  uint8_t bytes[8 + SESSION_MAC_SIZE];
+  uint8_t mac[SESSION_MAC_SIZE];
+
+  AsyncWebHeader *header = request->getHeader("Cookie");
+  if (!header) return false;
+  const char *ptr = sessionCookieValue(header->value().c_str());
+  if (!ptr) return false;
+  for (int x = 0; x < (int) sizeof bytes; x++, ptr += 2) { // decode hex
+    int high = hexDigit(ptr[0]);
+    int low = high < 0 ? -1 : hexDigit(ptr[1]);
+    if (low < 0) return false;
+    bytes[x] = high << 4 | low;
+  }
+  if (*ptr && *ptr != ';' && *ptr != ' ') return false; // too long
+  uint32_t id = 0, expires = 0;
+  for (int x = 0; x < 4; x++) {
+    id = (id << 8) | bytes[x];
+    expires = (expires << 8) | bytes[x + 4];
+  }
+  if (id == 0 || expires <= softSeconds()) return false;
+  sessionMac(bytes, mac);
+  uint8_t diff = 0;
+  for (int x = 0; x < SESSION_MAC_SIZE; x++) diff |= mac[x] ^ bytes[8 + x]; // constant time
+  if (diff) return false;
+  for (int x = 0; x < SESSION_MAX; x++) {
+    if (sessions[x].id == id && sessions[x].expires == expires) return true;
+  }
+  return false; // revoked
+}
+
+/*
+This returns false if the request is authorized. Otherwise, it sends the response (a
+password request, or a redirect that sets the session cookie) and returns true.
+*/
+static bool authNeeded(AsyncWebServerRequest *request) 
+{
+  webSettingsRefresh();
+  if (serverDisabled()) sessionsRevoke();
+  if (sessionValid(request)) return false;
+  if (!request->authenticate(webStg.webserverUsername, webStg.webserverPassword)) {
+    request->requestAuthentication();
+    return true;
+  }
+  // The password is OK, so start a session. Pages with parameters or a POST body can't
+  //   be repeated by a redirect, so they're served now and the session starts later.
+  if (request->method() != HTTP_GET || request->params()) return false;
+  char token[SESSION_TOKEN_SIZE + 1];
+  char cookie[sizeof sessionCookie + SESSION_TOKEN_SIZE + 64];
+  sessionStart(token);
+  snprintf(cookie, sizeof cookie, "%s%s; Path=/; Max-Age=%i; HttpOnly; SameSite=Strict",
+    sessionCookie, token, SESSION_MINUTES * 60);
+  AsyncWebServerResponse *response = request->beginResponse(302);
+  response->addHeader("Location", request->url());
+  response->addHeader("Set-Cookie", cookie);
+  response->addHeader("Cache-Control", "no-store");
+  request->send(response);
+  return true;
 }
 
 static void notFound(AsyncWebServerRequest *request) 
@@ -63,9 +210,16 @@ static String convertFileSize(const size_t bytes)
   }
 }
 
+// This returns the value of a request's GET or POST parameter, or "" if it's missing
+static String paramValue(AsyncWebServerRequest *request, const char *name)
+{
+  AsyncWebParameter *param = request->getParam(name, true); // POST
+  if (!param) param = request->getParam(name); // GET
+  return param ? param->value() : String();
+}
+
 static String listDir(fs::FS &fs, const char * dirname, uint8_t levels)
 {
-  filesDropdownOptions = "";
   String listenFiles = "<table><tr><th id=\"first_td_th\">Filename</th><th>";
   listenFiles += dirname;
   listenFiles += "</th></tr>";
@@ -90,14 +244,6 @@ static String listDir(fs::FS &fs, const char * dirname, uint8_t levels)
     {
       listenFiles += "<tr><td id=\"first_td_th\">Dir: ";
       listenFiles += file.name();
-
-      filesDropdownOptions += "<option value=\"";
-      filesDropdownOptions += "/";
-      filesDropdownOptions += file.name();
-      filesDropdownOptions += "\">";
-      filesDropdownOptions += file.name();
-      filesDropdownOptions += "</option>";
-
       listenFiles += "</td><td> - </td></tr>";
 
       if(levels)
@@ -114,14 +260,6 @@ static String listDir(fs::FS &fs, const char * dirname, uint8_t levels)
     {
       listenFiles += "<tr><td id=\"first_td_th\">";
       listenFiles += file.name();
-
-      filesDropdownOptions += "<option value=\"";
-      filesDropdownOptions += "/";
-      filesDropdownOptions += file.name();
-      filesDropdownOptions += "\">";
-      filesDropdownOptions += file.name();
-      filesDropdownOptions += "</option>";
-
       listenFiles += "</td><td>Size: ";
       listenFiles += convertFileSize(file.size());
       listenFiles += "</td></tr>";
@@ -132,17 +270,47 @@ static String listDir(fs::FS &fs, const char * dirname, uint8_t levels)
   return listenFiles;  
 }
 
-static String readFile(fs::FS &fs, const char * path)
+// This returns the <option> list of the files in the directory for the dropdown menus
+static String filesDropdown(fs::FS &fs, const char * dirname)
+{
+  String options = "";
+  File root = fs.open(dirname);
+  if(!root || !root.isDirectory())
+  {
+    return options;
+  }
+  File file = root.openNextFile();
+  char option[EDIT_OPTION_MAX];
+  while(file)
+  {
+    if(editFileOption(option, sizeof option, file.name()))
+    {
+      options += option;
+    }
+    file = root.openNextFile();
+  }
+  return options;
+}
+
+/*
+This returns the file's contents escaped for a <textarea>, or "" if the file is missing or
+bigger than EDIT_FILE_MAX. The file is escaped a block at a time as it's read, so only the
+escaped copy is held.
+*/
+static String readFileEscaped(fs::FS &fs, const char * path)
 {
   String fileContent = "";
   File file = fs.open(path, "r");
-  if(!file || file.isDirectory())
+  if(!file || file.isDirectory() || file.size() > EDIT_FILE_MAX)
   {
     return fileContent;
   }
-  while(file.available())
+  fileContent.reserve(file.size());
+  char buffer[64], escaped[HTML_ESCAPE_BLOCK(sizeof buffer)];
+  size_t len;
+  while((len = file.readBytes(buffer, sizeof buffer)) > 0)
   {
-    fileContent+=String((char)file.read());
+    fileContent.concat(escaped, htmlEscapeBlock(escaped, buffer, len));
   }
   file.close();
   return fileContent;
@@ -173,6 +341,7 @@ static void uploadFile(AsyncWebServerRequest *request, String filename, size_t i
   if(final)
   {
     request->_tempFile.close();
+    if (filename == SETTINGS_FILE || filename == SETTINGS_FILE + 1) ioRequest(ic_reload);
     request->redirect("/manager");
   }
 }
@@ -184,6 +353,7 @@ static String kilobyteString(const size_t bytes)
 
 static String processor(const String& var)
 {
+  webSettingsRefresh();
 
   if(var == "PROGRAM_INFO")
     return programInfo();
@@ -192,9 +362,9 @@ static String processor(const String& var)
     #define BUFFER_SIZE 64
     static char buffer[BUFFER_SIZE];
 
-    strlcpy(buffer, stg.hostName, BUFFER_SIZE - 3);
+    strlcpy(buffer, webStg.hostName, BUFFER_SIZE - 3);
     strcat(buffer, " - ");
-    strlcpy(buffer + strlen(buffer), stg.deviceName, BUFFER_SIZE - strlen(buffer));
+    strlcpy(buffer + strlen(buffer), webStg.deviceName, BUFFER_SIZE - strlen(buffer));
     return buffer;
     #undef BUFFER_SIZE
   }
@@ -219,7 +389,7 @@ static String processor(const String& var)
     String editDropdown = "<select name=\"edit_path\" id=\"edit_path\">";
     editDropdown += "<option value=\"choose\">Select file to edit</option>";
     editDropdown += "<option value=\"new\">New text file</option>";
-    editDropdown += filesDropdownOptions;      
+    editDropdown += filesDropdown(LittleFS, "/");
     editDropdown += "</select>";
     return editDropdown;
   }
@@ -228,28 +398,77 @@ static String processor(const String& var)
   {
     String deleteDropdown = "<select name=\"delete_path\" id=\"delete_path\">";
     deleteDropdown += "<option value=\"choose\">Select file to delete</option>";
-    deleteDropdown += filesDropdownOptions;      
+    deleteDropdown += filesDropdown(LittleFS, "/");
     deleteDropdown += "</select>";
     return deleteDropdown;
   }
 
+  return String();
+}
+
+// This is the processor for the edit page. The file path and whether it's a new file are
+// the only state and they come from the request, and the file is read while the response
+// is being sent.
+static String editProcessor(const String& var, const String& path, bool newFile)
+{
   if(var == "TEXTAREA_CONTENT")
-    return textareaContent;
-  
+    return newFile ? String() : readFileEscaped(LittleFS, path.c_str());
+
   if(var == "SAVE_PATH_INPUT")
   {
-    if(savePath == "/new.txt")
-    {
-      savePathInput = "<input type=\"text\" id=\"save_path\" name=\"save_path\" value=\"" +
-        savePath + "\" >";
-    }
-    else
-    {
-      savePathInput = "";
-    }
-    return savePathInput;
+    char input[EDIT_INPUT_MAX];
+    editSavePathInput(input, sizeof input, path.c_str(), newFile);
+    return input;
   }
-  return String();
+  return processor(var);
+}
+
+/*
+This pushes changes to the live dashboard on the home page. Only the values that changed
+since the last call are sent, and they are sent once to all viewers, so viewers cost
+almost nothing. Each value is sent as its own event: lcd, lock, user, run, and log.
+The net task runs this with the latest status from the I/O task.
+*/
+void webDashboardUpdate(const ioStatus &status)
+{
+  static char lastLcd[34];
+  static int lastLock = -1;
+  static char lastUser[ID_NAME_MAX];
+  static char lastRun[12];
+  static unsigned logSeq;
+  static char logBuffer[128];
+  char buffer[34];
+
+  if (events.count() == 0 || serverDisabled()) { // no viewers
+    while (logSince(logSeq, logBuffer, sizeof logBuffer)) /*NULL*/; // skip old log lines
+    return;
+  }
+  bool all = dashboardResync.exchange(false);
+
+  if (all || strcmp(status.lcd, lastLcd)) {
+    strlcpy(lastLcd, status.lcd, sizeof lastLcd);
+    events.send(lastLcd, "lcd");
+  }
+  if (all || lastLock != status.on) {
+    lastLock = status.on;
+    events.send(lastLock ? "ON" : "OFF", "lock");
+  }
+  const char *user = status.on ? status.user : "";
+  if (all || strcmp(user, lastUser)) {
+    strlcpy(lastUser, user, sizeof lastUser);
+    events.send(lastUser, "user");
+  }
+  buffer[0] = '\0';
+  if (status.on) {
+    int sec = wallTime() - status.activatedTime;
+    snprintf(buffer, sizeof buffer, "%i:%02i", sec / 60, sec % 60);
+  }
+  if (all || strcmp(buffer, lastRun)) {
+    strlcpy(lastRun, buffer, sizeof lastRun);
+    events.send(lastRun, "run");
+  }
+  while (logSince(logSeq, logBuffer, sizeof logBuffer))
+    events.send(logBuffer, "log");
 }
 
 void setupAsyncWebserver()
@@ -267,7 +486,7 @@ void setupAsyncWebserver()
   {
     static minTimedOut logWaitTimedout;
 
-    if (authNeeded(request)) return request->requestAuthentication();
+    if (authNeeded(request)) return;
     if (serverDisabled()) return request->send(404, textPlain, pageNotFound);
     if (logWaitTimedout) {
       logWaitTimedout.reset(20); // don't want to log events every minute or two
@@ -278,15 +497,16 @@ void setupAsyncWebserver()
 
   server.on("/update", HTTP_POST, [](AsyncWebServerRequest *request)
   {
-    if (authNeeded(request)) return request->requestAuthentication();
+    if (authNeeded(request)) return;
     if (serverDisabled()) return request->send(404, textPlain, pageNotFound);
-    rebootRequest = !Update.hasError();
-    logw(rebootRequest ?
+    bool updated = !Update.hasError();
+    logw(updated ?
       "Web interface program update and reboot" :
       "Web interface program update failed"
     );
+    if (updated) ioRequest(ic_reboot);
     AsyncWebServerResponse *response = request->beginResponse(200, "text/html",
-      rebootRequest ? update_ok_html : update_failed_html);
+      updated ? update_ok_html : update_failed_html);
 
     response->addHeader("Connection", "close");
     request->send(response);
@@ -326,53 +546,53 @@ void setupAsyncWebserver()
 
   server.on("/upload", HTTP_POST, [](AsyncWebServerRequest *request) 
   {
-    if (authNeeded(request)) return request->requestAuthentication();
+    if (authNeeded(request)) return;
     if (serverDisabled()) return request->send(404, textPlain, pageNotFound);
     request->send(200);
   }, uploadFile);
 
   server.on("/edit", HTTP_GET, [](AsyncWebServerRequest *request)
   {
-    if (authNeeded(request)) return request->requestAuthentication();
+    if (authNeeded(request)) return;
     if (serverDisabled()) return request->send(404, textPlain, pageNotFound);
-    String inputMessage = request->getParam(param_edit_path)->value();
-    if(inputMessage =="new")
+    String path = paramValue(request, param_edit_path);
+    bool newFile = path == "new"; // an existing file named /new.txt isn't a new file
+    if(newFile)
     {
-      textareaContent = "";
-      savePath = "/new.txt";
+      path = "/new.txt";
     }
     else
     {
-      savePath = inputMessage;
-      textareaContent = readFile(LittleFS, inputMessage.c_str());
+      File file = LittleFS.open(path, "r");
+      if(!file || file.isDirectory())
+        return request->send(404, textPlain, pageNotFound);
+      if(file.size() > EDIT_FILE_MAX)
+        return request->send(413, textPlain, "File is too big to edit");
     }
-    request->send_P(200, "text/html", edit_html, processor);
+    request->send_P(200, "text/html", edit_html, [path, newFile](const String& var)
+    {
+      return editProcessor(var, path, newFile);
+    });
   });
 
-  server.on("/save", HTTP_GET, [](AsyncWebServerRequest *request)
+  server.on("/save", HTTP_GET | HTTP_POST, [](AsyncWebServerRequest *request)
   {
-    if (authNeeded(request)) return request->requestAuthentication();
+    if (authNeeded(request)) return;
     if (serverDisabled()) return request->send(404, textPlain, pageNotFound);
-    String inputMessage = "";
-    if (request->hasParam(param_edit_textarea)) 
-    {
-      inputMessage = request->getParam(param_edit_textarea)->value();
-    }
-    if (request->hasParam(param_save_path)) 
-    {
-      savePath = request->getParam(param_save_path)->value();
-    }
-    writeFile(LittleFS, savePath.c_str(), inputMessage.c_str());
+    String path = paramValue(request, param_save_path);
+    if (!path.startsWith("/")) return request->send(400, textPlain, "Missing file name");
+    writeFile(LittleFS, path.c_str(), paramValue(request, param_edit_textarea).c_str());
+    if (path == SETTINGS_FILE) ioRequest(ic_reload); // apply the changes without a reboot
 
     request->redirect("/manager");
   });
 
   server.on("/delete", HTTP_GET, [](AsyncWebServerRequest *request)
   {
-    if (authNeeded(request)) return request->requestAuthentication();
+    if (authNeeded(request)) return;
     if (serverDisabled()) return request->send(404, textPlain, pageNotFound);
-    String inputMessage = request->getParam(param_delete_path)->value();
-    if(inputMessage != "choose")
+    String inputMessage = paramValue(request, param_delete_path);
+    if(inputMessage != "choose" && inputMessage.startsWith("/"))
     {
       LittleFS.remove(inputMessage.c_str());
     }
@@ -381,23 +601,33 @@ void setupAsyncWebserver()
 
   server.on("/format", HTTP_POST, [](AsyncWebServerRequest *request)
   {
-    if (authNeeded(request)) return request->requestAuthentication();
+    if (authNeeded(request)) return;
     if (serverDisabled()) return request->send(404, textPlain, pageNotFound);
     logw("Web interface reformat filesystem and reboot");
     LittleFS.format();
-    rebootRequest = true;
+    ioRequest(ic_reboot);
     request->send(200);
   });
 
   server.on("/reboot", HTTP_POST, [](AsyncWebServerRequest *request)
   {
-    if (authNeeded(request)) return request->requestAuthentication();
+    if (authNeeded(request)) return;
     if (serverDisabled()) return request->send(404, textPlain, pageNotFound);
     logw("Web interface user reboot");
-    rebootRequest = true;
+    ioRequest(ic_reboot);
     request->send(200);
   });
 
+  esp_fill_random(sessionKey, sizeof sessionKey);
+
+  events.onConnect([](AsyncEventSourceClient *)
+  {
+    dashboardResync = true; // the next dashboard update sends everything
+    netWake();
+  });
+  events.setFilter([](AsyncWebServerRequest *) { return !serverDisabled(); });
+  server.addHandler(&events);
+
   server.onNotFound(notFound);
   server.rewrite("/", "/index.html");
   server.begin();
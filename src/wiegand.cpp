@@ -0,0 +1,90 @@
+// wiegand.cpp - Wiegand tag reader
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+#include "main.h"
+
+void IRAM_ATTR wiegandClass::d0ISR(void *arg)
+{
+  wiegandClass *x = (wiegandClass *) arg;
+  portENTER_CRITICAL_ISR(&x->mux);
+  bool first = !x->decoder.pending();
+  x->decoder.edge(0, esp_timer_get_time());
+  portEXIT_CRITICAL_ISR(&x->mux);
+  if (first) scheduler.wakeFromISR(); // so update() starts frameTimer
+}
+
+void IRAM_ATTR wiegandClass::d1ISR(void *arg)
+{
+  wiegandClass *x = (wiegandClass *) arg;
+  portENTER_CRITICAL_ISR(&x->mux);
+  bool first = !x->decoder.pending();
+  x->decoder.edge(1, esp_timer_get_time());
+  portEXIT_CRITICAL_ISR(&x->mux);
+  if (first) scheduler.wakeFromISR();
+}
+
+void wiegandClass::begin(int8_t d0Pin, int8_t d1Pin)
+{
+  end();
+  if (d0Pin < 0 || d1Pin < 0) {
+    logw("Wiegand reader needs both the D0 & D1 pins");
+    return;
+  }
+  pins[0] = d0Pin;
+  pins[1] = d1Pin;
+  pinMode(d0Pin, INPUT_PULLUP); // the reader's outputs are open-collector on some readers
+  pinMode(d1Pin, INPUT_PULLUP);
+  attachInterruptArg(d0Pin, d0ISR, this, FALLING);
+  attachInterruptArg(d1Pin, d1ISR, this, FALLING);
+}
+
+void wiegandClass::end()
+{
+  for (int i = 0; i < 2; i++) {
+    if (pins[i] >= 0) detachInterrupt(pins[i]);
+    pins[i] = -1;
+  }
+  frameTimer.stop();
+  uint32_t uid;
+  portENTER_CRITICAL(&mux);
+  if (decoder.pending()) decoder.frame(stg.wiegandBits, uid); // throw away a partial frame
+  portEXIT_CRITICAL(&mux);
+}
+
+// This gets the frame after no bits have arrived for the timeout, it's run by the I/O task
+void wiegandClass::update()
+{
+  int64_t now = monoMicros();
+  int64_t ends = 0, micros = 0;
+  bool valid = false;
+  uint32_t uid;
+  portENTER_CRITICAL(&mux);
+  if (decoder.pending()) {
+    ends = decoder.endMicros();
+    if (ends <= now) {
+      micros = decoder.frameMicros();
+      valid = decoder.frame(stg.wiegandBits, uid);
+      ends = 0;
+    }
+  }
+  portEXIT_CRITICAL(&mux);
+  if (valid) received(uid, micros);
+  if (ends) frameTimer.start((ends - now + 999) / 1000);
+}
+
+int wiegandClass::formatStats(char *buffer, size_t size)
+{
+  return snprintf(buffer, size, "%u frames, %u parity errors, %u length errors, %u glitches",
+    decoder.frames, decoder.parityErrors, decoder.lengthErrors, decoder.glitches);
+}
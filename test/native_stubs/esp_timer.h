@@ -0,0 +1,29 @@
+// esp_timer.h - a fake esp_timer clock for the host tests
+/*
+Copyright 2024 Mark Pickhard
+Copyright rights associated with this file are nonexclusively transferred to The Bodgery Inc,
+  a 501c(3) nonprofit entity.
+This file is part of WACL. WACL is free software: you can redistribute it and/or modify it under
+  the terms of the GNU General Public License as published by the Free Software Foundation, either
+  version 3 of the License, or (at your option) any later version.
+WACL is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY; without even the
+  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General
+  Public License for more details.
+You should have received a copy of the GNU General Public License along with WACL. If not, see
+  <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _native_esp_timer_h
+#define _native_esp_timer_h
+
+#include <stdint.h>
+
+/*
+monoMicros() (timedout.h) reads esp_timer_get_time(). Here it's a virtual clock that only
+moves when a test moves it, so a test can run months of uptime in a moment.
+*/
+inline int64_t fakeTimerMicros; // microseconds since "boot"
+inline int64_t esp_timer_get_time() { return fakeTimerMicros; }
+inline void fakeTimerAdvance(int64_t micros) { fakeTimerMicros += micros; }
+
+#endif
@@ -0,0 +1,135 @@
+// test_em4100 - the RDM6300 frame decoder on recorded byte streams with noise
+#include <unity.h>
+#include <vector>
+#include "em4100.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+// Two frames from an RDM6300 reading tag 0x00256E6D (version 0x0F), with the idle line's
+// zero bytes before them, as they came from the UART
+static const uint8_t recorded[] = {
+  0x00, 0x00,
+  0x02, '0', 'F', '0', '0', '2', '5', '6', 'E', '6', 'D', '2', '9', 0x03,
+  0x02, '0', 'F', '0', '0', '2', '5', '6', 'E', '6', 'D', '2', '9', 0x03,
+};
+
+// This appends the frame for a tag to a stream
+static void appendFrame(std::vector<uint8_t> &stream, uint8_t version, uint32_t tagID)
+{
+  uint8_t bytes[5] = { version, (uint8_t) (tagID >> 24), (uint8_t) (tagID >> 16),
+    (uint8_t) (tagID >> 8), (uint8_t) tagID };
+  uint8_t checksum = bytes[0] ^ bytes[1] ^ bytes[2] ^ bytes[3] ^ bytes[4];
+  char text[13];
+  snprintf(text, sizeof text, "%02X%02X%02X%02X%02X%02X", bytes[0], bytes[1], bytes[2],
+    bytes[3], bytes[4], checksum);
+  stream.push_back(0x02);
+  stream.insert(stream.end(), text, text + 12);
+  stream.push_back(0x03);
+}
+
+static uint32_t randomState = 12345;
+static uint32_t random32(void) // xorshift, so every run is the same
+{
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}
+
+static void test_recorded_frames(void)
+{
+  em4100Decoder decoder;
+  uint32_t tagID = 0;
+  int found = 0;
+  for (uint8_t x : recorded) {
+    if (decoder.feed(x, tagID)) {
+      found++;
+      TEST_ASSERT_EQUAL_HEX32(0x00256E6D, tagID);
+    }
+  }
+  TEST_ASSERT_EQUAL(2, found);
+  TEST_ASSERT_EQUAL(2, decoder.frames);
+  TEST_ASSERT_EQUAL(0, decoder.checksumErrors + decoder.framingErrors);
+}
+
+static void test_lowercase_and_bad_checksum(void)
+{
+  em4100Decoder decoder;
+  uint32_t tagID = 0;
+  const char lower[] = "\x02" "0f00256e6d29" "\x03";
+  const char bad[] = "\x02" "0F00256E6D28" "\x03";
+  bool ok = false;
+  for (const char *p = lower; *p; p++) ok = decoder.feed(*p, tagID);
+  TEST_ASSERT_TRUE(ok);
+  for (const char *p = bad; *p; p++) ok = decoder.feed(*p, tagID);
+  TEST_ASSERT_FALSE(ok);
+  TEST_ASSERT_EQUAL(1, decoder.checksumErrors);
+}
+
+static void test_truncated_frames(void)
+{
+  em4100Decoder decoder;
+  uint32_t tagID = 0;
+  std::vector<uint8_t> stream;
+  appendFrame(stream, 0x0F, 0x12345678);
+  stream.resize(8); // cut short by the next frame
+  appendFrame(stream, 0x0F, 0x12345678);
+  int found = 0;
+  for (uint8_t x : stream) found += decoder.feed(x, tagID);
+  TEST_ASSERT_EQUAL(1, found);
+  TEST_ASSERT_EQUAL(1, decoder.framingErrors);
+  TEST_ASSERT_EQUAL_HEX32(0x12345678, tagID);
+}
+
+/*
+A long stream of frames for a few tags with noise: random bytes between frames, and some
+frames with a flipped bit, an extra byte, or a missing digit. Every damaged frame must be
+rejected, every intact one must be decoded, and no tag ID may come out that wasn't sent.
+*/
+#define NOISY_FRAMES 20000
+static void test_noisy_stream(void)
+{
+  static const uint32_t tags[] = { 0x00256E6D, 0x12345678, 0xFFFFFFFF, 0x00000001 };
+  std::vector<uint8_t> stream;
+  std::vector<uint32_t> expected; // the intact frames' tags, in order
+  for (int n = 0; n < NOISY_FRAMES; n++) {
+    for (uint32_t noise = random32() % 4; noise; noise--) { // no 0x02 or 0x03 in the noise,
+      uint8_t x = random32();                                 // so it can't finish a frame
+      stream.push_back(x == 0x02 || x == 0x03 ? 0x00 : x);
+    }
+    uint32_t tag = tags[random32() % 4];
+    std::vector<uint8_t> frame;
+    appendFrame(frame, 0x0F, tag);
+    switch (random32() % 8) {
+      case 0: frame[1 + random32() % 13] ^= 1 << (random32() % 5); break; // flipped bit
+                                                      // (bit 5 may just change the case)
+      case 1: frame.insert(frame.begin() + 1 + random32() % 13, 'A'); break; // extra byte
+      case 2: frame.erase(frame.begin() + 1 + random32() % 12); break; // lost digit
+      default: expected.push_back(tag); break;
+    }
+    stream.insert(stream.end(), frame.begin(), frame.end());
+  }
+  em4100Decoder decoder;
+  uint32_t tagID = 0;
+  size_t next = 0;
+  for (uint8_t x : stream) {
+    if (!decoder.feed(x, tagID)) continue;
+    TEST_ASSERT_LESS_THAN(expected.size(), next);
+    TEST_ASSERT_EQUAL_HEX32(expected[next], tagID);
+    next++;
+  }
+  TEST_ASSERT_EQUAL(expected.size(), next);
+  TEST_ASSERT_EQUAL(expected.size(), decoder.frames);
+  TEST_ASSERT_GREATER_THAN(NOISY_FRAMES / 8, decoder.checksumErrors + decoder.framingErrors);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_recorded_frames);
+  RUN_TEST(test_lowercase_and_bad_checksum);
+  RUN_TEST(test_truncated_frames);
+  RUN_TEST(test_noisy_stream);
+  return UNITY_END();
+}
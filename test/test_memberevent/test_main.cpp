@@ -0,0 +1,107 @@
+// test_memberevent - parsing the MQTT member event payloads
+#include <unity.h>
+#include "memberevent.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static memberEvent event;
+
+static bool parse(const char *payload)
+{
+  memset(&event, 0x55, sizeof event);
+  return parseMemberEvent(payload, strlen(payload), event);
+}
+
+static void test_events(void)
+{
+  TEST_ASSERT_TRUE(parse("{\"event\":\"add\",\"id\":1234567,\"name\":\"Jane Doe\"}"));
+  TEST_ASSERT_EQUAL(me_add, event.type);
+  TEST_ASSERT_EQUAL_UINT32(1234567, event.uid);
+  TEST_ASSERT_EQUAL_STRING("Jane Doe", event.name);
+  TEST_ASSERT_TRUE(parse("{\"event\":\"remove\",\"id\":1234567}"));
+  TEST_ASSERT_EQUAL(me_remove, event.type);
+  TEST_ASSERT_EQUAL_STRING(".", event.name); // no name
+  TEST_ASSERT_TRUE(parse(" { \"id\" : 7 , \"event\" : \"disable\" } "));
+  TEST_ASSERT_EQUAL(me_disable, event.type);
+  TEST_ASSERT_EQUAL_UINT32(7, event.uid);
+}
+
+// IDs can be numbers or strings of digits, as they're printed with leading zeros
+static void test_ids(void)
+{
+  TEST_ASSERT_TRUE(parse("{\"event\":\"add\",\"id\":\"0001234567\"}"));
+  TEST_ASSERT_EQUAL_UINT32(1234567, event.uid);
+  TEST_ASSERT_TRUE(parse("{\"event\":\"add\",\"id\":4294967295}"));
+  TEST_ASSERT_EQUAL_UINT32(4294967295u, event.uid);
+  TEST_ASSERT_TRUE(parse("{\"event\":\"add\",\"id\":\"4294967295\"}"));
+  TEST_ASSERT_EQUAL_UINT32(4294967295u, event.uid);
+  static const char *bad[] = {
+    "{\"event\":\"add\"}", // no ID
+    "{\"event\":\"add\",\"id\":0}",
+    "{\"event\":\"add\",\"id\":\"0000000000\"}",
+    "{\"event\":\"add\",\"id\":-5}",
+    "{\"event\":\"add\",\"id\":12.5}",
+    "{\"event\":\"add\",\"id\":4294967296}", // too big, it doesn't wrap around to 0
+    "{\"event\":\"add\",\"id\":\"4294967296\"}",
+    "{\"event\":\"add\",\"id\":\"99999999999999999999999\"}",
+    "{\"event\":\"add\",\"id\":\"\"}",
+    "{\"event\":\"add\",\"id\":\"12ab\"}", // strtoul() would make these 12
+    "{\"event\":\"add\",\"id\":\" 12\"}",
+    "{\"event\":\"add\",\"id\":\"+12\"}",
+    "{\"event\":\"add\",\"id\":true}",
+    "{\"event\":\"add\",\"id\":null}",
+  };
+  for (const char *payload : bad) TEST_ASSERT_FALSE_MESSAGE(parse(payload), payload);
+}
+
+static void test_not_events(void)
+{
+  static const char *bad[] = {
+    "",
+    "{",
+    "{\"event\":\"add\",\"id\":1234567", // truncated
+    "[\"add\",1234567]",
+    "\"add\"",
+    "{}",
+    "{\"id\":1234567}",
+    "{\"event\":\"ADD\",\"id\":1234567}",
+    "{\"event\":\"enable\",\"id\":1234567}",
+    "{\"event\":1,\"id\":1234567}",
+    "{\"online\":false}", // e.g. a status message
+  };
+  for (const char *payload : bad) TEST_ASSERT_FALSE_MESSAGE(parse(payload), payload);
+}
+
+// Names are truncated to fit, and a name that isn't a string is "."
+static void test_names(void)
+{
+  char payload[200];
+  snprintf(payload, sizeof payload, "{\"event\":\"add\",\"id\":1,\"name\":\"%0*d\"}",
+    ID_NAME_MAX + 10, 0);
+  TEST_ASSERT_TRUE(parse(payload));
+  TEST_ASSERT_EQUAL(ID_NAME_MAX - 1, strlen(event.name));
+  TEST_ASSERT_TRUE(parse("{\"event\":\"add\",\"id\":1,\"name\":42}"));
+  TEST_ASSERT_EQUAL_STRING(".", event.name);
+}
+
+// The payload isn't a C string, it's only len bytes
+static void test_length(void)
+{
+  const char payload[] = "{\"event\":\"add\",\"id\":42}{\"event\":\"remove\"";
+  TEST_ASSERT_TRUE(parseMemberEvent(payload, 23, event));
+  TEST_ASSERT_EQUAL(me_add, event.type);
+  TEST_ASSERT_EQUAL_UINT32(42, event.uid);
+  TEST_ASSERT_FALSE(parseMemberEvent(payload, 22, event)); // cut off
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_events);
+  RUN_TEST(test_ids);
+  RUN_TEST(test_not_events);
+  RUN_TEST(test_names);
+  RUN_TEST(test_length);
+  return UNITY_END();
+}
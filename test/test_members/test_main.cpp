@@ -0,0 +1,136 @@
+// test_members - the local access list's freshness across MQTT subscriptions, and replacement
+#include <unity.h>
+#include "members.h"
+
+static memberList<4> *list;
+void setUp(void) { list = new memberList<4>; }
+void tearDown(void) { delete list; }
+
+static unsigned long idEnable;
+static char idName[ID_NAME_MAX];
+static bool fresh;
+
+// This returns 0 if the ID isn't in the list, 1 if it's stale, and 2 if it's fresh
+static int lookup(uID_t uid, uint32_t now = 100)
+{
+  if (!list->find(uid, idEnable, idName, fresh, now)) return 0;
+  return fresh ? 2 : 1;
+}
+
+// Entries are only fresh while the subscription that was up when they were stored stays up
+static void test_fresh_while_subscribed(void)
+{
+  list->trust(true);
+  list->store(1001, 1, "Jane Doe", false, 10); // a lookup
+  list->store(1002, 0, "John Doe", true, 11); // a push
+  TEST_ASSERT_EQUAL(2, lookup(1001));
+  TEST_ASSERT_EQUAL(1, idEnable);
+  TEST_ASSERT_EQUAL_STRING("Jane Doe", idName);
+  TEST_ASSERT_EQUAL(2, lookup(1002));
+  TEST_ASSERT_EQUAL(0, idEnable);
+  TEST_ASSERT_EQUAL(0, lookup(1003));
+  list->trust(true); // another SUBACK, e.g. the same subscription again
+  TEST_ASSERT_EQUAL(2, lookup(1001));
+  list->trust(false); // disconnected, changes may be missed
+  TEST_ASSERT_EQUAL(1, lookup(1001));
+  list->trust(true); // they stay stale, a change may have been missed while it was down
+  TEST_ASSERT_EQUAL(1, lookup(1001));
+  TEST_ASSERT_EQUAL(1, lookup(1002));
+  list->store(1001, 1, "Jane Doe", false, 20); // looked up again
+  TEST_ASSERT_EQUAL(2, lookup(1001));
+}
+
+// A lookup before the subscription came up isn't fresh: a change before then wasn't pushed
+static void test_stored_before_subscription_is_stale(void)
+{
+  list->store(1001, 1, "Jane Doe", false, 10); // the backend lookup, not subscribed yet
+  TEST_ASSERT_EQUAL(1, lookup(1001));
+  list->trust(true);
+  TEST_ASSERT_EQUAL(1, lookup(1001));
+  list->store(1001, 0, "Jane Doe", true, 12); // pushed while subscribed
+  TEST_ASSERT_EQUAL(2, lookup(1001));
+  TEST_ASSERT_EQUAL(0, idEnable);
+}
+
+// A refused subscription never calls trust(true), so nothing is fresh
+static void test_never_subscribed(void)
+{
+  list->store(1001, 1, "Jane Doe", false, 10);
+  list->trust(false);
+  list->store(1002, 1, "John Doe", true, 11);
+  TEST_ASSERT_EQUAL(1, lookup(1001));
+  TEST_ASSERT_EQUAL(1, lookup(1002));
+  TEST_ASSERT_FALSE(list->isTrusted());
+}
+
+static void test_remove(void)
+{
+  list->trust(true);
+  for (uID_t uid = 1; uid <= 3; uid++) list->store(uid, 1, "x", false, uid);
+  list->remove(2, true);
+  list->remove(7, true); // not in the list
+  TEST_ASSERT_EQUAL(2, list->size());
+  TEST_ASSERT_EQUAL(0, lookup(2));
+  TEST_ASSERT_EQUAL(2, lookup(1));
+  TEST_ASSERT_EQUAL(2, lookup(3));
+  TEST_ASSERT_EQUAL_UINT32(2, list->pushes);
+}
+
+// When it's full, the least recently stored or found entry is replaced
+static void test_least_recently_used(void)
+{
+  for (uID_t uid = 1; uid <= 4; uid++) list->store(uid, 1, "x", false, 10 * uid);
+  TEST_ASSERT_EQUAL(1, lookup(1, 50)); // 2 is the least recently used now
+  list->store(5, 1, "x", false, 60);
+  TEST_ASSERT_EQUAL(4, list->size());
+  TEST_ASSERT_EQUAL(0, lookup(2, 61));
+  TEST_ASSERT_EQUAL(1, lookup(1, 62));
+  list->store(6, 1, "x", false, 63); // replaces 3
+  TEST_ASSERT_EQUAL(0, lookup(3, 64));
+  list->store(4, 0, "y", false, 65); // updates 4 in place
+  TEST_ASSERT_EQUAL(4, list->size());
+  TEST_ASSERT_EQUAL(1, lookup(4, 66));
+  TEST_ASSERT_EQUAL_STRING("y", idName);
+}
+
+// softSeconds() wrapping around doesn't make the newest entries look the oldest
+static void test_lru_wraparound(void)
+{
+  list->store(1, 1, "x", false, UINT32_MAX - 5);
+  list->store(2, 1, "x", false, UINT32_MAX - 1);
+  list->store(3, 1, "x", false, 2);
+  list->store(4, 1, "x", false, 3);
+  list->store(5, 1, "x", false, 4); // replaces 1
+  TEST_ASSERT_EQUAL(0, lookup(1, 5));
+  TEST_ASSERT_EQUAL(1, lookup(3, 5));
+}
+
+static void test_counts_and_names(void)
+{
+  list->trust(true);
+  char longName[ID_NAME_MAX + 20];
+  memset(longName, 'a', sizeof longName - 1);
+  longName[sizeof longName - 1] = 0;
+  list->store(1, 1, longName, false, 1);
+  TEST_ASSERT_EQUAL(2, lookup(1));
+  TEST_ASSERT_EQUAL(ID_NAME_MAX - 1, strlen(idName));
+  list->trust(false);
+  TEST_ASSERT_EQUAL(1, lookup(1));
+  TEST_ASSERT_EQUAL(0, lookup(2));
+  TEST_ASSERT_EQUAL_UINT32(1, list->hits);
+  TEST_ASSERT_EQUAL_UINT32(1, list->staleHits);
+  TEST_ASSERT_EQUAL_UINT32(0, list->pushes);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_fresh_while_subscribed);
+  RUN_TEST(test_stored_before_subscription_is_stale);
+  RUN_TEST(test_never_subscribed);
+  RUN_TEST(test_remove);
+  RUN_TEST(test_least_recently_used);
+  RUN_TEST(test_lru_wraparound);
+  RUN_TEST(test_counts_and_names);
+  return UNITY_END();
+}
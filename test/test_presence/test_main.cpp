@@ -0,0 +1,209 @@
+// test_presence - the reader event path with simulated readers, and its benchmark
+#include <unity.h>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <new>
+#include <thread>
+#include "presence.h"
+
+#define MS 1000LL // microseconds
+#define AWAY (TAG_AWAY_MS * MS)
+
+// The event path must not allocate, so the test counts the allocations
+static std::atomic<unsigned> allocations;
+void *operator new(size_t size)
+{
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static presenceEngine<2, 64> *engine;
+void setUp(void) { engine = new presenceEngine<2, 64>; }
+void tearDown(void) { delete engine; }
+
+static int events(tagEventType type, uID_t uid = 0)
+{
+  int n = 0;
+  tagEvent x;
+  while (engine->nextEvent(x)) {
+    if (x.type == type && (!uid || x.uid == uid)) n++;
+  }
+  return n;
+}
+
+// An RDM6300 sends a frame about every 65 ms while a tag is on it
+static void readTag(int reader, uID_t uid, int64_t from, int64_t to)
+{
+  for (int64_t t = from; t < to; t += 65 * MS) engine->frame(reader, {uid, t}, AWAY);
+}
+
+static void test_arrive_present_depart(void)
+{
+  readTag(0, 1234, 0, 1000 * MS);
+  tagEvent x;
+  TEST_ASSERT_TRUE(engine->nextEvent(x));
+  TEST_ASSERT_EQUAL(te_arrived, x.type);
+  TEST_ASSERT_EQUAL(1, x.reader);
+  TEST_ASSERT_EQUAL(1234, x.uid);
+  TEST_ASSERT_EQUAL(3, events(te_present)); // every TAG_PRESENT_MS while it's there
+  TEST_ASSERT_EQUAL(1234, engine->presentID(0));
+  int64_t last = 975 * MS; // the last frame
+  TEST_ASSERT_EQUAL_INT64(last + AWAY, engine->depart(last + AWAY - 1, AWAY));
+  TEST_ASSERT_EQUAL(0, events(te_departed));
+  TEST_ASSERT_EQUAL_INT64(INT64_MAX, engine->depart(last + AWAY, AWAY));
+  TEST_ASSERT_EQUAL(1, events(te_departed, 1234));
+  TEST_ASSERT_EQUAL(0, engine->presentID(0));
+}
+
+// A tag resting on the reader that isn't read for a while isn't a new scan
+static void test_missed_reads_are_suppressed(void)
+{
+  readTag(0, 1234, 0, 200 * MS);
+  readTag(0, 1234, 900 * MS, 1000 * MS); // 700 ms without a read
+  TEST_ASSERT_EQUAL(1, events(te_arrived));
+  TEST_ASSERT_EQUAL(1, engine->suppressedScans(0));
+}
+
+// Another tag arrives: the first departs; the first one again is suppressed until it's away
+static void test_tag_swap(void)
+{
+  readTag(0, 1, 0, 300 * MS);
+  readTag(0, 2, 300 * MS, 600 * MS);
+  TEST_ASSERT_EQUAL(2, events(te_arrived));
+  readTag(0, 1, 600 * MS, 700 * MS);
+  TEST_ASSERT_EQUAL(0, events(te_arrived));
+  TEST_ASSERT_EQUAL(2, engine->suppressedScans(0));
+  readTag(0, 1, 700 * MS + AWAY, 800 * MS + AWAY); // its last read was at 665 ms
+  TEST_ASSERT_EQUAL(1, events(te_arrived, 1));
+}
+
+// The same tag on two readers makes a scan at each
+static void test_two_readers(void)
+{
+  readTag(0, 7, 0, 200 * MS);
+  readTag(1, 7, 0, 200 * MS);
+  tagEvent x;
+  int seen = 0;
+  while (engine->nextEvent(x)) {
+    if (x.type == te_arrived) seen |= 1 << (x.reader - 1);
+  }
+  TEST_ASSERT_EQUAL(3, seen);
+  TEST_ASSERT_EQUAL(7, engine->presentID(0));
+  TEST_ASSERT_EQUAL(7, engine->presentID(1));
+}
+
+/*
+Simulated readers, each with tags coming and going: a tag is read every 65 ms for
+SIM_SCAN_FRAMES frames, and the next one comes after a 2-second gap.
+*/
+#define SIM_READERS 4
+#define SIM_SCAN_FRAMES 16
+static tagFrame simFrame(int reader, int n)
+{
+  int scan = n / SIM_SCAN_FRAMES;
+  return { (uID_t) (1000 * reader + scan % 100 + 1),
+    scan * (SIM_SCAN_FRAMES * 65 * MS + 2 * AWAY) + n % SIM_SCAN_FRAMES * 65 * MS };
+}
+
+struct simCounts { long frames, arrived, present, departed; };
+
+// This is the I/O task's side, like readersUpdate() and processID()
+template <unsigned N> static void simDrain(presenceEngine<SIM_READERS, 64> &engine,
+  spscQueue<tagFrame, N> *frames, simCounts &counts)
+{
+  for (int r = 0; r < SIM_READERS; r++) {
+    tagFrame f;
+    while (frames[r].pop(f)) {
+      engine.frame(r, f, AWAY);
+      counts.frames++;
+    }
+  }
+  tagEvent x;
+  while (engine.nextEvent(x)) {
+    counts.arrived += x.type == te_arrived;
+    counts.present += x.type == te_present;
+    counts.departed += x.type == te_departed;
+  }
+}
+
+static void checkCounts(presenceEngine<SIM_READERS, 64> &engine, const simCounts &counts)
+{
+  long scans = counts.frames / SIM_SCAN_FRAMES;
+  TEST_ASSERT_EQUAL(scans, counts.arrived);
+  TEST_ASSERT_EQUAL(scans - SIM_READERS, counts.departed); // the next tag makes one depart
+  TEST_ASSERT_EQUAL(0, engine.droppedEvents());
+  for (int r = 0; r < SIM_READERS; r++) TEST_ASSERT_EQUAL(0, engine.suppressedScans(r));
+}
+
+// Each simulated reader runs in its own thread, like the readers' tasks and interrupts
+#define SIM_THREAD_FRAMES 20000 // per reader
+static void test_concurrent_readers(void)
+{
+  static presenceEngine<SIM_READERS, 64> engine;
+  static spscQueue<tagFrame, 8> frames[SIM_READERS];
+  std::thread readerThreads[SIM_READERS];
+  for (int r = 0; r < SIM_READERS; r++) {
+    readerThreads[r] = std::thread([r]() {
+      for (int n = 0; n < SIM_THREAD_FRAMES; n++) {
+        while (!frames[r].push(simFrame(r, n))) std::this_thread::yield(); // queue is full
+      }
+    });
+  }
+  simCounts counts = {};
+  while (counts.frames < SIM_READERS * SIM_THREAD_FRAMES) {
+    long before = counts.frames;
+    simDrain(engine, frames, counts);
+    if (counts.frames == before) std::this_thread::yield();
+  }
+  for (std::thread &t : readerThreads) t.join();
+  checkCounts(engine, counts);
+}
+
+/*
+The benchmark runs the same path in one thread, so it times the event path and not the
+host's thread scheduling: the readers' frames go through their queues (a few at a time, as
+the I/O task gets them) and the presence engine, and the events are taken. Nothing may be
+allocated.
+*/
+#define BENCH_FRAMES 1000000 // per reader
+static void test_benchmark(void)
+{
+  static presenceEngine<SIM_READERS, 64> engine;
+  static spscQueue<tagFrame, 8> frames[SIM_READERS];
+  simCounts counts = {};
+  unsigned startAllocations = allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (int n = 0; n < BENCH_FRAMES; n += 4) {
+    for (int r = 0; r < SIM_READERS; r++) {
+      for (int i = 0; i < 4; i++) frames[r].push(simFrame(r, n + i));
+    }
+    simDrain(engine, frames, counts);
+  }
+  double ns = std::chrono::duration<double, std::nano>(
+    std::chrono::steady_clock::now() - start).count() / counts.frames;
+  TEST_ASSERT_EQUAL(0, allocations - startAllocations);
+  TEST_ASSERT_EQUAL(SIM_READERS * BENCH_FRAMES, counts.frames);
+  checkCounts(engine, counts);
+  char message[100];
+  snprintf(message, sizeof message, "%i readers: %.1f ns per frame, %ld events", SIM_READERS,
+    ns, counts.arrived + counts.present + counts.departed);
+  TEST_MESSAGE(message);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_arrive_present_depart);
+  RUN_TEST(test_missed_reads_are_suppressed);
+  RUN_TEST(test_tag_swap);
+  RUN_TEST(test_two_readers);
+  RUN_TEST(test_concurrent_readers);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
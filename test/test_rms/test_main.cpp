@@ -0,0 +1,181 @@
+// test_rms - the RMS estimator on synthetic current transformer signals, and its benchmark
+#include <unity.h>
+#include <chrono>
+#include <math.h>
+#include <new>
+#include <string.h>
+#include "rms.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+#define SAMPLE_HZ 10000 // the per-pin rate in current.cpp with two locks
+#define MIDDLE 2048 // the bias, the middle of the ADC's range
+
+static uint32_t randomState = 12345;
+static uint32_t random32(void) // xorshift, so every run is the same
+{
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}
+static double noise(double sigma) // about normal, the sum of 4 uniform values
+{
+  double x = 0;
+  for (int n = 0; n < 4; n++) x += random32() / 4294967296.0 - 0.5;
+  return x * sigma * sqrt(3.0); // the sum's variance is 4/12
+}
+
+struct signalStats {
+  uint32_t windows, unsyncedWindows;
+  uint32_t lowest, highest; // the lowest and highest estimates after the first window
+};
+
+// This feeds seconds of a sine wave with noise, a one-pole low-pass filter for the noise if
+// lowPass is true
+static signalStats run(rmsEstimator &e, double hz, double amplitude, double sigma,
+  double seconds, bool lowPass = false)
+{
+  signalStats stats = { 0, 0, UINT32_MAX, 0 };
+  double filtered = 0;
+  uint32_t windows = e.windows, unsynced = e.unsyncedWindows;
+  for (long n = 0; n < (long) (seconds * SAMPLE_HZ); n++) {
+    double x = noise(sigma);
+    if (lowPass) x = filtered += (x * 4 - filtered) / 8; // about the same RMS
+    x += MIDDLE + amplitude * sin(2 * M_PI * hz * n / SAMPLE_HZ);
+    if (!e.feed(lround(x))) continue;
+    if (e.windows - windows == 1) continue; // the first window starts from the bias
+    if (e.rms() < stats.lowest) stats.lowest = e.rms();
+    if (e.rms() > stats.highest) stats.highest = e.rms();
+  }
+  stats.windows = e.windows - windows;
+  stats.unsyncedWindows = e.unsyncedWindows - unsynced;
+  return stats;
+}
+
+static void checkAccuracy(double hz, double amplitude)
+{
+  rmsEstimator e;
+  e.begin(SAMPLE_HZ);
+  signalStats stats = run(e, hz, amplitude, 2, 2);
+  double expected = amplitude / sqrt(2.0);
+  TEST_ASSERT_UINT32_WITHIN(expected / 100 + 1, lround(expected), stats.lowest);
+  TEST_ASSERT_UINT32_WITHIN(expected / 100 + 1, lround(expected), stats.highest);
+  // 2 seconds of RMS_CYCLES-cycle windows, and the first one may be before the sync
+  TEST_ASSERT_UINT32_WITHIN(1, (int) (2 * hz / RMS_CYCLES), stats.windows);
+  TEST_ASSERT_LESS_OR_EQUAL(1, stats.unsyncedWindows);
+}
+
+static void test_50hz(void)
+{
+  checkAccuracy(50, 1000);
+  checkAccuracy(50, 100);
+  checkAccuracy(50, 30);
+}
+
+static void test_60hz(void)
+{
+  checkAccuracy(60, 1500);
+  checkAccuracy(60, 100);
+  checkAccuracy(60, 30);
+}
+
+// The mains frequency can drift a little
+static void test_off_frequency(void)
+{
+  checkAccuracy(49.5, 500);
+  checkAccuracy(60.5, 500);
+}
+
+// Only noise, at levels below, around and above the minimum hysteresis: the windows' crossings
+// aren't cycles, so no window is synced
+static void test_noise_is_unsynced(void)
+{
+  static const double sigmas[] = { 1, 4, 8, 16, 50, 200 };
+  for (double sigma : sigmas) {
+    for (int lowPass = 0; lowPass < 2; lowPass++) {
+      rmsEstimator e;
+      e.begin(SAMPLE_HZ);
+      signalStats stats = run(e, 0, 0, sigma, 10, lowPass);
+      char message[80];
+      snprintf(message, sizeof message, "sigma %.0f%s", sigma, lowPass ? " low-pass" : "");
+      TEST_ASSERT_GREATER_THAN_MESSAGE(0, stats.windows, message);
+      TEST_ASSERT_EQUAL_MESSAGE(stats.windows, stats.unsyncedWindows, message);
+      // the low-pass filter's noise varies more from window to window
+      TEST_ASSERT_UINT32_WITHIN_MESSAGE(sigma * 0.3 + 2, lround(sigma), stats.lowest, message);
+      TEST_ASSERT_UINT32_WITHIN_MESSAGE(sigma * 0.3 + 2, lround(sigma), stats.highest, message);
+    }
+  }
+}
+
+// When the machine turns off, the windows go from synced to unsynced and the RMS drops
+static void test_current_stops(void)
+{
+  rmsEstimator e;
+  e.begin(SAMPLE_HZ);
+  signalStats on = run(e, 60, 400, 4, 1);
+  TEST_ASSERT_LESS_OR_EQUAL(1, on.unsyncedWindows);
+  signalStats off = run(e, 0, 0, 4, 1);
+  TEST_ASSERT_GREATER_THAN(0, off.windows);
+  TEST_ASSERT_LESS_OR_EQUAL(1, off.windows - off.unsyncedWindows); // the one with the stop
+  TEST_ASSERT_LESS_OR_EQUAL(5, e.rms());
+  signalStats again = run(e, 50, 400, 4, 1);
+  TEST_ASSERT_LESS_OR_EQUAL(2, again.unsyncedWindows);
+  TEST_ASSERT_UINT32_WITHIN(3, lround(400 / sqrt(2.0)), e.rms());
+}
+
+// begin() sets up all of the state, whatever was in the memory before it
+static void test_begin_initializes(void)
+{
+  alignas(rmsEstimator) unsigned char memory[2][sizeof(rmsEstimator)];
+  memset(memory[0], 0x00, sizeof memory[0]);
+  memset(memory[1], 0xA5, sizeof memory[1]);
+  uint32_t estimates[2][20];
+  for (int m = 0; m < 2; m++) {
+    rmsEstimator &e = *new (memory[m]) rmsEstimator;
+    e.begin(SAMPLE_HZ);
+    randomState = 12345;
+    int count = 0;
+    for (long n = 0; count < 20; n++) {
+      int x = MIDDLE + lround(300 * sin(2 * M_PI * 60 * n / SAMPLE_HZ) + noise(2));
+      if (e.feed(x)) estimates[m][count++] = e.rmsFrac;
+    }
+  }
+  TEST_ASSERT_EQUAL_UINT32_ARRAY(estimates[0], estimates[1], 20);
+}
+
+#define BENCHMARK_SAMPLES 20000000
+
+static void test_benchmark(void)
+{
+  static int samples[SAMPLE_HZ / 60 * 60]; // 60 cycles at 60 Hz
+  for (unsigned n = 0; n < sizeof samples / sizeof *samples; n++)
+    samples[n] = MIDDLE + lround(800 * sin(2 * M_PI * 60 * n / SAMPLE_HZ) + noise(3));
+  rmsEstimator e;
+  e.begin(SAMPLE_HZ);
+  volatile uint32_t sink = 0; // so the loop isn't optimized out
+  auto start = std::chrono::steady_clock::now();
+  for (long n = 0; n < BENCHMARK_SAMPLES; n++)
+    if (e.feed(samples[n % (sizeof samples / sizeof *samples)])) sink = sink + e.rmsFrac;
+  double ns = std::chrono::duration<double, std::nano>(
+    std::chrono::steady_clock::now() - start).count() / BENCHMARK_SAMPLES;
+  TEST_ASSERT_GREATER_THAN(0, e.windows);
+  char message[80];
+  snprintf(message, sizeof message, "%.1f ns per sample, %.2f%% of a core at 20 kHz", ns,
+    ns * 20000 / 1e7);
+  TEST_MESSAGE(message);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_50hz);
+  RUN_TEST(test_60hz);
+  RUN_TEST(test_off_frequency);
+  RUN_TEST(test_noise_is_unsynced);
+  RUN_TEST(test_current_stops);
+  RUN_TEST(test_begin_initializes);
+  RUN_TEST(test_benchmark);
+  return UNITY_END();
+}
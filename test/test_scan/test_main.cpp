@@ -0,0 +1,207 @@
+// test_scan - the scan state machine and decideScan(), on a virtual clock
+#include <unity.h>
+#include "scan.h"
+
+#define SECOND 1000000LL // microseconds
+#define ID_ENABLED 1
+#define ID_DISABLED 0
+
+static scanMachine *scan;
+static scanLookup lookup; // what the next lookup finds, and the lock's state
+
+void setUp(void)
+{
+  fakeTimerMicros = 1000 * SECOND;
+  scan = new scanMachine;
+  lookup = {};
+  lookup.idEnable = ID_ENABLED;
+  lookup.tagPresent = true;
+}
+void tearDown(void) { delete scan; }
+
+// A tag arrives and its lookup comes back. The test is the lock: it follows the decision.
+static scanDecision scanTag(void)
+{
+  TEST_ASSERT_TRUE(scan->arrived());
+  TEST_ASSERT_EQUAL(ss_lookup, scan->state());
+  scanDecision d = scan->lookupDone(lookup);
+  if (d.action == sa_turnOn) lookup.lockOn = true;
+  if (d.action == sa_turnOff || d.action == sa_adminStart) lookup.lockOn = false;
+  if (d.action == sa_add) {
+    TEST_ASSERT_EQUAL(ss_add, scan->state());
+    scan->addDone();
+  }
+  TEST_ASSERT_EQUAL(ss_idle, scan->state());
+  return d;
+}
+
+static scanDecision adminScan(void)
+{
+  lookup.admin = true;
+  scanDecision d = scanTag();
+  lookup.admin = false;
+  return d;
+}
+
+// Tags are ignored while a lookup or an add is pending
+static void test_one_lookup_at_a_time(void)
+{
+  TEST_ASSERT_EQUAL(ss_idle, scan->state());
+  TEST_ASSERT_TRUE(scan->arrived());
+  fakeTimerAdvance(SECOND / 2); // a slow backend
+  TEST_ASSERT_FALSE(scan->arrived()); // another tag, ignored
+  TEST_ASSERT_EQUAL(ss_lookup, scan->state());
+  TEST_ASSERT_EQUAL(sa_turnOn, scan->lookupDone(lookup).action);
+  TEST_ASSERT_EQUAL(ss_idle, scan->state());
+  TEST_ASSERT_TRUE(scan->arrived());
+  scan->cancel(); // the request couldn't be sent
+  TEST_ASSERT_EQUAL(ss_idle, scan->state());
+  TEST_ASSERT_TRUE(scan->arrived());
+}
+
+static void test_lookup_results(void)
+{
+  lookup.error = 404;
+  TEST_ASSERT_EQUAL(sa_lookupFailed, scanTag().action);
+  lookup.error = 0;
+  lookup.idEnable = (unsigned long) ID_NOT_FOUND;
+  TEST_ASSERT_EQUAL(sa_noRecord, scanTag().action);
+  lookup.idEnable = ID_DISABLED;
+  TEST_ASSERT_EQUAL(sa_denied, scanTag().action);
+  lookup.idEnable = ID_ENABLED;
+  TEST_ASSERT_EQUAL(sa_turnOn, scanTag().action);
+  TEST_ASSERT_EQUAL(sa_turnOff, scanTag().action);
+}
+
+// A failed lookup of an admin ID isn't an admin scan
+static void test_lookup_failure_is_not_admin(void)
+{
+  lookup.error = 500;
+  TEST_ASSERT_EQUAL(sa_lookupFailed, adminScan().action);
+  lookup.error = 0;
+  scanDecision d = adminScan();
+  TEST_ASSERT_EQUAL(sa_turnOn, d.action);
+  TEST_ASSERT_TRUE(d.adminFirstScan);
+}
+
+static void test_sensors(void)
+{
+  lookup.voltageOn = true; // the machine is on but the lock is off
+  TEST_ASSERT_EQUAL(sa_turnOffFirst, scanTag().action);
+  lookup.voltageOn = false;
+  TEST_ASSERT_EQUAL(sa_turnOn, scanTag().action);
+  lookup.currentOn = true; // the machine is running
+  TEST_ASSERT_EQUAL(sa_stopFirst, scanTag().action);
+  lookup.currentOn = false;
+  TEST_ASSERT_EQUAL(sa_turnOff, scanTag().action);
+}
+
+static void test_hold_to_run(void)
+{
+  lookup.holdToRun = true;
+  lookup.tagPresent = false; // removed while the lookup was running
+  TEST_ASSERT_EQUAL(sa_holdRemoved, scanTag().action);
+  lookup.tagPresent = true;
+  TEST_ASSERT_EQUAL(sa_turnOn, scanTag().action);
+}
+
+// Two admin scans within 10 seconds start admin mode. The first one is also a normal scan.
+static void test_admin_second_scan_window(void)
+{
+  scanDecision d = adminScan();
+  TEST_ASSERT_EQUAL(sa_turnOn, d.action);
+  TEST_ASSERT_TRUE(d.adminFirstScan);
+  fakeTimerAdvance(ADMIN_WINDOW_SECONDS * SECOND - SECOND);
+  TEST_ASSERT_EQUAL(sa_adminStart, adminScan().action);
+  TEST_ASSERT_TRUE(scan->adminMode());
+  TEST_ASSERT_EQUAL_UINT32(ADMIN_TIMEOUT_MS, scan->adminMillisLeft());
+}
+
+static void test_admin_second_scan_too_late(void)
+{
+  TEST_ASSERT_EQUAL(sa_turnOn, adminScan().action);
+  fakeTimerAdvance(ADMIN_WINDOW_SECONDS * SECOND);
+  scanDecision d = adminScan(); // another 1st scan
+  TEST_ASSERT_EQUAL(sa_turnOff, d.action);
+  TEST_ASSERT_TRUE(d.adminFirstScan);
+  TEST_ASSERT_FALSE(scan->adminMode());
+  fakeTimerAdvance(5 * SECOND);
+  TEST_ASSERT_EQUAL(sa_adminStart, adminScan().action);
+}
+
+// In admin mode, scans add IDs and keep it on for ADMIN_TIMEOUT_MS after each one
+static void test_admin_mode(void)
+{
+  adminScan();
+  adminScan();
+  lookup.idEnable = ID_DISABLED;
+  for (int i = 0; i < 5; i++) {
+    fakeTimerAdvance(40 * SECOND);
+    TEST_ASSERT_EQUAL(sa_add, scanTag().action); // disabled IDs too
+    TEST_ASSERT_EQUAL_UINT32(ADMIN_TIMEOUT_MS, scan->adminMillisLeft());
+  }
+  lookup.idEnable = (unsigned long) ID_NOT_FOUND;
+  TEST_ASSERT_EQUAL(sa_noRecord, scanTag().action);
+  fakeTimerAdvance(ADMIN_TIMEOUT_MS * 1000LL - SECOND); // unknown IDs don't keep it on
+  TEST_ASSERT_TRUE(scan->adminMode());
+  fakeTimerAdvance(SECOND);
+  TEST_ASSERT_FALSE(scan->adminMode());
+  TEST_ASSERT_EQUAL_UINT32(0, scan->adminMillisLeft());
+  lookup.idEnable = ID_DISABLED;
+  TEST_ASSERT_EQUAL(sa_denied, scanTag().action);
+}
+
+// A tag during the add is ignored, and the add result finishes it
+static void test_admin_add_pending(void)
+{
+  adminScan();
+  adminScan();
+  TEST_ASSERT_TRUE(scan->arrived());
+  TEST_ASSERT_EQUAL(sa_add, scan->lookupDone(lookup).action);
+  TEST_ASSERT_EQUAL(ss_add, scan->state());
+  TEST_ASSERT_FALSE(scan->arrived());
+  fakeTimerAdvance(SECOND);
+  scan->addDone();
+  TEST_ASSERT_EQUAL(ss_idle, scan->state());
+  TEST_ASSERT_TRUE(scan->arrived());
+}
+
+static void test_admin_mode_stopped_by_admin(void)
+{
+  adminScan();
+  adminScan();
+  fakeTimerAdvance(SECOND);
+  TEST_ASSERT_EQUAL(sa_adminStop, adminScan().action);
+  TEST_ASSERT_FALSE(scan->adminMode());
+  fakeTimerAdvance(SECOND);
+  TEST_ASSERT_EQUAL(sa_turnOn, scanTag().action);
+}
+
+// Months later, the admin window still works (the timers use the 64-bit monotonic clock)
+static void test_admin_after_months(void)
+{
+  TEST_ASSERT_EQUAL(sa_turnOn, adminScan().action);
+  fakeTimerAdvance(120 * 24 * 3600 * SECOND);
+  scanDecision d = adminScan();
+  TEST_ASSERT_EQUAL(sa_turnOff, d.action);
+  TEST_ASSERT_TRUE(d.adminFirstScan);
+  fakeTimerAdvance(3 * SECOND);
+  TEST_ASSERT_EQUAL(sa_adminStart, adminScan().action);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_one_lookup_at_a_time);
+  RUN_TEST(test_lookup_results);
+  RUN_TEST(test_lookup_failure_is_not_admin);
+  RUN_TEST(test_sensors);
+  RUN_TEST(test_hold_to_run);
+  RUN_TEST(test_admin_second_scan_window);
+  RUN_TEST(test_admin_second_scan_too_late);
+  RUN_TEST(test_admin_mode);
+  RUN_TEST(test_admin_add_pending);
+  RUN_TEST(test_admin_mode_stopped_by_admin);
+  RUN_TEST(test_admin_after_months);
+  return UNITY_END();
+}
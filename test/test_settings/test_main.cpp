@@ -0,0 +1,146 @@
+// test_settings - setting lookup and storage, and a 200-line config parse benchmark
+#include <unity.h>
+#include <chrono>
+#include <string>
+#include "settingsparse.h"
+#include "ini_by_benhoyt.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static programSettings s;
+static int unknown, badSections;
+
+static int handler(void *user, const char *section, const char *name, const char *value,
+  int /*lineno*/)
+{
+  bool badSection;
+  if (storeSetting(*(programSettings *) user, section, name, value, &badSection)) return 1;
+  (badSection ? badSections : unknown)++;
+  return 0;
+}
+
+// This returns a setting's name as it's written in the config file, e.g. "Webserver-Minutes"
+static std::string fileName(const char *name)
+{
+  std::string out(1, toupper(name[0]));
+  for (name++; *name; name++) {
+    if (isupper(*name)) out += '-';
+    out += *name;
+  }
+  return out;
+}
+
+static void test_every_setting_is_found(void)
+{
+  for (int x = 0; x < NUM_SETTINGS; x++) {
+    char name[100];
+    normalizeName(name, fileName(settingsDefs[x].name).c_str(), sizeof name);
+    int index = settingsHash.index[hashSlot(settingHash(name, hashSeed))];
+    TEST_ASSERT_EQUAL(x, index);
+    TEST_ASSERT_TRUE(nameMatch(settingsDefs[x].name, name));
+  }
+}
+
+static void test_name_forms(void)
+{
+  memset(&s, 0, sizeof s);
+  unknown = badSections = 0;
+  const char *config =
+    "log-level-file = 1 # preferred\n"
+    "Log_Level_Serial : 2 ; another comment\n"
+    "WebserverMinutes = 3\n"
+    "tagawaymilliseconds:4\n"
+    "device-name = \"quoted name\"\n"
+    "host-name = 'single'\n"
+    "wifi-ssid = unquoted words\n"
+    "log-level = 5\n" // unknown (a prefix of a setting)
+    "output-pin = 6\n"
+    "[Lock-2]\n"
+    "Output-Pin = 7\n"
+    "Current-Watts-Per-Count = 0.25\n"
+    "Device-Group = no\n" // not a per-lock setting
+    "[Lock-3]\n"
+    "Output-Pin = 8\n"; // no such lock
+  int line = ini_parse_string(config, handler, &s);
+  TEST_ASSERT_EQUAL(8, line); // the first error
+  TEST_ASSERT_EQUAL(1, s.logLevelFile);
+  TEST_ASSERT_EQUAL(2, s.logLevelSerial);
+  TEST_ASSERT_EQUAL(3, s.webserverMinutes);
+  TEST_ASSERT_EQUAL(4, s.tagAwayMilliseconds);
+  TEST_ASSERT_EQUAL_STRING("quoted name", s.deviceName);
+  TEST_ASSERT_EQUAL_STRING("single", s.hostName);
+  TEST_ASSERT_EQUAL_STRING("unquoted words", s.wifiSSID);
+  TEST_ASSERT_EQUAL(6, s.locks[0].outputPin);
+  TEST_ASSERT_EQUAL(7, s.locks[1].outputPin);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6, 0.25, s.locks[1].currentWattsPerCount);
+  TEST_ASSERT_EQUAL_STRING("", s.deviceGroup);
+  TEST_ASSERT_EQUAL(1, unknown);
+  TEST_ASSERT_EQUAL(2, badSections);
+}
+
+static void test_strings_are_truncated(void)
+{
+  std::string line = "device-name = " + std::string(100, 'x') + "\n";
+  memset(&s, 0, sizeof s);
+  TEST_ASSERT_EQUAL(0, ini_parse_string(line.c_str(), handler, &s));
+  TEST_ASSERT_EQUAL(sizeof s.deviceName - 1, strlen(s.deviceName));
+  TEST_ASSERT_EQUAL(0, ini_parse_string("device-name = \"\"\n", handler, &s));
+  TEST_ASSERT_EQUAL_STRING("", s.deviceName);
+}
+
+/*
+The benchmark config has 200 lines: each setting once with a comment line before it, the
+lock settings again in a [Lock-2] section, and blank lines to make up the rest.
+*/
+static std::string benchmarkConfig(int *lines)
+{
+  std::string config;
+  *lines = 0;
+  for (int pass = 0; pass < 2; pass++) {
+    if (pass) { config += "[Lock-2]\n"; ++*lines; }
+    for (int x = 0; x < NUM_SETTINGS; x++) {
+      const settings_defs_t &def = settingsDefs[x];
+      if (pass && !def.perLock) continue;
+      config += "# The " + fileName(def.name) + " setting\n";
+      config += fileName(def.name) + " = " + (def.type == st_char ? "\"some text\"" : "12") +
+        " # a comment\n";
+      *lines += 2;
+    }
+  }
+  for (; *lines < 200; ++*lines) config += "\n";
+  return config;
+}
+
+#define BENCHMARK_PARSES 2000
+static void test_benchmark_200_lines(void)
+{
+  int lines;
+  std::string config = benchmarkConfig(&lines);
+  TEST_ASSERT_EQUAL(200, lines);
+  unknown = badSections = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int x = 0; x < BENCHMARK_PARSES; x++) {
+    memset(&s, 0, sizeof s);
+    TEST_ASSERT_EQUAL(0, ini_parse_string(config.c_str(), handler, &s));
+  }
+  double us = std::chrono::duration<double, std::micro>(
+    std::chrono::steady_clock::now() - start).count() / BENCHMARK_PARSES;
+  TEST_ASSERT_EQUAL(0, unknown + badSections);
+  TEST_ASSERT_EQUAL_STRING("some text", s.backendURL);
+  TEST_ASSERT_EQUAL(12, s.locks[1].autoOffMinutes);
+  char message[80];
+  snprintf(message, sizeof message, "200-line config: %.1f us per parse, %.0f ns per line", us,
+    us * 1000 / lines);
+  TEST_MESSAGE(message);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_every_setting_is_found);
+  RUN_TEST(test_name_forms);
+  RUN_TEST(test_strings_are_truncated);
+  RUN_TEST(test_benchmark_200_lines);
+  return UNITY_END();
+}
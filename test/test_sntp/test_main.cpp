@@ -0,0 +1,204 @@
+// test_sntp - the SNTP packets and the wall clock against a fake server with a drifting clock
+#include <unity.h>
+#include <stdlib.h>
+#include "sntp.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static uint32_t randomState = 12345;
+static uint32_t random32(void) // xorshift, so every run is the same
+{
+  randomState ^= randomState << 13;
+  randomState ^= randomState >> 17;
+  randomState ^= randomState << 5;
+  return randomState;
+}
+
+/*
+The fake server's time is its epoch plus the monotonic clock, which runs driftPpm slow or
+fast compared to it. Each exchange has its own network delays both ways.
+*/
+struct fakeServer {
+  double driftPpm;
+  int64_t epoch = 1700000000LL * 1000000;
+  int64_t truth(int64_t mono) { return epoch + mono + (int64_t) (mono * driftPpm / 1e6); }
+  // This makes a reply to a request that left at t1, it returns t4
+  int64_t reply(uint8_t packet[SNTP_PACKET_SIZE], const uint8_t request[SNTP_PACKET_SIZE],
+    int64_t t1, int64_t there, int64_t back, uint8_t stratum = 2)
+  {
+    uint64_t receive = ntpTime(truth(t1 + there)), transmit = ntpTime(truth(t1 + there) + 50);
+    for (int i = 0; i < SNTP_PACKET_SIZE; i++) packet[i] = 0;
+    packet[0] = (4 << 3) | 4; // version 4, server mode
+    packet[1] = stratum;
+    for (int i = 0; i < 8; i++) {
+      packet[24 + i] = request[40 + i]; // originate = the request's transmit time
+      packet[32 + i] = receive >> (56 - 8 * i);
+      packet[40 + i] = transmit >> (56 - 8 * i);
+    }
+    return t1 + there + 50 + back;
+  }
+  static uint64_t ntpTime(int64_t wall) {
+    return ((uint64_t) (wall / 1000000 + SNTP_UNIX_OFFSET) << 32) |
+      (((uint64_t) (wall % 1000000) << 32) / 1000000);
+  }
+};
+
+// One request and reply over a network with delays of 5-15 ms each way
+static sntpClock::result exchange(sntpClock &clock, fakeServer &server, int64_t t1)
+{
+  uint8_t request[SNTP_PACKET_SIZE], reply[SNTP_PACKET_SIZE];
+  sntpRequest(request, t1);
+  int64_t t4 = server.reply(reply, request, t1, 5000 + random32() % 10000,
+    5000 + random32() % 10000);
+  int64_t t2, t3;
+  TEST_ASSERT_TRUE(sntpParse(reply, sizeof reply, t1, t2, t3));
+  return clock.sample(t1, t2, t3, t4);
+}
+
+static void test_packets(void)
+{
+  uint8_t request[SNTP_PACKET_SIZE], reply[SNTP_PACKET_SIZE];
+  uint64_t nonce = 0x0123456789abcdefULL;
+  sntpRequest(request, nonce);
+  TEST_ASSERT_EQUAL_HEX8(0x23, request[0]); // version 4, client mode
+  TEST_ASSERT_EQUAL_HEX64(nonce, sntpField(request + 40));
+  fakeServer server = { 0 };
+  server.reply(reply, request, 1000000, 10000, 10000);
+  int64_t t2, t3;
+  TEST_ASSERT_TRUE(sntpParse(reply, sizeof reply, nonce, t2, t3));
+  TEST_ASSERT_INT64_WITHIN(1, server.truth(1010000), t2);
+  TEST_ASSERT_INT64_WITHIN(1, server.truth(1010050), t3);
+  TEST_ASSERT_FALSE(sntpParse(reply, sizeof reply, nonce + 1, t2, t3)); // another request's
+  TEST_ASSERT_FALSE(sntpParse(reply, SNTP_PACKET_SIZE - 1, nonce, t2, t3)); // short
+  reply[0] = (3 << 6) | (4 << 3) | 4; // leap indicator 3: the server isn't synchronized
+  TEST_ASSERT_FALSE(sntpParse(reply, sizeof reply, nonce, t2, t3));
+  reply[0] = (4 << 3) | 3; // client mode
+  TEST_ASSERT_FALSE(sntpParse(reply, sizeof reply, nonce, t2, t3));
+  server.reply(reply, request, 1000000, 10000, 10000, 0); // kiss-o'-death
+  TEST_ASSERT_FALSE(sntpParse(reply, sizeof reply, nonce, t2, t3));
+  server.reply(reply, request, 1000000, 10000, 10000, 16); // stratum 16, unsynchronized
+  TEST_ASSERT_FALSE(sntpParse(reply, sizeof reply, nonce, t2, t3));
+}
+
+// NTP seconds wrap around in 2036, and times after that are still later
+static void test_2036(void)
+{
+  TEST_ASSERT_EQUAL_INT64(0, sntpMicros((uint64_t) SNTP_UNIX_OFFSET << 32));
+  TEST_ASSERT_EQUAL_INT64(((1LL << 32) + 10 - SNTP_UNIX_OFFSET) * 1000000,
+    sntpMicros((uint64_t) 10 << 32));
+  TEST_ASSERT_EQUAL_INT64(500000, sntpMicros(((uint64_t) SNTP_UNIX_OFFSET << 32) | 0x80000000));
+}
+
+// The first sample sets the clock, to within the network's asymmetry
+static void test_first_sample_steps(void)
+{
+  sntpClock clock;
+  fakeServer server = { 0 };
+  TEST_ASSERT_FALSE(clock.isSet());
+  TEST_ASSERT_EQUAL_INT64(7000000, clock.micros(7000000)); // since boot
+  TEST_ASSERT_EQUAL(sntpClock::sr_stepped, exchange(clock, server, 5000000));
+  TEST_ASSERT_TRUE(clock.isSet());
+  TEST_ASSERT_INT64_WITHIN(5000, server.truth(6000000), clock.micros(6000000));
+}
+
+/*
+The server runs 35 ppm slow. The clock learns the drift, so it stays close between samples,
+it never goes backwards, and the poll interval grows to the maximum.
+*/
+static void test_drift_converges(void)
+{
+  sntpClock clock;
+  fakeServer server = { -35 };
+  int64_t mono = 5000000, previous = 0, maxError = 0;
+  for (int n = 0; n < 100; n++) {
+    sntpClock::result result = exchange(clock, server, mono);
+    TEST_ASSERT_EQUAL(n ? sntpClock::sr_slewed : sntpClock::sr_stepped, result);
+    int64_t next = mono + (int64_t) clock.pollSeconds() * 1000000;
+    for (int64_t m = mono + 30000; m < next; m += 250000) {
+      int64_t wall = clock.micros(m);
+      if (n) TEST_ASSERT_GREATER_OR_EQUAL_INT64(previous, wall);
+      previous = wall;
+      int64_t error = llabs(wall - server.truth(m));
+      if (n >= 50 && error > maxError) maxError = error;
+    }
+    mono = next;
+  }
+  TEST_ASSERT_INT32_WITHIN(1000, -35000, clock.freqPpb());
+  TEST_ASSERT_EQUAL_UINT32(1 << SNTP_MAX_POLL, clock.pollSeconds());
+  TEST_ASSERT_LESS_THAN_INT64(10000, maxError); // the delays can differ by 10 ms
+  TEST_ASSERT_EQUAL_UINT32(1, clock.steps);
+}
+
+// A large drift error makes the poll interval shorter again, and a jump over a second steps
+static void test_poll_shrinks_and_steps(void)
+{
+  sntpClock clock;
+  fakeServer server = { 10 };
+  int64_t mono = 5000000;
+  for (int n = 0; n < 60; n++) {
+    exchange(clock, server, mono);
+    mono += (int64_t) clock.pollSeconds() * 1000000;
+  }
+  uint32_t poll = clock.pollSeconds();
+  TEST_ASSERT_GREATER_THAN(1 << SNTP_MIN_POLL, poll);
+  server.epoch += 200000; // 200 ms off, slewed
+  TEST_ASSERT_EQUAL(sntpClock::sr_slewed, exchange(clock, server, mono));
+  TEST_ASSERT_LESS_THAN(poll, clock.pollSeconds());
+  mono += 1000000;
+  server.epoch += 5000000; // 5 s off, stepped
+  TEST_ASSERT_EQUAL(sntpClock::sr_stepped, exchange(clock, server, mono));
+  TEST_ASSERT_EQUAL_UINT32(1 << SNTP_MIN_POLL, clock.pollSeconds());
+  TEST_ASSERT_INT64_WITHIN(5000, server.truth(mono + 100000), clock.micros(mono + 100000));
+}
+
+// Slow round trips and replies from before the request are rejected, and change nothing
+static void test_rejects(void)
+{
+  sntpClock clock;
+  fakeServer server = { 0 };
+  exchange(clock, server, 5000000);
+  int64_t before = clock.micros(9000000);
+  uint8_t request[SNTP_PACKET_SIZE], reply[SNTP_PACKET_SIZE];
+  sntpRequest(request, 6000000);
+  int64_t t4 = server.reply(reply, request, 6000000, 300000, 300000), t2, t3;
+  TEST_ASSERT_TRUE(sntpParse(reply, sizeof reply, 6000000, t2, t3));
+  TEST_ASSERT_EQUAL(sntpClock::sr_rejected, clock.sample(6000000, t2, t3, t4));
+  TEST_ASSERT_EQUAL(sntpClock::sr_rejected, clock.sample(6000000, t2, t3, 5999999));
+  TEST_ASSERT_EQUAL_UINT32(2, clock.rejects);
+  TEST_ASSERT_EQUAL_INT64(before, clock.micros(9000000));
+}
+
+/*
+The offset assumes the reply took as long as the request, so a t4 taken late (e.g. when a
+polling loop gets to the reply) makes the offset wrong by half of the lateness.
+*/
+static void test_late_t4_skews_offset(void)
+{
+  for (int late = 0; late <= 4000; late += 1000) {
+    sntpClock clock;
+    fakeServer server = { 0 };
+    uint8_t request[SNTP_PACKET_SIZE], reply[SNTP_PACKET_SIZE];
+    int64_t t1 = 5000000, t2, t3;
+    for (int n = 0; n < 2; n++, t1 += 64000000) { // set it, then a sample with a late t4
+      sntpRequest(request, t1);
+      int64_t t4 = server.reply(reply, request, t1, 10000, 10000);
+      TEST_ASSERT_TRUE(sntpParse(reply, sizeof reply, t1, t2, t3));
+      clock.sample(t1, t2, t3, n ? t4 + late : t4);
+    }
+    TEST_ASSERT_INT64_WITHIN(1, -late / 2, clock.lastOffset);
+  }
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_packets);
+  RUN_TEST(test_2036);
+  RUN_TEST(test_first_sample_steps);
+  RUN_TEST(test_drift_converges);
+  RUN_TEST(test_poll_shrinks_and_steps);
+  RUN_TEST(test_rejects);
+  RUN_TEST(test_late_t4_skews_offset);
+  return UNITY_END();
+}
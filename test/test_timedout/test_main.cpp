@@ -0,0 +1,132 @@
+// test_timedout - the timer classes on a virtual clock, over months of uptime
+#include <unity.h>
+#include "timedout.h"
+
+#define SECOND 1000000LL // microseconds
+#define MINUTE (60 * SECOND)
+#define DAY (24 * 60 * MINUTE)
+
+void setUp(void) { fakeTimerMicros = 0; }
+void tearDown(void) {}
+
+static void test_ms_timed_out(void)
+{
+  msTimedOut x(500);
+  fakeTimerAdvance(499999);
+  TEST_ASSERT_FALSE(x);
+  fakeTimerAdvance(1);
+  TEST_ASSERT_TRUE(x);
+  TEST_ASSERT_TRUE(x); // it stays timed out until it's reset
+  x.reset(500);
+  TEST_ASSERT_FALSE(x);
+}
+
+static void test_sec_timed_out_once(void)
+{
+  secTimedOut x(10);
+  TEST_ASSERT_TRUE(x.isActive());
+  fakeTimerAdvance(10 * SECOND - 1);
+  TEST_ASSERT_FALSE(x);
+  fakeTimerAdvance(1);
+  TEST_ASSERT_FALSE(x.isActive());
+  TEST_ASSERT_TRUE(x);
+  TEST_ASSERT_TRUE(x.isDisabled()); // one time only
+  fakeTimerAdvance(365 * DAY);
+  TEST_ASSERT_FALSE(x);
+}
+
+static void test_min_timed_out(void)
+{
+  minTimedOut x;
+  x.reset(50);
+  fakeTimerAdvance(50 * MINUTE - SECOND);
+  TEST_ASSERT_FALSE(x);
+  fakeTimerAdvance(SECOND);
+  TEST_ASSERT_TRUE(x);
+  TEST_ASSERT_FALSE(x);
+}
+
+/*
+Six months of uptime in 1-second steps, past where millis() wraps (49.7 days) and where
+its signed difference changes sign (24.9 days). A 1-minute msTimedOut, a 1-hour
+minTimedOut and a 1-day secTimedOut must fire exactly on time, every time.
+*/
+static void test_months_of_uptime(void)
+{
+  const int64_t end = 183 * DAY;
+  msTimedOut minute(60000);
+  minTimedOut hour;
+  hour.reset(60);
+  secTimedOut day(24 * 3600);
+  int64_t minutes = 0, hours = 0, days = 0;
+  for (fakeTimerMicros = 0; fakeTimerMicros <= end; fakeTimerAdvance(SECOND)) {
+    if (minute) {
+      minutes++;
+      TEST_ASSERT_EQUAL_INT64(minutes * MINUTE, fakeTimerMicros);
+      minute.reset(60000);
+    }
+    if (hour) {
+      hours++;
+      TEST_ASSERT_EQUAL_INT64(hours * 60 * MINUTE, fakeTimerMicros);
+      hour.reset(60);
+    }
+    if (day) {
+      days++;
+      TEST_ASSERT_EQUAL_INT64(days * DAY, fakeTimerMicros);
+      day.reset(24 * 3600);
+    }
+  }
+  TEST_ASSERT_EQUAL_INT64(183 * 24 * 60, minutes);
+  TEST_ASSERT_EQUAL_INT64(183 * 24, hours);
+  TEST_ASSERT_EQUAL_INT64(183, days);
+  TEST_ASSERT_EQUAL_UINT32(fakeTimerMicros / SECOND, softSeconds()); // no 32-bit wrap
+}
+
+// A long timeout (e.g. Webserver-Minutes' default, 99,999,999 minutes) never fires early
+static void test_long_timeout(void)
+{
+  fakeTimerMicros = 100 * DAY;
+  minTimedOut x;
+  x.reset(99999999);
+  TEST_ASSERT_TRUE(x.isActive());
+  for (int month = 0; month < 24; month++) {
+    fakeTimerAdvance(30 * DAY);
+    TEST_ASSERT_TRUE(x.isActive());
+    TEST_ASSERT_FALSE(x);
+  }
+}
+
+// Setting or stepping the wall clock doesn't move the timeouts
+static void test_wall_clock_is_separate(void)
+{
+  fakeTimerMicros = 40 * DAY;
+  msTimedOut ms(1000);
+  secTimedOut sec(10);
+  int64_t t1 = monoMicros(), wall = 1700000000LL * SECOND;
+  TEST_ASSERT_EQUAL(sntpClock::sr_stepped, wallClock.sample(t1, wall, wall, t1 + 1000));
+  TEST_ASSERT_INT64_WITHIN(SECOND, 1700000000, wallTime());
+  fakeTimerAdvance(999999);
+  TEST_ASSERT_FALSE(ms);
+  TEST_ASSERT_FALSE(sec);
+  fakeTimerAdvance(1);
+  TEST_ASSERT_TRUE(ms);
+  t1 = monoMicros(); // a 1-hour step of the wall clock
+  wall = wallClock.micros(t1) + 3600 * SECOND;
+  TEST_ASSERT_EQUAL(sntpClock::sr_stepped, wallClock.sample(t1, wall, wall, t1 + 1000));
+  fakeTimerAdvance(8 * SECOND);
+  TEST_ASSERT_FALSE(sec);
+  fakeTimerAdvance(SECOND);
+  TEST_ASSERT_TRUE(sec);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_ms_timed_out);
+  RUN_TEST(test_sec_timed_out_once);
+  RUN_TEST(test_min_timed_out);
+  RUN_TEST(test_months_of_uptime);
+  RUN_TEST(test_long_timeout);
+  RUN_TEST(test_wall_clock_is_separate);
+  return UNITY_END();
+}
@@ -0,0 +1,106 @@
+// test_webedit - the file editor page's escaping and markup
+#include <unity.h>
+#include <string>
+#include "webedit.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void test_escape(void)
+{
+  char out[64];
+  TEST_ASSERT_EQUAL(32, htmlEscape(out, sizeof out, "/a\"b<c>&'.txt"));
+  TEST_ASSERT_EQUAL_STRING("/a&quot;b&lt;c&gt;&amp;&#39;.txt", out);
+  TEST_ASSERT_EQUAL(0, htmlEscape(out, sizeof out, ""));
+  TEST_ASSERT_EQUAL_STRING("", out);
+}
+
+static void test_escape_truncates_whole_entities(void)
+{
+  char out[8];
+  TEST_ASSERT_EQUAL(12, htmlEscape(out, sizeof out, "abc\"def"));
+  TEST_ASSERT_EQUAL_STRING("abc", out); // &quot; doesn't fit, so it and the rest are dropped
+  TEST_ASSERT_EQUAL(1, htmlEscape(out, 1, "x"));
+  TEST_ASSERT_EQUAL_STRING("", out);
+}
+
+static void test_new_file_input(void)
+{
+  char out[EDIT_INPUT_MAX];
+  editSavePathInput(out, sizeof out, "/new.txt", true);
+  TEST_ASSERT_EQUAL_STRING(
+    "<input type=\"text\" id=\"save_path\" name=\"save_path\" value=\"/new.txt\" >", out);
+  editSavePathInput(out, sizeof out, "/new.txt", false); // an existing file named new.txt
+  TEST_ASSERT_EQUAL_STRING(
+    "<input type=\"hidden\" id=\"save_path\" name=\"save_path\" value=\"/new.txt\" >", out);
+}
+
+static void test_attribute_injection(void)
+{
+  char out[EDIT_INPUT_MAX];
+  editSavePathInput(out, sizeof out, "/x\" onfocus=\"alert(1)", false);
+  TEST_ASSERT_EQUAL_STRING("<input type=\"hidden\" id=\"save_path\" name=\"save_path\" "
+    "value=\"/x&quot; onfocus=&quot;alert(1)\" >", out);
+}
+
+static void test_long_path_keeps_markup(void)
+{
+  char path[400], out[EDIT_INPUT_MAX];
+  memset(path, '&', sizeof path - 1);
+  path[sizeof path - 1] = '\0';
+  editSavePathInput(out, sizeof out, path, false);
+  TEST_ASSERT_LESS_THAN(sizeof out, strlen(out) + 1);
+  TEST_ASSERT_EQUAL_STRING("\" >", out + strlen(out) - 3);
+}
+
+// A file escaped a block at a time, as readFileEscaped() does, matches escaping it whole
+static void test_escape_blocks(void)
+{
+  const char text[] = "<textarea>\"x\" & 'y'</textarea>\nname = caf\xc3\xa9 <b>";
+  char whole[512], escaped[HTML_ESCAPE_BLOCK(sizeof text)];
+  htmlEscape(whole, sizeof whole, text);
+  for (size_t block = 1; block <= sizeof text; block++) {
+    std::string content;
+    for (size_t x = 0; x < sizeof text - 1; x += block) {
+      size_t n = sizeof text - 1 - x < block ? sizeof text - 1 - x : block;
+      content.append(escaped, htmlEscapeBlock(escaped, text + x, n));
+    }
+    TEST_ASSERT_EQUAL_STRING(whole, content.c_str());
+  }
+  TEST_ASSERT_EQUAL(6 * 4, htmlEscapeBlock(escaped, "\"\"\"\"", 4)); // the worst case fits
+}
+
+static void test_file_option(void)
+{
+  char out[EDIT_OPTION_MAX];
+  TEST_ASSERT_TRUE(editFileOption(out, sizeof out, "config.txt"));
+  TEST_ASSERT_EQUAL_STRING("<option value=\"/config.txt\">config.txt</option>", out);
+  TEST_ASSERT_TRUE(editFileOption(out, sizeof out, "a\"><script>.txt"));
+  TEST_ASSERT_EQUAL_STRING("<option value=\"/a&quot;&gt;&lt;script&gt;.txt\">"
+    "a&quot;&gt;&lt;script&gt;.txt</option>", out);
+}
+
+// A name that doesn't fit is left out, not truncated into another file's path
+static void test_file_option_too_long(void)
+{
+  char out[48];
+  TEST_ASSERT_TRUE(editFileOption(out, sizeof out, "abcdefghij")); // exactly fits
+  TEST_ASSERT_EQUAL(sizeof out - 1, strlen(out));
+  TEST_ASSERT_FALSE(editFileOption(out, sizeof out, "abcdefghijk"));
+  TEST_ASSERT_EQUAL_STRING("", out);
+  TEST_ASSERT_FALSE(editFileOption(out, sizeof out, "&&x")); // 11 escaped
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_escape);
+  RUN_TEST(test_escape_truncates_whole_entities);
+  RUN_TEST(test_new_file_input);
+  RUN_TEST(test_attribute_injection);
+  RUN_TEST(test_long_path_keeps_markup);
+  RUN_TEST(test_escape_blocks);
+  RUN_TEST(test_file_option);
+  RUN_TEST(test_file_option_too_long);
+  return UNITY_END();
+}
@@ -0,0 +1,177 @@
+// test_wiegand - the Wiegand decoder replaying edge-timing traces
+#include <unity.h>
+#include <vector>
+#include "wiegand.h"
+
+void setUp(void) {}
+void tearDown(void) {}
+
+struct edge { int bit; int64_t micros; }; // a falling edge on D0 (bit=0) or D1 (bit=1)
+
+// A 26-bit frame (facility 18, card 4660) recorded from a reader, about 2 ms per bit
+static const edge recorded[] = {
+  {1, 1000000}, {0, 1001981}, {0, 1003940}, {0, 1005930}, {1, 1007953}, {0, 1009899},
+  {0, 1011848}, {1, 1013893}, {0, 1015901}, {0, 1017853}, {0, 1019839}, {0, 1021853},
+  {1, 1023800}, {0, 1025856}, {0, 1027860}, {1, 1029827}, {0, 1031771}, {0, 1033722},
+  {0, 1035717}, {1, 1037710}, {1, 1039658}, {0, 1041628}, {1, 1043579}, {0, 1045589},
+  {0, 1047583}, {1, 1049530},
+};
+
+/*
+This replays a trace like the pins' interrupts and wiegandClass::update() do: a frame is
+taken when no edge has come for WIEGAND_TIMEOUT_US, and at the end of the trace. It returns
+the valid frames' tag IDs.
+*/
+static std::vector<uint32_t> replay(wiegandDecoder &decoder, const std::vector<edge> &trace,
+  int bits = 0)
+{
+  std::vector<uint32_t> ids;
+  uint32_t tagID;
+  for (const edge &e : trace) {
+    if (decoder.pending() && decoder.endMicros() <= e.micros && decoder.frame(bits, tagID))
+      ids.push_back(tagID);
+    decoder.edge(e.bit, e.micros);
+  }
+  if (decoder.pending() && decoder.frame(bits, tagID)) ids.push_back(tagID);
+  return ids;
+}
+
+// This appends a frame's edges to a trace, with the parity bits added
+static void appendFrame(std::vector<edge> &trace, uint64_t id, int bits, int64_t start,
+  int64_t spacing = 2000)
+{
+  int n = bits - 2, firstHalf = (bits + 1) / 2 - 1, ones = 0;
+  std::vector<int> frame;
+  for (int i = n - 1; i >= 0; i--) frame.push_back(id >> i & 1);
+  for (int i = 0; i < firstHalf; i++) ones += frame[i];
+  frame.insert(frame.begin(), ones & 1); // even parity
+  ones = 0;
+  for (int i = bits - 1 - (bits - bits / 2 - 1); i < bits - 1; i++) ones += frame[i];
+  frame.push_back(!(ones & 1)); // odd parity
+  for (int b : frame) {
+    trace.push_back({b, start});
+    start += spacing;
+  }
+}
+
+static void test_recorded_frame(void)
+{
+  wiegandDecoder decoder;
+  std::vector<edge> trace(recorded, recorded + sizeof recorded / sizeof recorded[0]);
+  std::vector<uint32_t> ids = replay(decoder, trace);
+  TEST_ASSERT_EQUAL(1, ids.size());
+  TEST_ASSERT_EQUAL_HEX32(18 << 16 | 4660, ids[0]);
+  TEST_ASSERT_EQUAL(1, decoder.frames);
+}
+
+static void test_frames_back_to_back(void)
+{
+  wiegandDecoder decoder;
+  std::vector<edge> trace;
+  appendFrame(trace, 0x121234, 26, 0);
+  appendFrame(trace, 0xDEADBEEF, 34, 26 * 2000 + WIEGAND_TIMEOUT_US); // right after the end
+  appendFrame(trace, 0x123, 26, 200000, 1000); // 1 ms per bit
+  std::vector<uint32_t> ids = replay(decoder, trace);
+  TEST_ASSERT_EQUAL(3, ids.size());
+  TEST_ASSERT_EQUAL_HEX32(0x121234, ids[0]);
+  TEST_ASSERT_EQUAL_HEX32(0xDEADBEEF, ids[1]);
+  TEST_ASSERT_EQUAL_HEX32(0x123, ids[2]);
+}
+
+static void test_custom_length(void)
+{
+  wiegandDecoder decoder;
+  std::vector<edge> trace;
+  appendFrame(trace, 0x1ABCDEF01ULL, 37, 0); // the ID is the low 32 bits
+  std::vector<uint32_t> ids = replay(decoder, trace, 37);
+  TEST_ASSERT_EQUAL(1, ids.size());
+  TEST_ASSERT_EQUAL_HEX32(0xABCDEF01, ids[0]);
+  ids = replay(decoder, trace); // not 26 or 34 bits
+  TEST_ASSERT_EQUAL(0, ids.size());
+  TEST_ASSERT_EQUAL(1, decoder.lengthErrors);
+}
+
+// Noise makes an extra edge shortly after a bit, which spoils that frame only
+static void test_glitches(void)
+{
+  wiegandDecoder decoder;
+  std::vector<edge> trace;
+  appendFrame(trace, 0x121234, 26, 0);
+  trace.insert(trace.begin() + 10, {1, trace[9].micros + 40}); // 40 us after bit 9
+  appendFrame(trace, 0x121234, 26, 100000);
+  trace.push_back({0, trace.back().micros + WIEGAND_GLITCH_US - 1}); // after the last bit
+  appendFrame(trace, 0x5678, 26, 200000);
+  std::vector<uint32_t> ids = replay(decoder, trace);
+  TEST_ASSERT_EQUAL(1, ids.size());
+  TEST_ASSERT_EQUAL_HEX32(0x5678, ids[0]);
+  TEST_ASSERT_EQUAL(2, decoder.glitches);
+}
+
+// An edge just slower than the glitch limit is a bit, so the frame is too long
+static void test_not_a_glitch(void)
+{
+  wiegandDecoder decoder;
+  std::vector<edge> trace;
+  appendFrame(trace, 0x121234, 26, 0);
+  trace.push_back({0, trace.back().micros + WIEGAND_GLITCH_US});
+  TEST_ASSERT_EQUAL(0, replay(decoder, trace).size());
+  TEST_ASSERT_EQUAL(0, decoder.glitches);
+  TEST_ASSERT_EQUAL(1, decoder.lengthErrors);
+}
+
+// A frame cut short (the tag was pulled away, or the reader was reset) is thrown away, and
+// the next frame still works
+static void test_truncated_frames(void)
+{
+  wiegandDecoder decoder;
+  std::vector<edge> trace, frame;
+  for (int keep = 1; keep < 26; keep++) {
+    frame.clear();
+    appendFrame(frame, 0x121234, 26, keep * 100000);
+    trace.insert(trace.end(), frame.begin(), frame.begin() + keep);
+  }
+  appendFrame(trace, 0x121234, 26, 3000000);
+  std::vector<uint32_t> ids = replay(decoder, trace);
+  TEST_ASSERT_EQUAL(1, ids.size());
+  TEST_ASSERT_EQUAL(25, decoder.lengthErrors);
+  TEST_ASSERT_EQUAL(0, decoder.parityErrors);
+}
+
+// A frame whose bits were received wrong fails the parity check, at either end
+static void test_parity_errors(void)
+{
+  wiegandDecoder decoder;
+  std::vector<edge> trace, frame;
+  for (int bit = 0; bit < 26; bit++) {
+    frame.clear();
+    appendFrame(frame, 0x121234, 26, bit * 100000);
+    frame[bit].bit ^= 1;
+    trace.insert(trace.end(), frame.begin(), frame.end());
+  }
+  TEST_ASSERT_EQUAL(0, replay(decoder, trace).size());
+  TEST_ASSERT_EQUAL(26, decoder.parityErrors);
+}
+
+// A stuck line makes a very long frame, which is thrown away
+static void test_too_long(void)
+{
+  wiegandDecoder decoder;
+  std::vector<edge> trace;
+  for (int i = 0; i < 100; i++) trace.push_back({0, i * 1000});
+  TEST_ASSERT_EQUAL(0, replay(decoder, trace, WIEGAND_MAX_BITS).size());
+  TEST_ASSERT_EQUAL(1, decoder.lengthErrors);
+}
+
+int main(void)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_recorded_frame);
+  RUN_TEST(test_frames_back_to_back);
+  RUN_TEST(test_custom_length);
+  RUN_TEST(test_glitches);
+  RUN_TEST(test_not_a_glitch);
+  RUN_TEST(test_truncated_frames);
+  RUN_TEST(test_parity_errors);
+  RUN_TEST(test_too_long);
+  return UNITY_END();
+}